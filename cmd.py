@@ -18,9 +18,11 @@ print("------------------------")
 
 KEY_MACHINE = "m"
 KEY_LINKER = "l"
+KEY_TRACE = "t"
 
 EXE_BIN_MACHINE = "./bin/test_machine"
 EXE_BIN_LINKER = "./bin/test_elf"
+EXE_BIN_CACHESIM = "./bin/cachesim"
 
 def make_build_directory():
     if not os.path.isdir("./bin/"):
@@ -110,10 +112,29 @@ def build(key):
                     "./src/common/convert.c",
                     "./src/common/cleanup.c",
                     "./src/algorithm/trie.c",
+                    "./src/algorithm/hashtable.c",
                     "./src/algorithm/array.c",
                     "./src/hardware/cpu/isa.c",
                     "./src/hardware/cpu/mmu.c",
                     "./src/hardware/memory/dram.c",
+                    "./src/hardware/memory/dramtiming.c",
+                    "./src/hardware/memory/pagemap.c",
+                    "./src/hardware/memory/swap.c",
+                    "./src/hardware/memory/loader.c",
+                    "./src/process/process.c",
+                    "./src/process/malloc.c",
+                    "./src/common/tagmalloc.c",
+                    "./src/algorithm/linkedlist.c",
+                    "./src/linker/parseElf.c",
+                    "./src/linker/binaryElf.c",
+                    "./src/linker/staticlink.c",
+                    "./src/linker/incremental.c",
+                    "./src/linker/archive.c",
+                    "./src/trace/tracecodec.c",
+                    "./src/trace/tracewriter.c",
+                    "./src/trace/tracereader.c",
+                    "./src/trace/stackdist.c",
+                    "-lpthread",
                     "-o",EXE_BIN_MACHINE
                 ]
             ],
@@ -131,7 +152,11 @@ def build(key):
                     "./src/algorithm/array.c",
                     "./src/algorithm/linkedlist.c",
                     "./src/linker/parseElf.c",
+                    "./src/linker/binaryElf.c",
                     "./src/linker/staticlink.c",
+                    "./src/linker/incremental.c",
+                    "./src/linker/archive.c",
+                    "-lpthread",
                     "-o",EXE_BIN_LINKER
                 ],
                 [
@@ -147,7 +172,11 @@ def build(key):
                     "./src/algorithm/array.c",
                     "./src/algorithm/linkedlist.c",
                     "./src/linker/parseElf.c",
+                    "./src/linker/binaryElf.c",
                     "./src/linker/staticlink.c",
+                    "./src/linker/incremental.c",
+                    "./src/linker/archive.c",
+                    "-lpthread",
                     "-o","./bin/staticlinker.so"
                 ],
                 [
@@ -162,7 +191,56 @@ def build(key):
                     "./src/algorithm/array.c",
                     "./src/algorithm/linkedlist.c",
                     "./src/linker/linker.c",
-                    "-ldl","-o","./bin/link"
+                    "-ldl","-lpthread","-o","./bin/link"
+                ],
+                [
+                    "/usr/bin/gcc-9",
+                    "-Wall","-g","-O0","-Werror","-std=gnu99","-Wno-unused-function",
+                    "-I","./src",
+                    "./src/common/print.c",
+                    "./src/common/convert.c",
+                    "./src/common/cleanup.c",
+                    "./src/common/tagmalloc.c",
+                    "./src/algorithm/hashtable.c",
+                    "./src/algorithm/array.c",
+                    "./src/algorithm/linkedlist.c",
+                    "./src/linker/parseElf.c",
+                    "./src/linker/binaryElf.c",
+                    "./src/linker/elf2bin.c",
+                    "-lpthread",
+                    "-o","./bin/elf2bin"
+                ],
+                [
+                    "/usr/bin/gcc-9",
+                    "-Wall","-g","-O0","-Werror","-std=gnu99","-Wno-unused-function",
+                    "-I","./src",
+                    "./src/common/print.c",
+                    "./src/common/convert.c",
+                    "./src/common/cleanup.c",
+                    "./src/common/tagmalloc.c",
+                    "./src/algorithm/hashtable.c",
+                    "./src/algorithm/array.c",
+                    "./src/algorithm/linkedlist.c",
+                    "./src/linker/parseElf.c",
+                    "./src/linker/binaryElf.c",
+                    "./src/linker/archive.c",
+                    "./src/linker/elfar.c",
+                    "-lpthread",
+                    "-o","./bin/elfar"
+                ]
+            ],
+        KEY_TRACE:[
+                [
+                    "/usr/bin/gcc-9",
+                    "-Wall","-g","-O2","-Werror","-std=gnu99","-Wno-unused-function",
+                    "-I","./src",
+                    "./src/common/print.c",
+                    "./src/common/convert.c",
+                    "./src/trace/tracecodec.c",
+                    "./src/trace/tracereader.c",
+                    "./src/trace/stackdist.c",
+                    "./src/trace/cachesim.c",
+                    "-o",EXE_BIN_CACHESIM
                 ]
             ]
     }
@@ -221,8 +299,11 @@ def clean():
         "*~",
         EXE_BIN_MACHINE,
         EXE_BIN_LINKER,
+        EXE_BIN_CACHESIM,
         "./bin/link",
         "./bin/staticlinker.so",
+        "./bin/elf2bin",
+        "./bin/elfar",
         "./files/exe/output.eof.txt"
     ])
 
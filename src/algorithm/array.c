@@ -41,7 +41,7 @@ int array_insert(array_t** address,uint64_t value){
         // count unchanged
 
         // copy from old to new table
-        for(int i=0; i<arr->size; ++i){
+        for(int i=0; i<arr->count; ++i){
             arr->table[i] = old_table[i];
         }
         // free the old table memory
@@ -7,14 +7,18 @@
 #include "headers/algorithm.h"
 
 
-static uint64_t hash_function(char* str){
-    int p= 31;
-    int m = 1000000007;
+// the hash is below 1000000007: the buckets never split on more bits
+#define HASH_BITS   (30)
 
-    int k = p;
-    int v = 0;
-    for(int i=0; i<strlen(str); ++i){
-        v = (v + ((int)str[i] * k) % m) % m;
+static uint64_t hash_function(char* str){
+    uint64_t p = 31;
+    uint64_t m = 1000000007;
+
+    // 64 bits: k * p does not overflow
+    uint64_t k = p;
+    uint64_t v = 0;
+    for(int i=0; str[i] != '\0'; ++i){
+        v = (v + ((uint64_t)str[i] * k) % m) % m;
         k = (k * p) % m;
     }
     return v;
@@ -27,7 +31,7 @@ static uint64_t lowbits_n(uint64_t num,int length){
 
 static void split_bucket_full(hashtable_t* tab,hashtable_bucket_t* b){
     assert(b != NULL);
-    assert(b->counter <= tab->size);
+    assert(b->counter <= b->capacity);
     assert(b->localdepth < tab->globaldepth);
 
     int before_localdepth = b->localdepth;
@@ -43,9 +47,15 @@ static void split_bucket_full(hashtable_t* tab,hashtable_bucket_t* b){
     // b1 malloc the new heap space
     hashtable_bucket_t* b1 = malloc(sizeof(hashtable_bucket_t));
     b1->counter = 0;
+    // as many slots as b: all its pairs may move to b1
+    b1->capacity = b->capacity;
     b1->localdepth = before_localdepth + 1;
-    b1->karray = malloc(tab->size * sizeof(char*));
-    b1->varray = malloc(tab->size * sizeof(uint64_t));
+    b1->karray = malloc(b1->capacity * sizeof(char*));
+    b1->varray = malloc(b1->capacity * sizeof(uint64_t));
+    for(int j=0; j<b1->capacity; ++j){
+        b1->karray[j] = NULL;
+        b1->varray[j] = 0x0;
+    }
 
     // copy the k-v pairs to new
     uint64_t hid64 = 0;
@@ -69,6 +79,11 @@ static void split_bucket_full(hashtable_t* tab,hashtable_bucket_t* b){
     }
 
     // stll now , all pairs from b have been moved to b0(b) and b1
+    // clear the slots b0 left behind, insert_bucket_tail expects them empty
+    for(int j=b0->counter; j<before_counter; ++j){
+        b0->karray[j] = NULL;
+        b0->varray[j] = 0x0;
+    }
 
     // hid64 now is the last hid64, but the low bits should be the same
     uint64_t hid_lowbits = lowbits_n(hid64,before_localdepth);
@@ -85,7 +100,7 @@ static void split_bucket_full(hashtable_t* tab,hashtable_bucket_t* b){
 
 static void insert_bucket_tail(hashtable_t* tab,hashtable_bucket_t* b,char* key,uint64_t val){
     assert(b->localdepth <= tab->globaldepth);
-    assert(b->counter < tab->size);
+    assert(b->counter < b->capacity);
     assert(b->karray[b->counter] == NULL);
     assert(b->varray[b->counter] == 0x0);
 
@@ -114,6 +129,7 @@ hashtable_t* hashtable_construct(int size){
 
         b->localdepth = 1;
         b->counter = 0;
+        b->capacity = tab->size;
         b->karray = malloc(tab->size * sizeof(char*));
         b->varray = malloc(tab->size * sizeof(uint64_t));
         for(int j=0; j<tab->size; ++j){
@@ -132,13 +148,21 @@ void hashtable_free(hashtable_t* tab){
         return;
     }
     debug_printf(DEBUG_DATASTRUCTURE,"free hashtable:\n");
-    print_hashtable(tab);
+    // dump the small tables only: a symbol index of the linker has ~100k keys
+    if((DEBUG_VERBOSE_SET & DEBUG_DATASTRUCTURE) != 0 && tab->num <= 64){
+        print_hashtable(tab);
+    }
     
     for(int i=0; i<tab->num; ++i){
         hashtable_bucket_t* b = tab->directory[i];
         if(b == NULL){
             continue;
         }
+        // a bucket is shared by the slots of the same low localdepth bits:
+        // free it once, from the lowest slot
+        for(int j=i; j<tab->num; j+=(1 << b->localdepth)){
+            tab->directory[j] = NULL;
+        }
         for(int j=0; j<b->counter; ++j){
             if(b->karray != NULL && b->karray[j] != NULL){
                 free(b->karray[j]);
@@ -180,6 +204,29 @@ int hashtable_get(hashtable_t* tab,char* key,uint64_t* valptr){
     return 0;
 }
 
+// splitting can not separate the keys of the full bucket b from key:
+// they all have its hash
+static int same_hash(hashtable_bucket_t* b,uint64_t hid64){
+    for(int i=0; i<b->counter; ++i){
+        if(hash_function(b->karray[i]) != hid64){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// double the slots of the bucket, it is never split again
+static void grow_bucket(hashtable_bucket_t* b){
+    int old_capacity = b->capacity;
+    b->capacity *= 2;
+    b->karray = realloc(b->karray,b->capacity * sizeof(char*));
+    b->varray = realloc(b->varray,b->capacity * sizeof(uint64_t));
+    for(int j=old_capacity; j<b->capacity; ++j){
+        b->karray[j] = NULL;
+        b->varray[j] = 0x0;
+    }
+}
+
 int hashtable_insert(hashtable_t** address,char* key,uint64_t value){
     hashtable_t* tab = *address;
     assert(tab != NULL);
@@ -188,11 +235,18 @@ int hashtable_insert(hashtable_t** address,char* key,uint64_t value){
     uint64_t hid = lowbits_n(hid64,tab->globaldepth);
 
     hashtable_bucket_t* b = tab->directory[hid];
-    if(b->counter < tab->size){
+    if(b->counter < b->capacity){
         // existing empty slot for inserting
         insert_bucket_tail(tab,b,key,value);
         return 1;
+    }else if(same_hash(b,hid64)){
+        // the colliding keys stay in one bucket instead of doubling the directory forever
+        grow_bucket(b);
+        insert_bucket_tail(tab,b,key,value);
+        return 1;
     }else{
+        // the keys differ in the low HASH_BITS bits: a split separates them
+        assert(b->localdepth < HASH_BITS);
         // full for this bucket's k-v array, expending the whole table or split
         if(b->localdepth == tab->globaldepth){
             // expand the array - double the size
@@ -204,29 +258,19 @@ int hashtable_insert(hashtable_t** address,char* key,uint64_t value){
             tab->num = 1 << tab->globaldepth;
             tab->directory = malloc(tab->num * sizeof(hashtable_bucket_t*));
 
-            // copy the old array to the new
+            // copy the old array to the new, both halves point to the same buckets
+            // the full bucket is then split like any other one
             for(int i=0; i<old_num; ++i){
-                if(b != old_array[i]){
-                    // this bucket is not changed - point to the same heap address fo bucket
-                    tab->directory[i] = old_array[i];
-                    tab->directory[i + (1 << (tab->globaldepth - 1))] = old_array[i];
-                }
+                tab->directory[i] = old_array[i];
+                tab->directory[i + old_num] = old_array[i];
             }
-            // for the bucket to be inserted,split
-            split_bucket_full(tab,b);
-
-            // finally, insert the input pair
-            hid = lowbits_n(hid64,tab->globaldepth);
-            insert_bucket_tail(tab,tab->directory[hid],key,value);
-
             free(old_array);
-            return 1;
-        }else{
-            // localdepth < globaldepth, split
-            split_bucket_full(tab,b);
-            insert_bucket_tail(tab,tab->directory[hid],key,value);
-            return 1;
         }
+        // localdepth < globaldepth, split
+        split_bucket_full(tab,b);
+
+        // all the pairs may have gone to the side of the key: split again
+        return hashtable_insert(address,key,value);
     }
     return 0;
 }
@@ -86,6 +86,9 @@ int linkedlist_delete(linkedlist_t* list,linkedlist_node_t* node){
     // same for the only one node situation
     node->prev->next = node->next;
     node->next->prev = node->prev;
+    if(list->head == node){
+        list->head = node->next;
+    }
     // free the node managed by the list
     free(node);
     list->count--;
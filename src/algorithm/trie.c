@@ -29,7 +29,8 @@ static char get_char(int id){
 }
 
 trie_node_t* trie_construct(){
-    trie_node_t* root = malloc(sizeof(trie_node_t));
+    // calloc: all next[] pointers must start as NULL
+    trie_node_t* root = calloc(1,sizeof(trie_node_t));
     root->isvalid = 0;
     root->value = 0;
     return root;
@@ -58,7 +59,7 @@ int trie_insert(trie_node_t** address,char* key,uint64_t value){
 
         int id = get_index(key[i]);
         if(p->next[id] == NULL){
-            p->next[id] = malloc(sizeof(trie_node_t));
+            p->next[id] = calloc(1,sizeof(trie_node_t));
             p->next[id]->isvalid = 0;
             p->next[id]->value = 0;
         }
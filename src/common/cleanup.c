@@ -29,7 +29,7 @@ void finally_cleanup(){
         uint64_t address;
         assert(array_get(events,i,&address) != 0);
 
-        cleanup_t* func;
+        cleanup_t func;
         *(uint64_t*)&func = address;
         (*func)();
     }
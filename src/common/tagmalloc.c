@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "headers/common.h"
 #include "headers/algorithm.h"
 
@@ -20,21 +21,27 @@ typedef struct{
 // and also cleanup events(array) cannot use tag_*()
 static linkedlist_t* tag_list = NULL;
 
+// the list is shared by the threads, e.g. the parsers of the link driver
+static pthread_mutex_t tag_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static uint64_t compute_tag(char* str){
-    int p = 31;
-    int m = 1000000007;
+    uint64_t p = 31;
+    uint64_t m = 1000000007;
 
-    int k = p;
-    int v = 0;
-    for(int i=0; i<strlen(str); ++i){
-        v = (v + ((int)str[i] * k) % m) % m;
+    uint64_t k = p;
+    uint64_t v = 0;
+    for(int i=0; str[i]!='\0'; ++i){
+        v = (v + ((uint64_t)str[i] * k) % m) % m;
         k = (k * p) % m;
     }
     return v;
 }
 
 static void tag_destroy(){
-    for(int i=0; i<tag_list->count; ++i){
+    pthread_mutex_lock(&tag_lock);
+    // the count drops while deleting
+    uint64_t count = tag_list->count;
+    for(uint64_t i=0; i<count; ++i){
         linkedlist_node_t* p = linkedlist_next(tag_list);
         tag_block_t* b = (tag_block_t*)p->value;
 
@@ -46,6 +53,8 @@ static void tag_destroy(){
         linkedlist_delete(tag_list,p);
     }
     linkedlist_free(tag_list);
+    tag_list = NULL;
+    pthread_mutex_unlock(&tag_lock);
 }
 
 void* tag_malloc(uint64_t size, char* tagstr){
@@ -57,6 +66,7 @@ void* tag_malloc(uint64_t size, char* tagstr){
     b->ptr = malloc(size);
 
     // manage the block 
+    pthread_mutex_lock(&tag_lock);
     if(tag_list == NULL){
         tag_list = linkedlist_construct();
         // remember to clean the tag_list finally
@@ -64,6 +74,7 @@ void* tag_malloc(uint64_t size, char* tagstr){
     }
     // add the heap address to the managing list
     linkedlist_add(&tag_list,(uint64_t)b);
+    pthread_mutex_unlock(&tag_lock);
 
     return b->ptr;
 }
@@ -71,10 +82,11 @@ void* tag_malloc(uint64_t size, char* tagstr){
 int tag_free(void* ptr){
     int found = 0;
 
-    // it's very slow because we are managing it
-    for(int i=0; i<tag_list->count; ++i){
-        linkedlist_node_t* p = linkedlist_next(tag_list);
-
+    // it's very slow because we are managing it,
+    // the recent blocks are freed first: search from the tail
+    pthread_mutex_lock(&tag_lock);
+    linkedlist_node_t* p = tag_list == NULL || tag_list->count == 0 ? NULL : tag_list->head->prev;
+    for(uint64_t i=0; p != NULL && i<tag_list->count; ++i){
         tag_block_t* b = (tag_block_t*)p->value;
         if(b->ptr == ptr){
             // found this block
@@ -84,7 +96,9 @@ int tag_free(void* ptr){
             found = 1;
             break;
         }
+        p = p->prev;
     }
+    pthread_mutex_unlock(&tag_lock);
     if(found == 0){
         // or we should exit the process at once?
         return 0;
@@ -99,7 +113,9 @@ void tag_sweep(char* tagstr){
     // CALL THIS FUNCTION ONLY IF YOU ARE VERY CONFIDENT
     uint64_t tag = compute_tag(tagstr);
 
-    for(int i=0; i<tag_list->count; ++i){
+    pthread_mutex_lock(&tag_lock);
+    uint64_t count = tag_list == NULL ? 0 : tag_list->count;
+    for(uint64_t i=0; i<count; ++i){
         linkedlist_node_t* p = linkedlist_next(tag_list);
 
         tag_block_t* b = (tag_block_t*)p->value;
@@ -112,4 +128,5 @@ void tag_sweep(char* tagstr){
             linkedlist_delete(tag_list,p);
         }
     }
+    pthread_mutex_unlock(&tag_lock);
 }
@@ -6,6 +6,7 @@
 #include "headers/memory.h"
 #include "headers/algorithm.h"
 #include "headers/instruction.h"
+#include "headers/process.h"
 
 
 
@@ -101,6 +102,7 @@ static void lazy_initialize_trie(){
     trie_insert(&register_mapping, "%r15d",  (uint64_t)&(cpu_reg.r15d)   );
     trie_insert(&register_mapping, "%r15w",  (uint64_t)&(cpu_reg.r15w)   );
     trie_insert(&register_mapping, "%r15b",  (uint64_t)&(cpu_reg.r15b)   );
+    trie_insert(&register_mapping, "%rip",   (uint64_t)&(cpu_pc.rip)     );
 
     // initialize the operator mapping
     operator_mapping = trie_construct();
@@ -116,6 +118,8 @@ static void lazy_initialize_trie(){
     trie_insert(&operator_mapping, "cmpq",   INST_CMP    );
     trie_insert(&operator_mapping, "jne",    INST_JNE    );
     trie_insert(&operator_mapping, "jmp",    INST_JMP    );
+    trie_insert(&operator_mapping, "syscall",INST_SYSCALL);
+    trie_insert(&operator_mapping, "lea",    INST_LEA    );
 
     trie_print(operator_mapping);
     trie_print(register_mapping);
@@ -138,6 +142,14 @@ static uint64_t try_get_from_trie(trie_node_t** root,char* key){
     return val;
 }
 
+// %rip reads as the address of the next instruction, as on x86
+static uint64_t reg_value(uint64_t reg){
+    if(reg == (uint64_t)&(cpu_pc.rip)){
+        return cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR;
+    }
+    return *((uint64_t *)reg);
+}
+
 /**
  * @brief decode the operand value e.g. "(%rsp,%rbx)"  "0xabcd(%rsp,%rbx)" etc
  * 
@@ -162,21 +174,21 @@ static uint64_t compute_operand(od_t* od){
         if(od->type == MEM_IMM){
             vaddr = od->imm;
         }else if(od->type == MEM_REG1){
-            vaddr = *((uint64_t *)od->reg1);
+            vaddr = reg_value(od->reg1);
         }else if(od->type == MEM_IMM_REG1){
-            vaddr = od->imm + (*((uint64_t *)od->reg1));
+            vaddr = od->imm + reg_value(od->reg1);
         }else if(od->type == MEM_REG1_REG2){
-            vaddr = (*((uint64_t *)od->reg1)) + (*((uint64_t *)od->reg2));
+            vaddr = reg_value(od->reg1) + reg_value(od->reg2);
         }else if(od->type == MEM_IMM_REG1_REG2){
-            vaddr = od->imm + (*((uint64_t *)od->reg1)) + (*((uint64_t *)od->reg2));
+            vaddr = od->imm + reg_value(od->reg1) + reg_value(od->reg2);
         }else if(od->type == MEM_REG2_SCAL){
-            vaddr = (*((uint64_t *)od->reg2)) * od->scal;
+            vaddr = reg_value(od->reg2) * od->scal;
         }else if(od->type == MEM_IMM_REG2_SCAL){
-            vaddr = od->imm + (*((uint64_t *)od->reg2)) * od->scal;
+            vaddr = od->imm + reg_value(od->reg2) * od->scal;
         }else if(od->type == MEM_REG1_REG2_SCAL){
-            vaddr = (*((uint64_t *)od->reg1)) + (*((uint64_t *)od->reg2)) * od->scal;
+            vaddr = reg_value(od->reg1) + reg_value(od->reg2) * od->scal;
         }else if(od->type == MEM_IMM_REG1_REG2_SCAL){
-            vaddr = od->imm + (*((uint64_t *)od->reg1)) + (*((uint64_t *)od->reg2)) * od->scal;
+            vaddr = od->imm + reg_value(od->reg1) + reg_value(od->reg2) * od->scal;
         }
         return vaddr;
     }
@@ -192,6 +204,7 @@ static uint64_t compute_operand(od_t* od){
  */
 static void parse_operand(const char* str, od_t *od){
     od->type = EMPTY;
+    od->indirect = 0;
     od->imm  = 0;
     od->reg1 = 0;
     od->reg2 = 0;
@@ -202,6 +215,12 @@ static void parse_operand(const char* str, od_t *od){
         // empty operand
         return;
     }
+    if(str[0] == '*'){
+        // indirect branch, e.g. "jmp    *0x601018": the rest is the operand holding the target
+        parse_operand(str + 1,od);
+        od->indirect = 1;
+        return;
+    }
     if(str[0] == '$'){
         // immediate number
         od->type = IMM;
@@ -350,9 +369,9 @@ static void parse_instruction(const char* str, inst_t *inst){
 
     char op_str[8]        = {'\0'};
     uint8_t  op_len       = 0;
-    char src_str[16]      = {'\0'};
+    char src_str[MAX_INSTRUCTION_CHAR] = {'\0'};
     uint8_t  src_len      = 0;
-    char dst_str[16]      = {'\0'};
+    char dst_str[MAX_INSTRUCTION_CHAR] = {'\0'};
     uint8_t  dst_len      = 0;
 
     uint8_t str_len             =  strlen(str);
@@ -426,6 +445,8 @@ static void sub_handler        (od_t* src_od,od_t* dst_od);
 static void cmp_handler        (od_t* src_od,od_t* dst_od);
 static void jne_handler        (od_t* src_od,od_t* dst_od);
 static void jmp_handler        (od_t* src_od,od_t* dst_od);
+static void syscall_handler    (od_t* src_od,od_t* dst_od);
+static void lea_handler        (od_t* src_od,od_t* dst_od);
 
 
 // handler table storing the handlers to different instruction types
@@ -454,6 +475,8 @@ static handler_t handler_table[NUM_INSTRTYPE] = {
     &cmp_handler,             // 8
     &jne_handler,             // 9 
     &jmp_handler,             // 10 
+    &syscall_handler,         // 11
+    &lea_handler,             // 12
 };
 
 // update the rip pointer (PC) to the next instruction aequentially
@@ -485,11 +508,11 @@ static void mov_handler (od_t* src_od,od_t* dst_od){
     }else if(src_od->type == REG && dst_od->type >= MEM_IMM){
         // src: register
         // dst: virtual address
-        write64bits_dram(va2pa(dst),*(uint64_t*)src);
+        write64bits_vaddr(dst,*(uint64_t*)src);
     }else if(src_od->type >= MEM_IMM && dst_od->type == REG){
         // src: virtual address
         // dst: register
-        *(uint64_t*)dst = read64bits_dram(va2pa(src));
+        *(uint64_t*)dst = read64bits_vaddr(src);
     }else if(src_od->type == IMM && dst_od->type == REG){
         // src: immediate number (uint64_t bit map)
         // dst: register
@@ -512,7 +535,7 @@ static void push_handler (od_t* src_od,od_t* dst_od){
         // src: register
         // dst empty
         cpu_reg.rsp = cpu_reg.rsp - 8;
-        write64bits_dram(va2pa(cpu_reg.rsp),*(uint64_t*)src);
+        write64bits_vaddr(cpu_reg.rsp,*(uint64_t*)src);
     }
     next_rip();
     cpu_flags.__flag_value = 0;
@@ -530,7 +553,7 @@ static void pop_handler (od_t* src_od,od_t* dst_od){
     if(src_od->type == REG){
         // src: register
         // dst empty
-        uint64_t old_val = read64bits_dram(va2pa(cpu_reg.rsp));
+        uint64_t old_val = read64bits_vaddr(cpu_reg.rsp);
         cpu_reg.rsp = cpu_reg.rsp + 8;
         *(uint64_t*)src = old_val;
     }
@@ -549,13 +572,25 @@ static void leave_handler (od_t* src_od,od_t* dst_od){
     cpu_reg.rsp = cpu_reg.rbp;
 
     // popq %rbp
-    uint64_t old_val = read64bits_dram(va2pa(cpu_reg.rsp));
+    uint64_t old_val = read64bits_vaddr(cpu_reg.rsp);
     cpu_reg.rsp = cpu_reg.rsp + 8;
     cpu_reg.rbp = old_val;
     next_rip();
     cpu_flags.__flag_value = 0;
 }
 
+// the target of jmp and call: the operand itself, or loaded from it if indirect
+static uint64_t branch_target(od_t* od){
+    uint64_t target = compute_operand(od);
+    if(od->indirect == 0){
+        return target;
+    }
+    if(od->type == REG){
+        return *(uint64_t*)target;
+    }
+    return read64bits_vaddr(target);
+}
+
 /**
  * @brief 
  * 
@@ -563,13 +598,13 @@ static void leave_handler (od_t* src_od,od_t* dst_od){
  * @param dst_od 
  */
 static void call_handler (od_t* src_od,od_t* dst_od){
-    uint64_t src = compute_operand(src_od);
+    uint64_t src = branch_target(src_od);
 
     // src: immediate number:virtual address for target function starting
     // dst: empty
     // push the return value
     cpu_reg.rsp = cpu_reg.rsp - 8;
-    write64bits_dram(va2pa(cpu_reg.rsp),cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR);
+    write64bits_vaddr(cpu_reg.rsp,cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR);
 
     // jump to target function address
     cpu_pc.rip = src;
@@ -586,7 +621,7 @@ static void ret_handler (od_t* src_od,od_t* dst_od){
     // src: empty
     // dst: empty
     // pop rsp register
-    uint64_t ret_addr = read64bits_dram(va2pa(cpu_reg.rsp));
+    uint64_t ret_addr = read64bits_vaddr(cpu_reg.rsp);
     cpu_reg.rsp = cpu_reg.rsp + 8;
 
     // jump to target address
@@ -676,7 +711,7 @@ static void cmp_handler (od_t* src_od,od_t* dst_od){
         // src: immediate number
         // dst: register (value: int64_t bit map)
         // dst = dst - src = dst + (~src + 1)
-        uint64_t dval = read64bits_dram(va2pa(dst));
+        uint64_t dval = read64bits_vaddr(dst);
         uint64_t val = dval + (~src + 1);
 
         // set condition
@@ -725,11 +760,43 @@ static void jne_handler (od_t* src_od,od_t* dst_od){
  * @param dst_od 
  */
 static void jmp_handler (od_t* src_od,od_t* dst_od){
-    uint64_t src = compute_operand(src_od);
+    uint64_t src = branch_target(src_od);
     cpu_pc.rip = src;
     cpu_flags.__flag_value = 0;
 }
 
+/**
+ * @brief load the effective address of the memory operand
+ * 
+ * @param src_od 
+ * @param dst_od 
+ */
+static void lea_handler (od_t* src_od,od_t* dst_od){
+    uint64_t src = compute_operand(src_od);
+    uint64_t dst = compute_operand(dst_od);
+
+    if(src_od->type >= MEM_IMM && dst_od->type == REG){
+        // src: virtual address
+        // dst: register
+        *(uint64_t*)dst = src;
+    }
+    next_rip();
+    cpu_flags.__flag_value = 0;
+}
+
+/**
+ * @brief trap into the system call of number rax,
+ *        a process forked here resumes at the next instruction
+ *
+ * @param src_od
+ * @param dst_od
+ */
+static void syscall_handler (od_t* src_od,od_t* dst_od){
+    next_rip();
+    cpu_flags.__flag_value = 0;
+    do_syscall();
+}
+
 // instruction cycle is implemented in CPU
 // the only exposed interface outside CPU
 /**
@@ -740,7 +807,7 @@ void instruction_cycle(){
     // FETCH: get the instruction string by program counter
     //const char* inst_str = (const char*)cpu_pc.rip;
     char inst_str[MAX_INSTRUCTION_CHAR + 10];
-    readinst_dram(va2pa(cpu_pc.rip),inst_str);
+    readinst_vaddr(cpu_pc.rip,inst_str);
     debug_printf(DEBUG_INSTRUCTIONCYCLE,"%8lx     %s\n",cpu_pc.rip,inst_str);
 
     // DECODE: decode the run-time instruction operands
@@ -750,6 +817,7 @@ void instruction_cycle(){
     // EXECUTE: get the function pointer or handler by the operator
     handler_t handler = handler_table[inst.op];
     handler(&(inst.src),&(inst.dst));
+    cpu_cycles += 1;
 }
 
 void print_register(){
@@ -771,13 +839,10 @@ void print_stack(){
         return;
     }
     int n = 10;
-    uint64_t* high = (uint64_t*)&pm[va2pa(cpu_reg.rsp)];
-    high = &high[n];
     uint64_t va = cpu_reg.rsp + n * 8;
 
     for (int i = 0; i < 2 * n; ++ i){
-        uint64_t *ptr = (uint64_t *)(high - i);
-        printf("0x%16lx : %16lx", va, (uint64_t)*ptr);
+        printf("0x%16lx : %16lx", va, read64bits_vaddr(va));
 
         if (i == n){
             printf(" <== rsp");
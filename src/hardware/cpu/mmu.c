@@ -3,10 +3,755 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
+#include "headers/common.h"
 #include "headers/cpu.h"
 #include "headers/memory.h"
+#include "headers/trace.h"
 
+/*=================================*/
+/*      page walk and page fault   */
+/*=================================*/
+
+static int thp_enabled = 0;
+
+// the leaf entry found by the walker
+typedef struct{
+    uint64_t    paddr;
+    uint64_t    ppn;            // ppn of the start of the 4KB / 2MB / 1GB page
+    int         offset_length;  // 12, 21 or 30
+    pte_t*      pte;
+}walk_result_t;
+
+// host address of the entry [index] in the page table frame
+static inline pte_t* table_entry(uint64_t table_ppn, uint64_t index){
+    return (pte_t*)pm_frame(table_ppn) + index;
+}
+
+// index into the table of level 1 (PGD) to 4 (PT)
+static inline uint64_t table_index(uint64_t vaddr, int level){
+    int shift = PHYSICAL_PAGE_OFFSET_LENGTH + (4 - level) * PAGE_TABLE_ENTRY_LENGTH;
+    return (vaddr >> shift) & (PAGE_TABLE_ENTRY_NUM - 1);
+}
+
+// page table frames are zero filled by the allocator and pinned
+static uint64_t allocate_page_table(){
+    uint64_t ppn = pm_frame_alloc();
+    pm_meta(ppn)->pinned = 1;
+    return ppn;
+}
+
+static void thp_try_promote(pte_t* pmd, uint64_t vaddr);
+
+/**
+ * @brief bring the user page into a resident frame
+ *
+ * @param pte level 4 entry of the page
+ * @param pte_paddr physical address of the entry
+ * @param vaddr faulting virtual address
+ */
+static void page_fault_handler(pte_t* pte, uint64_t pte_paddr, uint64_t vaddr){
+    assert(pte->present == 0);
+    cpu_controls.cr2 = vaddr;
+
+    // the frame may come from evicting another page
+    uint64_t ppn = paging_acquire_frame();
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    meta->swap_id = 0;
+
+    if(pte->swap_id != 0){
+        // major fault: read back from the swap device
+        swap_in(pte->swap_id,ppn);
+        paging_stats.major_faults += 1;
+        debug_printf(DEBUG_MMU,"major page fault: vaddr %lx swap slot %lu -> frame %lx\n",vaddr,pte->swap_id - 1,ppn);
+    }else{
+        // minor fault: demand zero page, or the first touch of the loaded image
+        memset(pm_frame(ppn),0,PHYSICAL_PAGE_SIZE);
+        loader_populate(vaddr & ~PHYSICAL_PAGE_OFFSET_MASK,pm_frame(ppn));
+        paging_stats.minor_faults += 1;
+        debug_printf(DEBUG_MMU,"minor page fault: vaddr %lx -> frame %lx\n",vaddr,ppn);
+    }
+
+    pte->pte_value = 0;
+    pte->present = 1;
+    pte->usermode = 1;
+    pte->readonly = loader_is_readonly(vaddr);
+    pte->ppn = ppn;
+    paging_track_frame(ppn,vaddr,pte_paddr);
+}
+
+/**
+ * @brief write to a page shared by fork: copy it unless this is the last mapping
+ *
+ * @param pte leaf entry of the 4KB / 2MB / 1GB page
+ * @param pte_paddr physical address of the entry
+ * @param vaddr faulting virtual address
+ * @param offset_length size of the page
+ */
+static void cow_fault_handler(pte_t* pte, uint64_t pte_paddr, uint64_t vaddr, int offset_length){
+    cpu_controls.cr2 = vaddr;
+    uint64_t old = pte->ppn;
+    uint64_t page = vaddr & ~(((uint64_t)1 << offset_length) - 1);
+    uint64_t num_frames = (uint64_t)1 << (offset_length - PHYSICAL_PAGE_OFFSET_LENGTH);
+
+    if(pm_meta(old)->refcount == 1){
+        // the other mappings have gone: take the frame over
+        if(offset_length == PHYSICAL_PAGE_OFFSET_LENGTH){
+            paging_adopt_frame(old);
+            paging_track_frame(old,vaddr,pte_paddr);
+        }
+        paging_stats.cow_reused += 1;
+        debug_printf(DEBUG_MMU,"copy on write: vaddr %lx reuses frame %lx\n",page,old);
+    }else{
+        uint64_t ppn;
+        if(offset_length == PHYSICAL_PAGE_OFFSET_LENGTH){
+            ppn = paging_acquire_frame();
+            pm_meta(ppn)->swap_id = 0;
+            memcpy(pm_frame(ppn),pm_frame(old),PHYSICAL_PAGE_SIZE);
+            paging_track_frame(ppn,vaddr,pte_paddr);
+        }else{
+            ppn = pm_frame_alloc_contiguous(num_frames);
+            for(uint64_t i=0; i<num_frames; ++i){
+                memcpy(pm_frame(ppn + i),pm_frame(old + i),PHYSICAL_PAGE_SIZE);
+            }
+        }
+        // the refcount of a huge page is kept in its first frame
+        pm_frame_put(old);
+        pte->ppn = ppn;
+        paging_stats.cow_copied += 1;
+        debug_printf(DEBUG_MMU,"copy on write: vaddr %lx frame %lx -> %lx\n",page,old,ppn);
+    }
+    pte->readonly = 0;
+    pte->cow = 0;
+
+    for(uint64_t i=0; i<num_frames; ++i){
+        mmu_invalidate(page + i * PHYSICAL_PAGE_SIZE);
+    }
+}
+
+/**
+ * @brief walk the 4-level page table from cr3, fault in the page if needed
+ *
+ * @param vaddr virtual address
+ * @param write 1 if the access writes the page
+ * @param result the leaf entry and the physical address
+ */
+static void page_walk(uint64_t vaddr, int write, walk_result_t* result){
+    paging_stats.virtual_time += 1;
+    tlb_stats.page_walks += 1;
+
+    if(cpu_controls.cr3 == 0){
+        cpu_controls.cr3 = allocate_page_table() << PHYSICAL_PAGE_OFFSET_LENGTH;
+    }
+
+    // PGD -> PUD -> PMD: create the missing tables on the way
+    // a PUD or PMD entry with the hugepage bit maps a 1GB or 2MB page
+    uint64_t table_ppn = cpu_controls.cr3 >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    pte_t* pmd = NULL;
+    pte_t* pte = NULL;
+    uint64_t pte_paddr = 0;
+    for(int level=1; level<=3; ++level){
+        pte = table_entry(table_ppn,table_index(vaddr,level));
+        tlb_stats.walk_references += 1;
+
+        if(pte->present == 1 && pte->hugepage == 1){
+            assert(level == 2 || level == 3);
+            result->offset_length = level == 2 ? PAGE_1G_OFFSET_LENGTH : PAGE_2M_OFFSET_LENGTH;
+            pte_paddr = (table_ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + table_index(vaddr,level) * sizeof(pte_t);
+            goto LEAF_FOUND;
+        }
+        if(pte->present == 0){
+            pte->pte_value = 0;
+            pte->present = 1;
+            pte->usermode = 1;
+            pte->ppn = allocate_page_table();
+        }
+        pmd = pte;
+        table_ppn = pte->ppn;
+    }
+
+    // PT
+    uint64_t index = table_index(vaddr,4);
+    pte = table_entry(table_ppn,index);
+    pte_paddr = (table_ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + index * sizeof(pte_t);
+    tlb_stats.walk_references += 1;
+    if(pte->present == 0){
+        page_fault_handler(pte,pte_paddr,vaddr);
+
+        if(thp_enabled == 1){
+            thp_try_promote(pmd,vaddr);
+            if(pmd->hugepage == 1){
+                pte = pmd;
+                result->offset_length = PAGE_2M_OFFSET_LENGTH;
+                goto LEAF_FOUND;
+            }
+        }
+    }
+    result->offset_length = PHYSICAL_PAGE_OFFSET_LENGTH;
+
+    LEAF_FOUND:
+    if(write == 1 && pte->readonly == 1){
+        if(pte->cow == 0){
+            debug_printf(DEBUG_MMU,"protection fault: write to read-only vaddr %lx\n",vaddr);
+            exit(1);
+        }
+        cow_fault_handler(pte,pte_paddr,vaddr,result->offset_length);
+    }
+
+    pte->reference = 1;
+    if(write == 1){
+        pte->dirty = 1;
+    }
+    uint64_t offset_mask = ((uint64_t)1 << result->offset_length) - 1;
+    result->pte = pte;
+    result->ppn = pte->ppn;
+    result->paddr = ((uint64_t)pte->ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + (vaddr & offset_mask);
+}
+
+// drop a mapping of the 4KB user frame, the last one frees its clean copy too
+static void put_user_frame(uint64_t ppn){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    if(meta->refcount == 1){
+        paging_untrack_frame(ppn);
+        swap_slot_put(meta->swap_id);
+    }
+    paging_stats.frames_freed += pm_frame_put(ppn);
+}
+
+static void free_page_table(uint64_t table_ppn, int level){
+    for(int i=0; i<PAGE_TABLE_ENTRY_NUM; ++i){
+        pte_t* pte = table_entry(table_ppn,i);
+        if(pte->present == 0){
+            // the swap slot of a swapped out page
+            swap_slot_put(pte->swap_id);
+            continue;
+        }
+        // a frame shared by fork is freed with its last mapping
+        if(level == 4){
+            put_user_frame(pte->ppn);
+        }else if(pte->hugepage == 1){
+            int offset_length = level == 2 ? PAGE_1G_OFFSET_LENGTH : PAGE_2M_OFFSET_LENGTH;
+            uint64_t num_frames = (uint64_t)1 << (offset_length - PHYSICAL_PAGE_OFFSET_LENGTH);
+            if(pm_frame_put(pte->ppn) == 1){
+                for(uint64_t j=1; j<num_frames; ++j){
+                    pm_frame_free(pte->ppn + j);
+                }
+                paging_stats.frames_freed += num_frames;
+            }
+        }else{
+            free_page_table(pte->ppn,level + 1);
+        }
+    }
+    pm_frame_free(table_ppn);
+}
+
+/**
+ * @brief free all the frames and page tables of the address space,
+ *        the next access starts from an empty page table
+ */
+void mmu_free_address_space(){
+    if(cpu_controls.cr3 != 0){
+        free_page_table(cpu_controls.cr3 >> PHYSICAL_PAGE_OFFSET_LENGTH,1);
+        cpu_controls.cr3 = 0;
+    }
+    softtlb_flush();
+    tlb_flush();
+}
+
+/**
+ * @brief drop the 4KB page at vaddr, its frame is freed with the last mapping
+ *
+ * @param vaddr
+ */
+void mmu_unmap_page(uint64_t vaddr){
+    if(cpu_controls.cr3 == 0){
+        return;
+    }
+    uint64_t table_ppn = cpu_controls.cr3 >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    for(int level=1; level<=3; ++level){
+        pte_t* pte = table_entry(table_ppn,table_index(vaddr,level));
+        if(pte->present == 0){
+            return;
+        }
+        // a huge page is unmapped as a whole only
+        assert(pte->hugepage == 0);
+        table_ppn = pte->ppn;
+    }
+
+    pte_t* pte = table_entry(table_ppn,table_index(vaddr,4));
+    if(pte->present == 1){
+        put_user_frame(pte->ppn);
+    }else{
+        swap_slot_put(pte->swap_id);
+    }
+    pte->pte_value = 0;
+    mmu_invalidate(vaddr);
+}
+
+// copy the tables, share the pages read-only
+static uint64_t fork_page_table(uint64_t table_ppn, int level){
+    uint64_t copy = allocate_page_table();
+    for(int i=0; i<PAGE_TABLE_ENTRY_NUM; ++i){
+        pte_t* src = table_entry(table_ppn,i);
+        pte_t* dst = table_entry(copy,i);
+        if(src->present == 0){
+            // demand zero, or a swap slot shared from now on
+            if(src->swap_id != 0){
+                swap_slot_get(src->swap_id);
+            }
+            *dst = *src;
+            continue;
+        }
+        if(level < 4 && src->hugepage == 0){
+            *dst = *src;
+            dst->ppn = fork_page_table(src->ppn,level + 1);
+            continue;
+        }
+
+        // the read-only pages of the image are shared as they are
+        if(src->readonly == 0){
+            src->readonly = 1;
+            src->cow = 1;
+        }
+        if(level == 4 && pm_meta(src->ppn)->refcount == 1){
+            // a shared frame cannot be evicted through one of its ptes
+            paging_untrack_frame(src->ppn);
+        }
+        pm_frame_get(src->ppn);
+        *dst = *src;
+        paging_stats.cow_shared += 1;
+    }
+    return copy;
+}
+
+/**
+ * @brief duplicate the address space for fork, the pages are shared
+ *        copy on write
+ *
+ * @return uint64_t cr3 of the child
+ */
+uint64_t mmu_fork_address_space(){
+    if(cpu_controls.cr3 == 0){
+        cpu_controls.cr3 = allocate_page_table() << PHYSICAL_PAGE_OFFSET_LENGTH;
+    }
+    uint64_t pgd = fork_page_table(cpu_controls.cr3 >> PHYSICAL_PAGE_OFFSET_LENGTH,1);
+
+    // the writable pages of the parent are read-only now
+    softtlb_flush();
+    tlb_flush();
+    return pgd << PHYSICAL_PAGE_OFFSET_LENGTH;
+}
+
+/*=================================*/
+/*      huge pages                 */
+/*=================================*/
+
+void mmu_set_thp(int enable){
+    thp_enabled = enable;
+}
+
+/**
+ * @brief map a 2MB or 1GB page at vaddr, backed by contiguous zero frames
+ *        the huge page is pinned: it is never swapped out
+ *
+ * @param vaddr aligned to the page size
+ * @param offset_length PAGE_2M_OFFSET_LENGTH or PAGE_1G_OFFSET_LENGTH
+ */
+void mmu_map_hugepage(uint64_t vaddr, int offset_length){
+    assert(offset_length == PAGE_2M_OFFSET_LENGTH || offset_length == PAGE_1G_OFFSET_LENGTH);
+    assert((vaddr & (((uint64_t)1 << offset_length) - 1)) == 0);
+
+    if(cpu_controls.cr3 == 0){
+        cpu_controls.cr3 = allocate_page_table() << PHYSICAL_PAGE_OFFSET_LENGTH;
+    }
+
+    // the 1GB leaf is in PUD (level 2), the 2MB leaf in PMD (level 3)
+    int leaf_level = offset_length == PAGE_1G_OFFSET_LENGTH ? 2 : 3;
+    uint64_t table_ppn = cpu_controls.cr3 >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    for(int level=1; level<leaf_level; ++level){
+        pte_t* pte = table_entry(table_ppn,table_index(vaddr,level));
+        if(pte->present == 0){
+            pte->pte_value = 0;
+            pte->present = 1;
+            pte->usermode = 1;
+            pte->ppn = allocate_page_table();
+        }
+        assert(pte->hugepage == 0);
+        table_ppn = pte->ppn;
+    }
+
+    pte_t* leaf = table_entry(table_ppn,table_index(vaddr,leaf_level));
+    if(leaf->present == 1){
+        debug_printf(DEBUG_MMU,"huge page: vaddr %lx is already mapped\n",vaddr);
+        exit(1);
+    }
+
+    uint64_t num_frames = (uint64_t)1 << (offset_length - PHYSICAL_PAGE_OFFSET_LENGTH);
+    uint64_t ppn = pm_frame_alloc_contiguous(num_frames);
+
+    leaf->pte_value = 0;
+    leaf->present = 1;
+    leaf->usermode = 1;
+    leaf->hugepage = 1;
+    leaf->ppn = ppn;
+}
+
+/**
+ * @brief transparent huge page: promote the 2MB region of vaddr
+ *        if it is aligned and all of its 512 4KB pages are resident
+ *
+ * @param pmd the PMD entry pointing to the page table of the region
+ * @param vaddr
+ */
+static void thp_try_promote(pte_t* pmd, uint64_t vaddr){
+    assert(pmd != NULL && pmd->present == 1 && pmd->hugepage == 0);
+
+    // the frames shared by fork stay as they are
+    uint64_t table_ppn = pmd->ppn;
+    for(int i=0; i<PAGE_TABLE_ENTRY_NUM; ++i){
+        pte_t* pte = table_entry(table_ppn,i);
+        if(pte->present == 0 || pm_meta(pte->ppn)->refcount > 1){
+            return;
+        }
+    }
+
+    uint64_t region = vaddr & ~(PAGE_2M_SIZE - 1);
+    uint64_t base = pm_frame_alloc_contiguous(PAGE_TABLE_ENTRY_NUM);
+    for(int i=0; i<PAGE_TABLE_ENTRY_NUM; ++i){
+        uint64_t ppn = table_entry(table_ppn,i)->ppn;
+        memcpy(pm_frame(base + i),pm_frame(ppn),PHYSICAL_PAGE_SIZE);
+
+        paging_untrack_frame(ppn);
+        swap_slot_put(pm_meta(ppn)->swap_id);
+        pm_frame_free(ppn);
+        mmu_invalidate(region + (uint64_t)i * PHYSICAL_PAGE_SIZE);
+    }
+    pm_frame_free(table_ppn);
+
+    pmd->pte_value = 0;
+    pmd->present = 1;
+    pmd->usermode = 1;
+    pmd->hugepage = 1;
+    pmd->dirty = 1;
+    pmd->ppn = base;
+
+    paging_stats.thp_promotions += 1;
+    debug_printf(DEBUG_MMU,"transparent huge page: vaddr %lx promoted to frame %lx\n",region,base);
+}
+
+/*=================================*/
+/*      tlb of the modeled mmu     */
+/*=================================*/
+
+/*
+One set associative TLB per page size, as x86 cores have:
+
+    4KB:  16 sets x 4 ways
+    2MB:   8 sets x 4 ways
+    1GB:   1 set  x 4 ways
+
+An entry tags the virtual page number at its own page size, so one 2MB
+entry covers what would take 512 4KB entries. A miss walks the table; the
+cost of the walk is counted in page table entries read.
+*/
+#define TLB_NUM_WAYS        (4)
+#define TLB_4K_NUM_SETS     (16)
+#define TLB_2M_NUM_SETS     (8)
+#define TLB_1G_NUM_SETS     (1)
+
+typedef struct{
+    int         valid;
+    int         dirty;
+    uint64_t    vpn;    // vaddr >> offset_length
+    uint64_t    ppn;    // ppn of the start of the page
+    uint64_t    time;   // last use, for lru replacement
+}tlb_entry_t;
+
+typedef struct{
+    int             offset_length;
+    int             num_sets;
+    tlb_entry_t*    entries;    // num_sets * TLB_NUM_WAYS
+}tlb_t;
+
+static tlb_entry_t tlb_4k_entries[TLB_4K_NUM_SETS * TLB_NUM_WAYS];
+static tlb_entry_t tlb_2m_entries[TLB_2M_NUM_SETS * TLB_NUM_WAYS];
+static tlb_entry_t tlb_1g_entries[TLB_1G_NUM_SETS * TLB_NUM_WAYS];
+
+static tlb_t tlbs[3] = {
+    {PHYSICAL_PAGE_OFFSET_LENGTH,   TLB_4K_NUM_SETS,    tlb_4k_entries},
+    {PAGE_2M_OFFSET_LENGTH,         TLB_2M_NUM_SETS,    tlb_2m_entries},
+    {PAGE_1G_OFFSET_LENGTH,         TLB_1G_NUM_SETS,    tlb_1g_entries},
+};
+
+static int tlb_model_enabled = 0;
+static uint64_t tlb_time = 0;
+
+static inline tlb_entry_t* tlb_set(tlb_t* tlb, uint64_t vpn){
+    return &tlb->entries[(vpn % tlb->num_sets) * TLB_NUM_WAYS];
+}
+
+static tlb_entry_t* tlb_lookup(uint64_t vaddr, tlb_t** found){
+    for(int i=0; i<3; ++i){
+        uint64_t vpn = vaddr >> tlbs[i].offset_length;
+        tlb_entry_t* set = tlb_set(&tlbs[i],vpn);
+        for(int w=0; w<TLB_NUM_WAYS; ++w){
+            if(set[w].valid == 1 && set[w].vpn == vpn){
+                *found = &tlbs[i];
+                return &set[w];
+            }
+        }
+    }
+    return NULL;
+}
+
+static void tlb_insert(uint64_t vaddr, walk_result_t* result){
+    tlb_t* tlb = NULL;
+    for(int i=0; i<3; ++i){
+        if(tlbs[i].offset_length == result->offset_length){
+            tlb = &tlbs[i];
+        }
+    }
+    uint64_t vpn = vaddr >> tlb->offset_length;
+    tlb_entry_t* set = tlb_set(tlb,vpn);
+
+    // the same page, an invalid way, or the least recently used way
+    tlb_entry_t* victim = &set[0];
+    for(int w=0; w<TLB_NUM_WAYS; ++w){
+        if(set[w].valid == 1 && set[w].vpn == vpn){
+            victim = &set[w];
+            break;
+        }
+        if(set[w].valid == 0 || (victim->valid == 1 && set[w].time < victim->time)){
+            victim = &set[w];
+        }
+    }
+    victim->valid = 1;
+    // a write to a read-only (copy on write) page must walk again
+    victim->dirty = result->pte->dirty == 1 && result->pte->readonly == 0;
+    victim->vpn = vpn;
+    victim->ppn = result->ppn;
+    victim->time = tlb_time;
+}
+
+static void tlb_invalidate(uint64_t vaddr){
+    for(int i=0; i<3; ++i){
+        uint64_t vpn = vaddr >> tlbs[i].offset_length;
+        tlb_entry_t* set = tlb_set(&tlbs[i],vpn);
+        for(int w=0; w<TLB_NUM_WAYS; ++w){
+            if(set[w].vpn == vpn){
+                set[w].valid = 0;
+            }
+        }
+    }
+}
+
+void tlb_flush(){
+    for(int i=0; i<3; ++i){
+        memset(tlbs[i].entries,0,tlbs[i].num_sets * TLB_NUM_WAYS * sizeof(tlb_entry_t));
+    }
+}
+
+// when the tlb model is enabled, every access goes through it
+// and the soft tlb of the emulator is bypassed
+void mmu_set_tlb_model(int enable){
+    tlb_model_enabled = enable;
+    tlb_flush();
+}
+
+static uint64_t translate(uint64_t vaddr, int write){
+    if(DEBUG_ENABLE_PAGE_WALK == 0){
+        return vaddr % PHYSICAL_MEMORY_SPACE;
+    }
+
+    if(tlb_model_enabled == 1){
+        tlb_time += 1;
+        tlb_t* tlb = NULL;
+        tlb_entry_t* e = tlb_lookup(vaddr,&tlb);
+        // the first write to a clean page walks again to set the dirty bit
+        if(e != NULL && (write == 0 || e->dirty == 1)){
+            tlb_stats.hits += 1;
+            e->time = tlb_time;
+            uint64_t offset_mask = ((uint64_t)1 << tlb->offset_length) - 1;
+            return (e->ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + (vaddr & offset_mask);
+        }
+        tlb_stats.misses += 1;
+    }
+
+    walk_result_t result;
+    page_walk(vaddr,write,&result);
+    if(tlb_model_enabled == 1){
+        tlb_insert(vaddr,&result);
+    }
+    return result.paddr;
+}
+
+// the access type is not known here, so the page is taken as written
 uint64_t va2pa(uint64_t vaddr){
-//    return vaddr & (0xffffffffffffffff >> (64 - MAX_INDEX_PHYSICAL_PAGE));
-    return vaddr % PHYSICAL_MEMORY_SPACE;
-}
\ No newline at end of file
+    return translate(vaddr,1);
+}
+
+/*=================================*/
+/*      soft tlb of the emulator   */
+/*=================================*/
+
+/*
+This is NOT the TLB of the modeled machine. It belongs to the emulator
+itself and caches where a guest virtual page lives in host memory:
+
+    guest vaddr
+    |      vpn (tag)      | index |  page offset  |
+                              |
+                              v
+    +-------------------------------------------+
+    | tag_read | tag_write | host page address  |  x SOFT_TLB_SIZE
+    +-------------------------------------------+
+
+Direct mapped. The tag is the page aligned guest virtual address, and an
+invalid slot holds SOFT_TLB_INVALID_TAG which is never page aligned, so it
+never matches. Read and write have separate tags so that a page can be
+cached for loads only.
+*/
+#define SOFT_TLB_INDEX_LENGTH   (8)
+#define SOFT_TLB_SIZE           (1 << SOFT_TLB_INDEX_LENGTH)
+#define SOFT_TLB_INVALID_TAG    (0xffffffffffffffff)
+
+typedef struct{
+    uint64_t    tag_read;   // page aligned vaddr valid for load
+    uint64_t    tag_write;  // page aligned vaddr valid for store
+    uint8_t*    host;       // host address of the guest page start
+}softtlb_entry_t;
+
+static softtlb_entry_t softtlb[SOFT_TLB_SIZE] = {
+    [0 ... SOFT_TLB_SIZE - 1] = {SOFT_TLB_INVALID_TAG, SOFT_TLB_INVALID_TAG, NULL}
+};
+
+void softtlb_flush(){
+    for(int i=0; i<SOFT_TLB_SIZE; ++i){
+        softtlb[i].tag_read = SOFT_TLB_INVALID_TAG;
+        softtlb[i].tag_write = SOFT_TLB_INVALID_TAG;
+        softtlb[i].host = NULL;
+    }
+}
+
+static inline softtlb_entry_t* softtlb_slot(uint64_t vaddr){
+    return &softtlb[(vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH) & (SOFT_TLB_SIZE - 1)];
+}
+
+// the access [vaddr, vaddr + size) stays in one page
+static inline int in_one_page(uint64_t vaddr, uint64_t size){
+    return (vaddr & PHYSICAL_PAGE_OFFSET_MASK) <= PHYSICAL_PAGE_SIZE - size;
+}
+
+void softtlb_invalidate(uint64_t vaddr){
+    uint64_t page = vaddr & ~PHYSICAL_PAGE_OFFSET_MASK;
+    softtlb_entry_t* e = softtlb_slot(vaddr);
+    if(e->tag_read == page || e->tag_write == page){
+        e->tag_read = SOFT_TLB_INVALID_TAG;
+        e->tag_write = SOFT_TLB_INVALID_TAG;
+        e->host = NULL;
+    }
+}
+
+// slow path: translate the page and refill the slot
+// a load fills the read tag only, so that the first store still
+// reaches the walker and sets the dirty bit
+static uint8_t* softtlb_fill(uint64_t vaddr, int write){
+    uint64_t page = vaddr & ~PHYSICAL_PAGE_OFFSET_MASK;
+    softtlb_entry_t* e = softtlb_slot(vaddr);
+
+    uint8_t* host = pm_host(translate(page,write));
+    if(e->tag_read != page){
+        e->tag_write = SOFT_TLB_INVALID_TAG;
+    }
+    e->host = host;
+    e->tag_read = page;
+    if(write == 1){
+        e->tag_write = page;
+    }
+
+    debug_printf(DEBUG_MMU,"soft tlb fill: vaddr %lx -> host %p\n",page,e->host);
+    return e->host;
+}
+
+// invlpg: drop the page from both the modeled tlb and the soft tlb
+void mmu_invalidate(uint64_t vaddr){
+    tlb_invalidate(vaddr);
+    softtlb_invalidate(vaddr);
+}
+
+uint64_t read64bits_vaddr(uint64_t vaddr){
+    if(trace_capture_enabled == 1){
+        trace_capture(TRACE_LOAD,vaddr,sizeof(uint64_t),cpu_pc.rip);
+    }
+    if(DEBUG_ENABLE_SRAM_CACHE == 1 || tlb_model_enabled == 1 || dram_timing_enabled == 1){
+        // must go through the cache / tlb / dram timing model
+        return read64bits_dram(translate(vaddr,0));
+    }
+
+    uint64_t val = 0;
+    if(in_one_page(vaddr,sizeof(uint64_t))){
+        softtlb_entry_t* e = softtlb_slot(vaddr);
+        uint8_t* host = e->host;
+        if(e->tag_read != (vaddr & ~PHYSICAL_PAGE_OFFSET_MASK)){
+            // miss
+            host = softtlb_fill(vaddr,0);
+        }
+        memcpy(&val,host + (vaddr & PHYSICAL_PAGE_OFFSET_MASK),sizeof(uint64_t));
+        return val;
+    }
+
+    // crossing the page boundary: byte by byte, little-endian
+    for(int i=0; i<sizeof(uint64_t); ++i){
+        val += ((uint64_t)read8bits_dram(translate(vaddr + i,0))) << (i * 8);
+    }
+    return val;
+}
+
+void write64bits_vaddr(uint64_t vaddr, uint64_t data){
+    if(trace_capture_enabled == 1){
+        trace_capture(TRACE_STORE,vaddr,sizeof(uint64_t),cpu_pc.rip);
+    }
+    if(DEBUG_ENABLE_SRAM_CACHE == 1 || tlb_model_enabled == 1 || dram_timing_enabled == 1){
+        write64bits_dram(translate(vaddr,1),data);
+        return;
+    }
+
+    if(in_one_page(vaddr,sizeof(uint64_t))){
+        softtlb_entry_t* e = softtlb_slot(vaddr);
+        uint8_t* host = e->host;
+        if(e->tag_write != (vaddr & ~PHYSICAL_PAGE_OFFSET_MASK)){
+            // miss
+            host = softtlb_fill(vaddr,1);
+        }
+        memcpy(host + (vaddr & PHYSICAL_PAGE_OFFSET_MASK),&data,sizeof(uint64_t));
+        return;
+    }
+
+    for(int i=0; i<sizeof(uint64_t); ++i){
+        write8bits_dram(translate(vaddr + i,1),(data >> (i * 8)) & 0xff);
+    }
+}
+
+void readinst_vaddr(uint64_t vaddr, char* buf){
+    if(trace_capture_enabled == 1){
+        trace_capture(TRACE_FETCH,vaddr,MAX_INSTRUCTION_CHAR,cpu_pc.rip);
+    }
+    if(in_one_page(vaddr,MAX_INSTRUCTION_CHAR) == 0){
+        // crossing the page boundary: the two pages are translated separately
+        uint64_t head = PHYSICAL_PAGE_SIZE - (vaddr & PHYSICAL_PAGE_OFFSET_MASK);
+        readblock_dram(translate(vaddr,0),buf,head);
+        readblock_dram(translate(vaddr + head,0),buf + head,MAX_INSTRUCTION_CHAR - head);
+        return;
+    }
+    if(DEBUG_ENABLE_SRAM_CACHE == 1 || tlb_model_enabled == 1 || dram_timing_enabled == 1){
+        readinst_dram(translate(vaddr,0),buf);
+        return;
+    }
+
+    softtlb_entry_t* e = softtlb_slot(vaddr);
+    uint8_t* host = e->host;
+    if(e->tag_read != (vaddr & ~PHYSICAL_PAGE_OFFSET_MASK)){
+        host = softtlb_fill(vaddr,0);
+    }
+    memcpy(buf,host + (vaddr & PHYSICAL_PAGE_OFFSET_MASK),MAX_INSTRUCTION_CHAR);
+}
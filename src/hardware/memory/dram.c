@@ -6,97 +6,206 @@
 #include "headers/cpu.h"
 #include "headers/memory.h"
 
-/*  
+/*
 Be careful with the x86-64 little endian integer encoding
 e.g. write 0x00007fd357a02ae0 to cache, the memory lapping should be:
     e0 2a a0 57 d3 7f 00 00
 */
 
-// memory accessing used in instruction
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define HOST_LITTLE_ENDIAN  (1)
+#else
+#define HOST_LITTLE_ENDIAN  (0)
+#endif
+
+// the emulator stalls for the access on the timing model
+static inline void charge_dram(uint64_t paddr, uint64_t len, int write){
+    if(dram_timing_enabled == 1 && len > 0){
+        cpu_cycles += dram_timing_access(paddr,len,write,cpu_cycles);
+    }
+}
+
+// the access [paddr, paddr + size) stays in one physical frame
+static inline int in_one_frame(uint64_t paddr, uint64_t size){
+    return (paddr & PHYSICAL_PAGE_OFFSET_MASK) <= PHYSICAL_PAGE_SIZE - size;
+}
+
 /**
- * @brief 
- * 
- * @param paddr pysical
- * @param cr core index
- * @return uint64_t 
+ * @brief read a little-endian value of 1, 2, 4 or 8 bytes
+ *
+ * @param paddr physical address
+ * @param size bytes to read
+ * @return uint64_t zero extended value
  */
-uint64_t read64bits_dram(uint64_t paddr){
+static inline uint64_t read_dram(uint64_t paddr, int size){
     if(DEBUG_ENABLE_SRAM_CACHE == 1){
-        // try to read uint64_t from SRAM cache
+        // try to read from SRAM cache
         // little-endian
-    }else{
-        // read from DRAM directly
-        // little-endian
-        uint64_t val = 0x0;
-
-        val += (((uint64_t)pm[paddr + 0]) << 0);
-        val += (((uint64_t)pm[paddr + 1]) << 8);
-        val += (((uint64_t)pm[paddr + 2]) << 16);
-        val += (((uint64_t)pm[paddr + 3]) << 24);
-        val += (((uint64_t)pm[paddr + 4]) << 32);
-        val += (((uint64_t)pm[paddr + 5]) << 40);
-        val += (((uint64_t)pm[paddr + 6]) << 48);
-        val += (((uint64_t)pm[paddr + 7]) << 56);
+        return 0x0;
+    }
 
+    // read from DRAM directly
+    charge_dram(paddr,size,0);
+    uint64_t val = 0x0;
+    if(HOST_LITTLE_ENDIAN && in_one_frame(paddr,size)){
+        // one unaligned host load, the compiler folds the memcpy
+        memcpy(&val,pm_host(paddr),size);
         return val;
     }
-    return 0x0;
+
+    // crossing the frame boundary or big-endian host
+    for(int i=0; i<size; ++i){
+        val += ((uint64_t)*pm_host(paddr + i)) << (i * 8);
+    }
+    return val;
 }
 
 /**
- * @brief 
- * 
- * @param paddr pysical address
- * @param data 
- * @param cr core index
+ * @brief write a little-endian value of 1, 2, 4 or 8 bytes
+ *
+ * @param paddr physical address
+ * @param data the low size bytes are written
+ * @param size bytes to write
  */
-void write64bits_dram(uint64_t paddr, uint64_t data){
+static inline void write_dram(uint64_t paddr, uint64_t data, int size){
     if(DEBUG_ENABLE_SRAM_CACHE == 1){
-        // try to write uint64_t from SRAM cache
-        // little-endian
-    }else{
-        // write from DRAM directly
+        // try to write to SRAM cache
         // little-endian
-        pm[paddr + 0] = (data >> 0) & 0xff;
-        pm[paddr + 1] = (data >> 8) & 0xff;
-        pm[paddr + 2] = (data >> 16) & 0xff;
-        pm[paddr + 3] = (data >> 24) & 0xff;
-        pm[paddr + 4] = (data >> 32) & 0xff;
-        pm[paddr + 5] = (data >> 40) & 0xff;
-        pm[paddr + 6] = (data >> 48) & 0xff;
-        pm[paddr + 7] = (data >> 56) & 0xff;
+        return;
+    }
+
+    // write to DRAM directly
+    charge_dram(paddr,size,1);
+    if(HOST_LITTLE_ENDIAN && in_one_frame(paddr,size)){
+        memcpy(pm_host(paddr),&data,size);
+        return;
+    }
+
+    for(int i=0; i<size; ++i){
+        *pm_host(paddr + i) = (data >> (i * 8)) & 0xff;
+    }
+}
+
+// memory accessing used in instruction
+uint8_t read8bits_dram(uint64_t paddr){
+    return (uint8_t)read_dram(paddr,sizeof(uint8_t));
+}
+
+uint16_t read16bits_dram(uint64_t paddr){
+    return (uint16_t)read_dram(paddr,sizeof(uint16_t));
+}
+
+uint32_t read32bits_dram(uint64_t paddr){
+    return (uint32_t)read_dram(paddr,sizeof(uint32_t));
+}
+
+uint64_t read64bits_dram(uint64_t paddr){
+    return read_dram(paddr,sizeof(uint64_t));
+}
+
+void write8bits_dram(uint64_t paddr, uint8_t data){
+    write_dram(paddr,data,sizeof(uint8_t));
+}
+
+void write16bits_dram(uint64_t paddr, uint16_t data){
+    write_dram(paddr,data,sizeof(uint16_t));
+}
+
+void write32bits_dram(uint64_t paddr, uint32_t data){
+    write_dram(paddr,data,sizeof(uint32_t));
+}
+
+void write64bits_dram(uint64_t paddr, uint64_t data){
+    write_dram(paddr,data,sizeof(uint64_t));
+}
+
+/*
+The block accessors split [paddr, paddr + len) at the frame boundaries and
+hand each piece to memcpy / memset, which use the vector registers of the
+host for the bulk of the copy.
+*/
+
+// bytes from paddr to the end of its frame, at most len
+static inline uint64_t frame_chunk(uint64_t paddr, uint64_t len){
+    uint64_t left = PHYSICAL_PAGE_SIZE - (paddr & PHYSICAL_PAGE_OFFSET_MASK);
+    return left < len ? left : len;
+}
+
+/**
+ * @brief copy len bytes from physical memory to host buffer
+ *
+ * @param paddr
+ * @param buf
+ * @param len
+ */
+void readblock_dram(uint64_t paddr, void* buf, uint64_t len){
+    charge_dram(paddr,len,0);
+    uint8_t* dst = buf;
+    while(len > 0){
+        uint64_t n = frame_chunk(paddr,len);
+        memcpy(dst,pm_host(paddr),n);
+        dst += n;
+        paddr += n;
+        len -= n;
     }
 }
 
 /**
- * @brief 
- * 
- * @param paddr 
- * @param buf 
- * @param cr 
+ * @brief copy len bytes from host buffer to physical memory
+ *
+ * @param paddr
+ * @param buf
+ * @param len
  */
-void readinst_dram(uint64_t paddr, char* buf){
-    for(int i=0; i< MAX_INSTRUCTION_CHAR; ++i){
-        buf[i] = (char)pm[paddr + i];
+void writeblock_dram(uint64_t paddr, const void* buf, uint64_t len){
+    charge_dram(paddr,len,1);
+    const uint8_t* src = buf;
+    while(len > 0){
+        uint64_t n = frame_chunk(paddr,len);
+        memcpy(pm_host(paddr),src,n);
+        src += n;
+        paddr += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief set len bytes of physical memory to val
+ *
+ * @param paddr
+ * @param val
+ * @param len
+ */
+void fillblock_dram(uint64_t paddr, uint8_t val, uint64_t len){
+    charge_dram(paddr,len,1);
+    while(len > 0){
+        uint64_t n = frame_chunk(paddr,len);
+        memset(pm_host(paddr),val,n);
+        paddr += n;
+        len -= n;
     }
 }
 
 /**
- * @brief 
- * 
- * @param paddr 
- * @param str 
- * @param cr 
+ * @brief
+ *
+ * @param paddr
+ * @param buf
+ */
+void readinst_dram(uint64_t paddr, char* buf){
+    readblock_dram(paddr,buf,MAX_INSTRUCTION_CHAR);
+}
+
+/**
+ * @brief
+ *
+ * @param paddr
+ * @param str
  */
 void writeinst_dram(uint64_t paddr, const char* str){
     uint8_t len = strlen(str);
     assert(len < MAX_INSTRUCTION_CHAR);
 
-    for(uint8_t i=0;i<MAX_INSTRUCTION_CHAR; ++i){
-        if(i < len){
-            pm[paddr + i] = (uint8_t)str[i];
-        }else{
-            pm[paddr + i] = 0;
-        }
-    }
-}
\ No newline at end of file
+    writeblock_dram(paddr,str,len);
+    fillblock_dram(paddr + len,0,MAX_INSTRUCTION_CHAR - len);
+}
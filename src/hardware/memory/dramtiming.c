@@ -0,0 +1,294 @@
+// Timing model of the DRAM: channels, ranks, banks and row buffers
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "headers/common.h"
+#include "headers/memory.h"
+
+/*
+The physical address of a 64 byte line is mapped as
+
+    |   row   | rank | bank | channel | column | line offset |
+                 1      3       1        7           6
+
+so a sequential sweep stays in the open row of one bank for 8KB, and the
+next 8KB goes to the other channel, then to the next bank.
+
+Each bank has one row buffer. An access to the open row only needs the
+column command (tCAS); to a closed bank it activates the row first
+(tRCD + tCAS); to another row it precharges the open row as well
+(tRP + tRCD + tCAS). The data then takes tBURST cycles on the data bus
+of the channel. Column commands to the open row are tCCD apart.
+
+The controller issues one command per cycle to a bank that is ready.
+FR-FCFS picks the oldest request hitting an open row first, then the
+oldest request; FCFS always serves the oldest request.
+
+The queue stays open across the accesses of the emulator. A write is
+posted: its lines wait in the queue and the emulator goes on, unless the
+queue is over DRAM_QUEUE_DEPTH, then it stalls while requests are issued.
+A read waits for its own lines only, which the scheduler may serve before
+the older writes or after them.
+*/
+#define DRAM_LINE_LENGTH        (6)
+#define DRAM_COLUMN_LENGTH      (7)     // 128 lines: 8KB row
+#define DRAM_CHANNEL_LENGTH     (1)
+#define DRAM_BANK_LENGTH        (3)
+#define DRAM_RANK_LENGTH        (1)
+
+#define DRAM_NUM_CHANNELS       (1 << DRAM_CHANNEL_LENGTH)
+#define DRAM_NUM_RANKS          (1 << DRAM_RANK_LENGTH)
+#define DRAM_NUM_BANKS          (1 << DRAM_BANK_LENGTH)
+
+// memory clock cycles, DDR4-2400 like
+#define DRAM_TCAS               (16)
+#define DRAM_TRCD               (16)
+#define DRAM_TRP                (16)
+#define DRAM_TBURST             (4)
+#define DRAM_TCCD               (4)     // column command to column command
+
+#define DRAM_ROW_CLOSED         (0xffffffffffffffff)
+#define DRAM_QUEUE_DEPTH        (16)    // posted requests before a write stalls
+
+typedef struct{
+    uint64_t    open_row;
+    uint64_t    ready;      // cycle the bank accepts the next command
+}dram_bank_t;
+
+typedef struct{
+    uint64_t    paddr;
+    uint64_t    arrival;
+    uint64_t    id;         // in the order of enqueue
+    int         write;
+}dram_request_t;
+
+static dram_bank_t banks[DRAM_NUM_CHANNELS][DRAM_NUM_RANKS][DRAM_NUM_BANKS];
+static uint64_t bus_free[DRAM_NUM_CHANNELS];    // the data bus is free from this cycle
+
+static dram_request_t* queue = NULL;
+static uint64_t queue_count = 0;
+static uint64_t queue_size = 0;
+static uint64_t next_id = 0;
+
+static dram_sched_t sched_policy = DRAM_SCHED_FR_FCFS;
+static uint64_t now = 0;    // the cycle of the next command
+
+static inline uint64_t field(uint64_t paddr, int shift, int length){
+    return (paddr >> shift) & (((uint64_t)1 << length) - 1);
+}
+
+static dram_bank_t* request_bank(uint64_t paddr, uint64_t* channel, uint64_t* row){
+    int shift = DRAM_LINE_LENGTH + DRAM_COLUMN_LENGTH;
+    *channel = field(paddr,shift,DRAM_CHANNEL_LENGTH);
+    shift += DRAM_CHANNEL_LENGTH;
+    uint64_t bank = field(paddr,shift,DRAM_BANK_LENGTH);
+    shift += DRAM_BANK_LENGTH;
+    uint64_t rank = field(paddr,shift,DRAM_RANK_LENGTH);
+    shift += DRAM_RANK_LENGTH;
+    *row = paddr >> shift;
+    return &banks[*channel][rank][bank];
+}
+
+static void queue_cleanup(){
+    free(queue);
+    queue = NULL;
+    queue_count = 0;
+    queue_size = 0;
+}
+
+void dram_timing_set_policy(dram_sched_t policy){
+    sched_policy = policy;
+}
+
+/**
+ * @brief close all rows, clear the queue, the clock and the stats
+ */
+void dram_timing_reset(){
+    for(int c=0; c<DRAM_NUM_CHANNELS; ++c){
+        for(int r=0; r<DRAM_NUM_RANKS; ++r){
+            for(int b=0; b<DRAM_NUM_BANKS; ++b){
+                banks[c][r][b].open_row = DRAM_ROW_CLOSED;
+                banks[c][r][b].ready = 0;
+            }
+        }
+        bus_free[c] = 0;
+    }
+    queue_count = 0;
+    next_id = 0;
+    now = 0;
+    memset(&dram_timing_stats,0,sizeof(dram_timing_stats_t));
+}
+
+/**
+ * @brief queue a request of one line arriving at the cycle arrival
+ *
+ * @param paddr
+ * @param write
+ * @param arrival not earlier than the previous request
+ */
+void dram_timing_enqueue(uint64_t paddr, int write, uint64_t arrival){
+    if(queue == NULL){
+        queue_size = 64;
+        queue = malloc(queue_size * sizeof(dram_request_t));
+        // the banks start with all rows closed
+        dram_timing_reset();
+        add_cleanup_event(&queue_cleanup);
+    }
+    if(queue_count == queue_size){
+        queue_size *= 2;
+        queue = realloc(queue,queue_size * sizeof(dram_request_t));
+    }
+    assert(queue_count == 0 || queue[queue_count - 1].arrival <= arrival);
+    queue[queue_count].paddr = paddr;
+    queue[queue_count].arrival = arrival;
+    queue[queue_count].id = next_id;
+    queue[queue_count].write = write;
+    next_id += 1;
+    queue_count += 1;
+}
+
+// the queue is kept in arrival order: the oldest is the first
+static int64_t schedule(){
+    int64_t oldest = -1;
+    for(uint64_t i=0; i<queue_count && queue[i].arrival <= now; ++i){
+        uint64_t channel, row;
+        dram_bank_t* bank = request_bank(queue[i].paddr,&channel,&row);
+        if(sched_policy == DRAM_SCHED_FCFS){
+            // in order: the oldest waits for its bank
+            return bank->ready <= now ? (int64_t)i : -1;
+        }
+        if(bank->ready > now){
+            continue;
+        }
+        if(bank->open_row == row){
+            // first ready: a row hit goes before the older requests
+            return i;
+        }
+        if(oldest == -1){
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+// the earliest cycle a request could be issued
+static uint64_t next_event(){
+    uint64_t next = 0xffffffffffffffff;
+    for(uint64_t i=0; i<queue_count; ++i){
+        uint64_t channel, row;
+        dram_bank_t* bank = request_bank(queue[i].paddr,&channel,&row);
+        uint64_t t = queue[i].arrival > bank->ready ? queue[i].arrival : bank->ready;
+        if(t < next){
+            next = t;
+        }
+        if(sched_policy == DRAM_SCHED_FCFS){
+            break;
+        }
+    }
+    return next;
+}
+
+// issue the request, return the cycle it is done
+static uint64_t issue(uint64_t index){
+    dram_request_t req = queue[index];
+    memmove(&queue[index],&queue[index + 1],(queue_count - index - 1) * sizeof(dram_request_t));
+    queue_count -= 1;
+
+    uint64_t channel, row;
+    dram_bank_t* bank = request_bank(req.paddr,&channel,&row);
+    uint64_t access = DRAM_TCAS;
+    if(bank->open_row == row){
+        dram_timing_stats.row_hits += 1;
+    }else if(bank->open_row == DRAM_ROW_CLOSED){
+        access += DRAM_TRCD;
+        dram_timing_stats.row_empty += 1;
+    }else{
+        access += DRAM_TRP + DRAM_TRCD;
+        dram_timing_stats.bank_conflicts += 1;
+    }
+    // the column commands to the open row are pipelined
+    bank->open_row = row;
+    bank->ready = now + access - DRAM_TCAS + DRAM_TCCD;
+
+    uint64_t data = now + access > bus_free[channel] ? now + access : bus_free[channel];
+    uint64_t done = data + DRAM_TBURST;
+    bus_free[channel] = done;
+
+    dram_timing_stats.requests += 1;
+    dram_timing_stats.total_latency += done - req.arrival;
+    if(done > dram_timing_stats.cycles){
+        dram_timing_stats.cycles = done;
+    }
+    debug_printf(DEBUG_CACHEDETAILS,"dram: %s %lx row %lx issued %lu done %lu\n",
+        req.write ? "write" : "read",req.paddr,row,now,done);
+    return done;
+}
+
+// issue the next request of the policy, or move the clock to when one can be
+// return 1 if issued, with its id and the cycle it is done
+static int step(uint64_t* id, uint64_t* done){
+    int64_t index = schedule();
+    if(index == -1){
+        uint64_t next = next_event();
+        now = next > now ? next : now + 1;
+        return 0;
+    }
+    *id = queue[index].id;
+    *done = issue(index);
+    // one command per cycle
+    now += 1;
+    return 1;
+}
+
+/**
+ * @brief serve all the queued requests
+ *
+ * @return uint64_t the cycle the last request is done
+ */
+uint64_t dram_timing_drain(){
+    uint64_t id, done;
+    while(queue_count > 0){
+        step(&id,&done);
+    }
+    return dram_timing_stats.cycles;
+}
+
+/**
+ * @brief charge the access of the emulator: the lines of [paddr, paddr + len)
+ *        are requested back to back, a read waits for them, a write is posted
+ *
+ * @param paddr
+ * @param len
+ * @param write
+ * @param arrival the cycle of the emulator, not earlier than the last access
+ * @return uint64_t cycles the emulator stalls
+ */
+uint64_t dram_timing_access(uint64_t paddr, uint64_t len, int write, uint64_t arrival){
+    uint64_t first = next_id;
+    uint64_t line = paddr >> DRAM_LINE_LENGTH;
+    uint64_t last = (paddr + len - 1) >> DRAM_LINE_LENGTH;
+    for(; line<=last; ++line){
+        dram_timing_enqueue(line << DRAM_LINE_LENGTH,write,arrival);
+    }
+
+    uint64_t id, done, end = arrival;
+    if(write){
+        // the write buffer is full: wait until there is room
+        while(queue_count > DRAM_QUEUE_DEPTH){
+            step(&id,&done);
+            end = now;
+        }
+        return end > arrival ? end - arrival : 0;
+    }
+    // the lines of this read are the newest requests
+    uint64_t waiting = last - (paddr >> DRAM_LINE_LENGTH) + 1;
+    while(waiting > 0){
+        if(step(&id,&done) == 1 && id >= first){
+            waiting -= 1;
+            end = done > end ? done : end;
+        }
+    }
+    return end - arrival;
+}
@@ -0,0 +1,506 @@
+// Loader: map the EOF executable into the guest virtual memory
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers/common.h"
+#include "headers/cpu.h"
+#include "headers/memory.h"
+#include "headers/algorithm.h"
+
+/*
+The EOF file written by the linker is a text image:
+
+    44                          line count
+    3                           section header count
+    .text,0x400000,5,32         name,runtime address,first line,line count
+    .data,0x400800,37,3
+    .symtab,0x0,40,4
+    push   %rbp                 .text: one instruction per line
+    ...
+    0x0000000012340000          .data: one 64-bit value per line
+    ...
+
+load_eof() mmaps the file and reads the header only. Nothing is copied
+into the guest memory: the pages of the sections are filled by the page
+fault handler when they are touched first, and only the lines up to the
+faulting page are indexed. So the startup cost does not depend on the
+size of the image.
+
+    .text       MAX_INSTRUCTION_CHAR bytes per line, read-only
+    .data       8 bytes per line
+    .rodata     8 bytes per line, read-only
+    .bss        8 bytes per line, demand zero
+    .got.plt    8 bytes per line
+
+The executable may import functions from the shared images listed in its
+.dynamic section, as the names of .dynsym. Its calls go through the PLT
+stubs, which trap into loader_resolve() on the first call of an import. The
+resolver loads the shared images in the order of .dynamic, only until one
+of them exports the name, and writes the address into the GOT entry, so the
+next calls jump there directly. A program starts with no shared image
+loaded at all, and the imports never called are never looked up.
+
+A shared image is an EOF file linked at its own address (--image-base) and
+joins the address space of the executable.
+*/
+#define LOADER_MAX_SECTIONS     (16)
+#define LOADER_NAME_LENGTH      (32)
+#define LOADER_MAX_IMAGES       (16)
+
+typedef struct{
+    char        name[LOADER_NAME_LENGTH];
+    uint64_t    addr;       // runtime virtual address
+    uint64_t    offset;     // index of the first line in the image
+    uint64_t    count;      // count of lines
+    uint64_t    entry_size; // bytes of one line in memory
+    int         readonly;
+    int         from_file;  // 0 for .bss
+}load_section_t;
+
+typedef struct{
+    const char*     base;       // the mmap-ed file
+    uint64_t        size;
+    array_t*        line_start; // byte offset of the lines indexed so far
+    uint64_t        scan;       // where the indexing stopped
+
+    int             num_sections;
+    load_section_t  sections[LOADER_MAX_SECTIONS];
+
+    // not loaded: the tables of the dynamic linking, count is 0 if absent
+    load_section_t  symtab;
+    load_section_t  dynsym;
+    load_section_t  dynamic;
+    hashtable_t*    exports;    // global symbol -> runtime address, built on the first search
+}load_image_t;
+
+// images[0] is the executable, the others the shared images loaded so far
+static load_image_t* images[LOADER_MAX_IMAGES];
+static int num_images = 0;
+
+static void unmap_image(load_image_t* image){
+    munmap((void*)image->base,image->size);
+    array_free(image->line_start);
+    if(image->exports != NULL){
+        hashtable_free(image->exports);
+    }
+    free(image);
+}
+
+static void loader_unmap(){
+    for(int i=0; i<num_images; ++i){
+        unmap_image(images[i]);
+        images[i] = NULL;
+    }
+    num_images = 0;
+}
+
+static int is_blank(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * @brief index the lines of the image until line [index] is known
+ *        the text is scanned once, lazily
+ *
+ * @param image
+ * @param index
+ * @param start byte offset of the line
+ * @param end byte offset after the last char of the line, trailing spaces excluded
+ */
+static void image_line(load_image_t* image, uint64_t index, uint64_t* start, uint64_t* end){
+    while(image->line_start->count <= index){
+        if(image->scan >= image->size){
+            printf("loader: line %lu is beyond the image\n",index);
+            exit(1);
+        }
+        // skip the empty lines
+        uint64_t p = image->scan;
+        while(p < image->size && (image->base[p] == '\n' || is_blank(image->base[p]))){
+            p += 1;
+        }
+        array_insert(&image->line_start,p);
+        while(p < image->size && image->base[p] != '\n'){
+            p += 1;
+        }
+        image->scan = p;
+    }
+
+    uint64_t p;
+    array_get(image->line_start,index,&p);
+    uint64_t q = p;
+    while(q < image->size && image->base[q] != '\n'){
+        q += 1;
+    }
+    while(q > p && is_blank(image->base[q - 1])){
+        q -= 1;
+    }
+    *start = p;
+    *end = q;
+}
+
+static uint64_t image_line_uint(load_image_t* image, uint64_t index){
+    uint64_t start, end;
+    image_line(image,index,&start,&end);
+    assert(end > start);
+    return string2uint_range(image->base,start,end - 1);
+}
+
+// .text,0x400000,5,32
+static void parse_section_header(load_image_t* image, uint64_t index, load_section_t* sec){
+    uint64_t start, end;
+    image_line(image,index,&start,&end);
+
+    int num_cols = 0;
+    uint64_t p = start;
+    for(uint64_t i=start; i<=end; ++i){
+        if(i == end || image->base[i] == ','){
+            assert(num_cols < 4);
+            num_cols += 1;
+            if(num_cols == 1){
+                uint64_t len = i - p;
+                assert(len < LOADER_NAME_LENGTH);
+                memcpy(sec->name,image->base + p,len);
+                sec->name[len] = '\0';
+            }else{
+                uint64_t val = string2uint_range(image->base,p,i - 1);
+                if(num_cols == 2){
+                    sec->addr = val;
+                }else if(num_cols == 3){
+                    sec->offset = val;
+                }else{
+                    sec->count = val;
+                }
+            }
+            p = i + 1;
+        }
+    }
+    assert(num_cols == 4);
+
+    sec->entry_size = sizeof(uint64_t);
+    sec->readonly = 0;
+    sec->from_file = 1;
+    if(strcmp(sec->name,".text") == 0){
+        sec->entry_size = MAX_INSTRUCTION_CHAR;
+        sec->readonly = 1;
+    }else if(strcmp(sec->name,".rodata") == 0){
+        sec->readonly = 1;
+    }else if(strcmp(sec->name,".bss") == 0){
+        sec->from_file = 0;
+    }else if(strcmp(sec->name,".symtab") == 0 || strcmp(sec->name,".dynsym") == 0 ||
+        strcmp(sec->name,".dynamic") == 0){
+        // one name per line, never in the memory
+        sec->from_file = 0;
+    }
+}
+
+// the section is mapped into the guest memory
+static int is_loadable(load_section_t* sec){
+    return strcmp(sec->name,".text") == 0 || strcmp(sec->name,".data") == 0 ||
+        strcmp(sec->name,".rodata") == 0 || strcmp(sec->name,".bss") == 0 ||
+        strcmp(sec->name,".got.plt") == 0;
+}
+
+// mmap the EOF file and read its header only
+static load_image_t* map_image(const char* filename){
+    int fd = open(filename,O_RDONLY);
+    if(fd < 0){
+        printf("loader: unable to open %s\n",filename);
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(fd,&st) != 0 || st.st_size == 0){
+        printf("loader: unable to stat %s\n",filename);
+        exit(1);
+    }
+    const char* base = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(base == MAP_FAILED){
+        printf("loader: unable to mmap %s\n",filename);
+        exit(1);
+    }
+
+    load_image_t* image = calloc(1,sizeof(load_image_t));
+    image->base = base;
+    image->size = st.st_size;
+    image->line_start = array_construct(64);
+
+    // only the header: line count, section header count and the sections
+    uint64_t num_sht = image_line_uint(image,1);
+    for(uint64_t i=0; i<num_sht; ++i){
+        load_section_t sec;
+        parse_section_header(image,2 + i,&sec);
+        if(strcmp(sec.name,".symtab") == 0){
+            image->symtab = sec;
+        }else if(strcmp(sec.name,".dynsym") == 0){
+            image->dynsym = sec;
+        }else if(strcmp(sec.name,".dynamic") == 0){
+            image->dynamic = sec;
+        }
+        if(is_loadable(&sec) == 0){
+            continue;
+        }
+        if(image->num_sections == LOADER_MAX_SECTIONS){
+            printf("loader: too many sections in %s\n",filename);
+            exit(1);
+        }
+        image->sections[image->num_sections] = sec;
+        image->num_sections += 1;
+        debug_printf(DEBUG_LOADER,"load %s at %lx, %lu lines\n",sec.name,sec.addr,sec.count);
+    }
+    return image;
+}
+
+/**
+ * @brief map the EOF executable filename into a new address space
+ *        the old address space is destroyed as exec does
+ *
+ * @param filename
+ */
+void load_eof(const char* filename){
+    load_image_t* image = map_image(filename);
+
+    if(num_images == 0){
+        add_cleanup_event(&loader_unmap);
+    }
+    loader_unmap();
+    images[0] = image;
+    num_images = 1;
+
+    mmu_free_address_space();
+}
+
+/**
+ * @brief fill the frame of the page at vaddr from the image
+ *        called by the page fault handler on the first touch
+ *
+ * @param vaddr start of the page
+ * @param frame host address of the zero filled frame
+ */
+void loader_populate(uint64_t vaddr, uint8_t* frame){
+    assert((vaddr & PHYSICAL_PAGE_OFFSET_MASK) == 0);
+    uint64_t page_end = vaddr + PHYSICAL_PAGE_SIZE;
+
+    for(int m=0; m<num_images; ++m){
+        load_image_t* image = images[m];
+        for(int s=0; s<image->num_sections; ++s){
+            load_section_t* sec = &image->sections[s];
+            uint64_t sec_end = sec->addr + sec->count * sec->entry_size;
+            if(sec->from_file == 0 || sec_end <= vaddr || page_end <= sec->addr){
+                continue;
+            }
+
+            // the lines overlapping the page
+            uint64_t lo = vaddr > sec->addr ? vaddr : sec->addr;
+            uint64_t hi = page_end < sec_end ? page_end : sec_end;
+            uint64_t first = (lo - sec->addr) / sec->entry_size;
+            uint64_t last = (hi - sec->addr - 1) / sec->entry_size;
+
+            for(uint64_t i=first; i<=last; ++i){
+                uint8_t entry[MAX_INSTRUCTION_CHAR];
+                assert(sec->entry_size <= MAX_INSTRUCTION_CHAR);
+                memset(entry,0,sizeof(entry));
+
+                if(sec->entry_size == MAX_INSTRUCTION_CHAR){
+                    uint64_t start, end;
+                    image_line(image,sec->offset + i,&start,&end);
+                    uint64_t len = end - start;
+                    if(len >= MAX_INSTRUCTION_CHAR){
+                        printf("loader: instruction at line %lu is too long\n",sec->offset + i);
+                        exit(1);
+                    }
+                    memcpy(entry,image->base + start,len);
+                }else{
+                    uint64_t val = image_line_uint(image,sec->offset + i);
+                    memcpy(entry,&val,sizeof(uint64_t));
+                }
+
+                // the part of the entry inside the page
+                uint64_t entry_addr = sec->addr + i * sec->entry_size;
+                uint64_t from = entry_addr < vaddr ? vaddr - entry_addr : 0;
+                uint64_t to = entry_addr + sec->entry_size > page_end ? page_end - entry_addr : sec->entry_size;
+                memcpy(frame + (entry_addr + from - vaddr),entry + from,to - from);
+            }
+            debug_printf(DEBUG_LOADER,"page %lx populated from %s lines [%lu, %lu]\n",vaddr,sec->name,first,last);
+        }
+    }
+}
+
+/**
+ * @brief the page at vaddr belongs to a read-only section of the image
+ *
+ * @param vaddr
+ * @return int 1 if read-only
+ */
+int loader_is_readonly(uint64_t vaddr){
+    uint64_t page = vaddr & ~PHYSICAL_PAGE_OFFSET_MASK;
+    int readonly = 0;
+    for(int m=0; m<num_images; ++m){
+        for(int s=0; s<images[m]->num_sections; ++s){
+            load_section_t* sec = &images[m]->sections[s];
+            uint64_t sec_end = sec->addr + sec->count * sec->entry_size;
+            if(sec_end <= page || page + PHYSICAL_PAGE_SIZE <= sec->addr){
+                continue;
+            }
+            // a page shared with a writable section stays writable
+            if(sec->readonly == 0){
+                return 0;
+            }
+            readonly = 1;
+        }
+    }
+    return readonly;
+}
+
+/**
+ * @brief runtime address of the section name, 0 if not loaded
+ *
+ * @param name e.g. ".text"
+ * @return uint64_t
+ */
+uint64_t loader_section_address(const char* name){
+    if(num_images == 0){
+        return 0;
+    }
+    for(int s=0; s<images[0]->num_sections; ++s){
+        if(strcmp(images[0]->sections[s].name,name) == 0){
+            return images[0]->sections[s].addr;
+        }
+    }
+    return 0;
+}
+
+/*======================================*/
+/*          lazy binding                */
+/*======================================*/
+
+// copy the line [index] of the image as a string
+static void image_line_string(load_image_t* image, uint64_t index, char* buf, uint64_t size){
+    uint64_t start, end;
+    image_line(image,index,&start,&end);
+    if(end - start >= size){
+        printf("loader: line %lu is too long\n",index);
+        exit(1);
+    }
+    memcpy(buf,image->base + start,end - start);
+    buf[end - start] = '\0';
+}
+
+// the global symbols of the loaded sections: name,bind,type,section,value,size
+static void build_exports(load_image_t* image){
+    image->exports = hashtable_construct(8);
+    for(uint64_t i=0; i<image->symtab.count; ++i){
+        char line[MAX_INSTRUCTION_CHAR * 2];
+        image_line_string(image,image->symtab.offset + i,line,sizeof(line));
+
+        char* cols[6];
+        int num_cols = 0;
+        char* p = line;
+        while(num_cols < 6){
+            cols[num_cols] = p;
+            num_cols += 1;
+            p = strchr(p,',');
+            if(p == NULL){
+                break;
+            }
+            *p = '\0';
+            p += 1;
+        }
+        if(num_cols != 6 || strcmp(cols[1],"STB_GLOBAL") != 0){
+            continue;
+        }
+        for(int s=0; s<image->num_sections; ++s){
+            load_section_t* sec = &image->sections[s];
+            if(strcmp(sec->name,cols[3]) == 0){
+                uint64_t value = string2uint(cols[4]);
+                hashtable_insert(&image->exports,cols[0],sec->addr + value * sec->entry_size);
+            }
+        }
+    }
+}
+
+// the shared image must not overlap the images loaded before
+static void check_overlap(load_image_t* image, const char* filename){
+    for(int s=0; s<image->num_sections; ++s){
+        load_section_t* a = &image->sections[s];
+        uint64_t a_end = a->addr + a->count * a->entry_size;
+        for(int m=0; m<num_images; ++m){
+            for(int t=0; t<images[m]->num_sections; ++t){
+                load_section_t* b = &images[m]->sections[t];
+                uint64_t b_end = b->addr + b->count * b->entry_size;
+                if(a->addr < b_end && b->addr < a_end){
+                    printf("loader: %s of %s overlaps the loaded images\n",a->name,filename);
+                    exit(1);
+                }
+            }
+        }
+    }
+}
+
+// map the next shared image of .dynamic into the address space, 0 if none is left
+static int load_next_image(){
+    load_image_t* exe = images[0];
+    uint64_t next = num_images - 1;
+    if(next >= exe->dynamic.count){
+        return 0;
+    }
+    if(num_images == LOADER_MAX_IMAGES){
+        printf("loader: too many shared images\n");
+        exit(1);
+    }
+    char filename[256];
+    image_line_string(exe,exe->dynamic.offset + next,filename,sizeof(filename));
+
+    load_image_t* image = map_image(filename);
+    check_overlap(image,filename);
+    images[num_images] = image;
+    num_images += 1;
+    dynamic_stats.images_loaded += 1;
+    debug_printf(DEBUG_LOADER,"shared image %s loaded\n",filename);
+    return 1;
+}
+
+/**
+ * @brief bind the import [index] of the executable: search the shared images
+ *        loading them as needed, and write the address into its GOT entry
+ *
+ * @param index the line of .dynsym, the entry of .got.plt
+ * @return uint64_t the runtime address of the function
+ */
+uint64_t loader_resolve(uint64_t index){
+    assert(num_images > 0);
+    load_image_t* exe = images[0];
+    uint64_t got = loader_section_address(".got.plt");
+    if(index >= exe->dynsym.count || got == 0){
+        printf("loader: no import %lu to resolve\n",index);
+        exit(1);
+    }
+    char name[MAX_INSTRUCTION_CHAR];
+    image_line_string(exe,exe->dynsym.offset + index,name,sizeof(name));
+
+    int m = 1;
+    uint64_t address;
+    while(1){
+        if(m == num_images && load_next_image() == 0){
+            printf("loader: undefined symbol %s\n",name);
+            exit(1);
+        }
+        if(images[m]->exports == NULL){
+            build_exports(images[m]);
+        }
+        if(hashtable_get(images[m]->exports,name,&address) == 1){
+            break;
+        }
+        m += 1;
+    }
+
+    write64bits_vaddr(got + index * sizeof(uint64_t),address);
+    dynamic_stats.resolutions += 1;
+    debug_printf(DEBUG_LOADER,"bind %s to %lx\n",name,address);
+    return address;
+}
@@ -0,0 +1,264 @@
+// Sparse physical memory: 4KB frames allocated on first touch
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "headers/common.h"
+#include "headers/memory.h"
+#include "headers/algorithm.h"
+
+/*
+The physical page number is split into two radix indexes:
+
+    |   ROOT_LEN (12)   |   LEAF_LEN (12)   |   page offset (12)  |
+    +-------------------------------------------------------------+
+    |     root index    |     leaf index    |       offset        |
+    +-------------------------------------------------------------+
+
+root[] is static and always present; a leaf table is calloc-ed when any
+frame under it is touched, and a frame is carved from an anonymous mmap
+arena when the frame itself is touched. Anonymous mappings are zero
+filled and only committed by the host kernel on access, so an untouched
+frame costs nothing and a touched frame reads as zero.
+*/
+#define PM_LEAF_LENGTH      (12)
+#define PM_LEAF_SIZE        (1 << PM_LEAF_LENGTH)
+#define PM_ROOT_LENGTH      (PHYSICAL_ADDRESS_LENGTH - PHYSICAL_PAGE_OFFSET_LENGTH - PM_LEAF_LENGTH)
+#define PM_ROOT_SIZE        (1 << PM_ROOT_LENGTH)
+
+// frames are carved from arenas of 512 frames (2MB)
+#define PM_ARENA_FRAMES     (512)
+
+typedef struct{
+    uint8_t*            host[PM_LEAF_SIZE];     // host address of the frame, NULL if never touched
+    pm_frame_meta_t     meta[PM_LEAF_SIZE];
+}pm_leaf_t;
+
+typedef struct PM_ARENA_STRUCT{
+    uint8_t*                    base;
+    uint64_t                    used;   // frames carved from this arena
+    struct PM_ARENA_STRUCT*     next;
+}pm_arena_t;
+
+static pm_leaf_t* pm_root[PM_ROOT_SIZE];
+static pm_arena_t* pm_arena = NULL;
+static uint64_t pm_frames_allocated = 0;
+
+// frame allocator: freed frames are reused first, then bump from next_ppn
+static array_t* pm_free_frames = NULL;
+static uint64_t pm_next_ppn = PM_ALLOC_FIRST_PPN;
+
+static void pm_destroy(){
+    for(int i=0; i<PM_ROOT_SIZE; ++i){
+        if(pm_root[i] != NULL){
+            free(pm_root[i]);
+            pm_root[i] = NULL;
+        }
+    }
+    while(pm_arena != NULL){
+        pm_arena_t* next = pm_arena->next;
+        munmap(pm_arena->base,PM_ARENA_FRAMES * PHYSICAL_PAGE_SIZE);
+        free(pm_arena);
+        pm_arena = next;
+    }
+    pm_frames_allocated = 0;
+
+    if(pm_free_frames != NULL){
+        array_free(pm_free_frames);
+        pm_free_frames = NULL;
+    }
+    pm_next_ppn = PM_ALLOC_FIRST_PPN;
+}
+
+static uint8_t* pm_carve_frame(){
+    if(pm_arena == NULL){
+        // remember to unmap the arenas finally
+        add_cleanup_event(&pm_destroy);
+    }
+    if(pm_arena == NULL || pm_arena->used == PM_ARENA_FRAMES){
+        uint8_t* base = mmap(NULL,PM_ARENA_FRAMES * PHYSICAL_PAGE_SIZE,
+            PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,-1,0);
+        if(base == MAP_FAILED){
+            printf("physical memory: unable to mmap a frame arena\n");
+            exit(1);
+        }
+        pm_arena_t* a = malloc(sizeof(pm_arena_t));
+        a->base = base;
+        a->used = 0;
+        a->next = pm_arena;
+        pm_arena = a;
+    }
+    uint8_t* frame = pm_arena->base + pm_arena->used * PHYSICAL_PAGE_SIZE;
+    pm_arena->used += 1;
+    return frame;
+}
+
+static pm_leaf_t* pm_leaf(uint64_t ppn){
+    assert(ppn <= MAX_INDEX_PHYSICAL_PAGE);
+
+    uint64_t root_index = ppn >> PM_LEAF_LENGTH;
+    pm_leaf_t* leaf = pm_root[root_index];
+    if(leaf == NULL){
+        leaf = calloc(1,sizeof(pm_leaf_t));
+        pm_root[root_index] = leaf;
+    }
+    return leaf;
+}
+
+/**
+ * @brief host address of the physical frame with page number ppn,
+ *        the frame is allocated on first touch
+ *
+ * @param ppn physical page number
+ * @return uint8_t*
+ */
+uint8_t* pm_frame(uint64_t ppn){
+    pm_leaf_t* leaf = pm_leaf(ppn);
+    uint64_t leaf_index = ppn & (PM_LEAF_SIZE - 1);
+
+    uint8_t* frame = leaf->host[leaf_index];
+    if(frame == NULL){
+        frame = pm_carve_frame();
+        leaf->host[leaf_index] = frame;
+        pm_frames_allocated += 1;
+        debug_printf(DEBUG_MMU,"physical frame %lx allocated at host %p\n",ppn,frame);
+    }
+    return frame;
+}
+
+/**
+ * @brief host address of the physical byte paddr
+ *
+ * @param paddr physical address
+ * @return uint8_t*
+ */
+uint8_t* pm_host(uint64_t paddr){
+    assert(paddr < PHYSICAL_MEMORY_SPACE);
+    return pm_frame(paddr >> PHYSICAL_PAGE_OFFSET_LENGTH) + (paddr & PHYSICAL_PAGE_OFFSET_MASK);
+}
+
+// count of frames consuming host memory
+uint64_t pm_frame_count(){
+    return pm_frames_allocated;
+}
+
+/**
+ * @brief bookkeeping of the physical frame
+ *
+ * @param ppn physical page number
+ * @return pm_frame_meta_t*
+ */
+pm_frame_meta_t* pm_meta(uint64_t ppn){
+    return &pm_leaf(ppn)->meta[ppn & (PM_LEAF_SIZE - 1)];
+}
+
+/**
+ * @brief hand out a zero filled physical frame
+ *
+ * @return uint64_t physical page number
+ */
+uint64_t pm_frame_alloc(){
+    uint64_t ppn;
+    if(pm_free_frames != NULL && pm_free_frames->count > 0){
+        int found = array_get(pm_free_frames,pm_free_frames->count - 1,&ppn);
+        assert(found != 0);
+        array_delete(pm_free_frames,pm_free_frames->count - 1);
+    }else{
+        ppn = pm_next_ppn;
+        pm_next_ppn += 1;
+        if(ppn > MAX_INDEX_PHYSICAL_PAGE){
+            printf("physical memory: out of physical frames\n");
+            exit(1);
+        }
+    }
+
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    assert(meta->allocated == 0);
+    memset(meta,0,sizeof(pm_frame_meta_t));
+    meta->allocated = 1;
+    meta->refcount = 1;
+    return ppn;
+}
+
+/**
+ * @brief give the frame back, its host memory is returned to the host kernel
+ *
+ * @param ppn physical page number
+ */
+void pm_frame_free(uint64_t ppn){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    assert(meta->allocated == 1);
+    memset(meta,0,sizeof(pm_frame_meta_t));
+
+    // the anonymous mapping reads as zero again after MADV_DONTNEED
+    // a frame never touched has no host memory to give back
+    uint8_t* frame = pm_leaf(ppn)->host[ppn & (PM_LEAF_SIZE - 1)];
+    if(frame != NULL && madvise(frame,PHYSICAL_PAGE_SIZE,MADV_DONTNEED) != 0){
+        memset(frame,0,PHYSICAL_PAGE_SIZE);
+    }
+
+    if(pm_free_frames == NULL){
+        pm_free_frames = array_construct(64);
+    }
+    array_insert(&pm_free_frames,ppn);
+}
+
+/**
+ * @brief hand out num zero filled frames, contiguous and aligned to num
+ *        they back a huge page; the frames skipped for the alignment
+ *        are kept on the free list
+ *
+ * @param num power of 2
+ * @return uint64_t physical page number of the first frame
+ */
+uint64_t pm_frame_alloc_contiguous(uint64_t num){
+    assert(num > 0 && (num & (num - 1)) == 0);
+
+    uint64_t ppn = (pm_next_ppn + num - 1) & ~(num - 1);
+    if(ppn + num - 1 > MAX_INDEX_PHYSICAL_PAGE){
+        printf("physical memory: out of contiguous physical frames\n");
+        exit(1);
+    }
+    if(pm_free_frames == NULL){
+        pm_free_frames = array_construct(64);
+    }
+    for(uint64_t p=pm_next_ppn; p<ppn; ++p){
+        array_insert(&pm_free_frames,p);
+    }
+    pm_next_ppn = ppn + num;
+
+    for(uint64_t i=0; i<num; ++i){
+        pm_frame_meta_t* meta = pm_meta(ppn + i);
+        assert(meta->allocated == 0);
+        memset(meta,0,sizeof(pm_frame_meta_t));
+        meta->allocated = 1;
+        meta->pinned = 1;
+        meta->refcount = 1;
+    }
+    return ppn;
+}
+
+void pm_frame_get(uint64_t ppn){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    assert(meta->allocated == 1);
+    meta->refcount += 1;
+}
+
+/**
+ * @brief drop one mapping of the frame
+ *
+ * @param ppn
+ * @return int 1 if it was the last one and the frame is freed
+ */
+int pm_frame_put(uint64_t ppn){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    assert(meta->allocated == 1 && meta->refcount > 0);
+    meta->refcount -= 1;
+    if(meta->refcount > 0){
+        return 0;
+    }
+    pm_frame_free(ppn);
+    return 1;
+}
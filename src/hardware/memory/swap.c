@@ -0,0 +1,407 @@
+// Swap device and page replacement
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "headers/common.h"
+#include "headers/cpu.h"
+#include "headers/memory.h"
+#include "headers/algorithm.h"
+
+/*
+The user pages resident in physical memory are kept in resident[], at most
+frame_budget of them. Once the budget is reached, a page fault does not get
+a new frame: a victim is picked by the eviction policy, written to the swap
+file if it has no clean copy there, unmapped, and its frame is reused.
+
+    swap file
+    +-----------+-----------+-----------+----
+    |  slot 0   |  slot 1   |  slot 2   | ...     one slot = one 4KB page
+    +-----------+-----------+-----------+----
+
+A non-present pte holds (slot + 1) as its swap_id, 0 means demand zero.
+A frame keeps the slot it was read from as its clean copy. Each of them
+holds one reference to the slot; the slot goes to the free list with the
+last one and is handed out again before the file grows.
+
+Every frame in resident[] keeps its position there in its resident_id, so
+it leaves in O(1): the last page of resident[] moves into the hole.
+
+A frame shared by fork is mapped by several ptes and is not in resident[]
+until the copy on write leaves it with one mapping. The swapped out pages
+are shared by fork through their slots: a dirty page is written to a new
+slot instead of overwriting one referenced elsewhere.
+*/
+#define DEFAULT_FRAME_BUDGET            (16384)     // 64MB
+#define DEFAULT_WORKING_SET_WINDOW      (1024)
+
+static FILE* swap_file = NULL;
+static uint64_t swap_next_slot = 0;   // end of the swap file in slots
+static uint32_t* slot_refs = NULL;     // references of each slot, 0 if free
+static array_t* free_slots = NULL;     // slots below swap_next_slot not in use
+
+static array_t* resident = NULL;       // ppn of the resident user pages
+static uint64_t clock_hand = 0;
+
+static evict_policy_t evict_policy = EVICT_CLOCK;
+static uint64_t frame_budget = DEFAULT_FRAME_BUDGET;
+static uint64_t working_set_window = DEFAULT_WORKING_SET_WINDOW;
+
+static void swap_cleanup(){
+    if(swap_file != NULL){
+        fclose(swap_file);
+        swap_file = NULL;
+    }
+    if(resident != NULL){
+        array_free(resident);
+        resident = NULL;
+    }
+    if(free_slots != NULL){
+        array_free(free_slots);
+        free_slots = NULL;
+    }
+    free(slot_refs);
+    slot_refs = NULL;
+    swap_next_slot = 0;
+    clock_hand = 0;
+}
+
+static void lazy_initialize_swap(){
+    if(resident != NULL){
+        return;
+    }
+    resident = array_construct(64);
+    free_slots = array_construct(64);
+    add_cleanup_event(&swap_cleanup);
+}
+
+/**
+ * @brief use filename as the swap device, the old content is discarded
+ *
+ * @param filename
+ */
+void swap_open(const char* filename){
+    lazy_initialize_swap();
+    assert(swap_file == NULL);
+
+    swap_file = fopen(filename,"w+b");
+    if(swap_file == NULL){
+        printf("swap: unable to open swap file %s\n",filename);
+        exit(1);
+    }
+}
+
+static int swap_fd(){
+    if(swap_file == NULL){
+        // default: anonymous temporary file, removed on exit
+        swap_file = tmpfile();
+        if(swap_file == NULL){
+            printf("swap: unable to create the swap file\n");
+            exit(1);
+        }
+    }
+    return fileno(swap_file);
+}
+
+void paging_set_policy(evict_policy_t policy){
+    evict_policy = policy;
+}
+
+void paging_set_frame_budget(uint64_t frames){
+    assert(frames > 0);
+    frame_budget = frames;
+}
+
+void paging_set_working_set_window(uint64_t window){
+    working_set_window = window;
+}
+
+/**
+ * @brief copy the page in swap slot (swap_id - 1) to the physical frame
+ *
+ * @param swap_id
+ * @param ppn
+ */
+void swap_in(uint64_t swap_id, uint64_t ppn){
+    assert(swap_id != 0);
+    off_t offset = (off_t)(swap_id - 1) * PHYSICAL_PAGE_SIZE;
+    if(pread(swap_fd(),pm_frame(ppn),PHYSICAL_PAGE_SIZE,offset) != PHYSICAL_PAGE_SIZE){
+        printf("swap: unable to read slot %lu\n",swap_id - 1);
+        exit(1);
+    }
+    paging_stats.swap_ins += 1;
+
+    // the slot stays with the frame as its clean copy
+    pm_meta(ppn)->swap_id = swap_id;
+}
+
+// a free slot with one reference, the file grows when there is none
+static uint64_t swap_slot_alloc(){
+    uint64_t slot;
+    if(free_slots->count > 0){
+        array_get(free_slots,free_slots->count - 1,&slot);
+        array_delete(free_slots,free_slots->count - 1);
+        assert(slot_refs[slot] == 0);
+    }else{
+        slot = swap_next_slot;
+        swap_next_slot += 1;
+        if((swap_next_slot & (swap_next_slot - 1)) == 0){
+            // grow the references at the powers of 2
+            slot_refs = realloc(slot_refs,swap_next_slot * 2 * sizeof(uint32_t));
+        }
+    }
+    slot_refs[slot] = 1;
+    paging_stats.swap_slots += 1;
+    return slot + 1;
+}
+
+/**
+ * @brief one more reference to the slot (swap_id - 1), e.g. a pte copied by fork
+ *
+ * @param swap_id
+ */
+void swap_slot_get(uint64_t swap_id){
+    assert(swap_id != 0 && slot_refs[swap_id - 1] > 0);
+    slot_refs[swap_id - 1] += 1;
+}
+
+/**
+ * @brief drop one reference to the slot (swap_id - 1), the last one frees it
+ *
+ * @param swap_id 0 for demand zero: nothing to drop
+ */
+void swap_slot_put(uint64_t swap_id){
+    if(swap_id == 0){
+        return;
+    }
+    assert(slot_refs[swap_id - 1] > 0);
+    slot_refs[swap_id - 1] -= 1;
+    if(slot_refs[swap_id - 1] == 0){
+        array_insert(&free_slots,swap_id - 1);
+        paging_stats.swap_slots -= 1;
+    }
+}
+
+static uint64_t swap_out(uint64_t ppn){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    uint64_t swap_id = meta->swap_id;
+    if(swap_id != 0 && slot_refs[swap_id - 1] > 1){
+        // the clean copy is still the page of another address space
+        swap_slot_put(swap_id);
+        swap_id = 0;
+    }
+    if(swap_id == 0){
+        swap_id = swap_slot_alloc();
+    }
+
+    off_t offset = (off_t)(swap_id - 1) * PHYSICAL_PAGE_SIZE;
+    if(pwrite(swap_fd(),pm_frame(ppn),PHYSICAL_PAGE_SIZE,offset) != PHYSICAL_PAGE_SIZE){
+        printf("swap: unable to write slot %lu\n",swap_id - 1);
+        exit(1);
+    }
+    paging_stats.swap_outs += 1;
+    return swap_id;
+}
+
+static inline pte_t* frame_pte(pm_frame_meta_t* meta){
+    return (pte_t*)pm_host(meta->pte_paddr);
+}
+
+// clear the reference bit; the tlb entries must go as well
+// otherwise the next accesses would not reach the walker to set it again
+static inline int test_and_clear_reference(pm_frame_meta_t* meta){
+    pte_t* pte = frame_pte(meta);
+    int referenced = pte->reference;
+    if(referenced){
+        pte->reference = 0;
+        mmu_invalidate(meta->vaddr);
+    }
+    return referenced;
+}
+
+/*======================================*/
+/*          eviction policies           */
+/*======================================*/
+
+static uint64_t resident_ppn(uint64_t index){
+    uint64_t ppn;
+    array_get(resident,index,&ppn);
+    return ppn;
+}
+
+// second chance: sweep the clock hand, clearing reference bits,
+// until a page not referenced since the last sweep is found
+static uint64_t select_victim_clock(){
+    while(1){
+        uint64_t index = clock_hand;
+        clock_hand = (clock_hand + 1) % resident->count;
+
+        pm_frame_meta_t* meta = pm_meta(resident_ppn(index));
+        if(test_and_clear_reference(meta) == 0){
+            return index;
+        }
+    }
+}
+
+// aging: shift the counters right and put the reference bit on the top,
+// then evict the smallest counter (least recently used, approximately)
+static uint64_t select_victim_lru_aging(){
+    uint64_t victim = 0;
+    uint32_t victim_age = 0xffffffff;
+    for(uint64_t i=0; i<resident->count; ++i){
+        pm_frame_meta_t* meta = pm_meta(resident_ppn(i));
+        meta->age = (meta->age >> 1) | ((uint32_t)test_and_clear_reference(meta) << 31);
+        if(meta->age < victim_age){
+            victim_age = meta->age;
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+// wsclock: a page referenced since the last sweep is in the working set;
+// otherwise it leaves the working set when it has not been used for the
+// window of virtual time. prefer clean pages, which need no swap out
+static uint64_t select_victim_working_set(){
+    uint64_t now = paging_stats.virtual_time;
+    uint64_t oldest = clock_hand;
+    uint64_t oldest_use = 0xffffffffffffffff;
+    int64_t dirty_candidate = -1;
+
+    for(uint64_t n=0; n<resident->count; ++n){
+        uint64_t index = clock_hand;
+        clock_hand = (clock_hand + 1) % resident->count;
+
+        pm_frame_meta_t* meta = pm_meta(resident_ppn(index));
+        if(test_and_clear_reference(meta)){
+            meta->last_use = now;
+            continue;
+        }
+        if(now - meta->last_use > working_set_window){
+            if(frame_pte(meta)->dirty == 0 && meta->swap_id != 0){
+                return index;
+            }
+            if(dirty_candidate == -1){
+                dirty_candidate = index;
+            }
+        }
+        if(meta->last_use < oldest_use){
+            oldest_use = meta->last_use;
+            oldest = index;
+        }
+    }
+    if(dirty_candidate != -1){
+        return (uint64_t)dirty_candidate;
+    }
+    // every page is in the working set: fall back to the oldest one
+    return oldest;
+}
+
+static void evict(uint64_t ppn){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    pte_t* pte = frame_pte(meta);
+    assert(pte->present == 1 && pte->ppn == ppn);
+
+    uint64_t swap_id = meta->swap_id;
+    if(pte->dirty == 1 || swap_id == 0){
+        // no clean copy on the swap device
+        swap_id = swap_out(ppn);
+    }
+    // the reference to the slot moves from the frame to the pte
+    meta->swap_id = 0;
+    pte->pte_value = 0;
+    pte->swap_id = swap_id;
+    mmu_invalidate(meta->vaddr);
+
+    paging_stats.evictions += 1;
+    debug_printf(DEBUG_MMU,"evict vaddr %lx from frame %lx to swap slot %lu\n",meta->vaddr,ppn,swap_id - 1);
+}
+
+static void resident_add(uint64_t ppn){
+    array_insert(&resident,ppn);
+    pm_meta(ppn)->resident_id = resident->count;
+}
+
+/**
+ * @brief a resident frame for a faulting user page
+ *
+ * @return uint64_t physical page number
+ */
+uint64_t paging_acquire_frame(){
+    lazy_initialize_swap();
+
+    if(resident->count < frame_budget){
+        uint64_t ppn = pm_frame_alloc();
+        resident_add(ppn);
+        return ppn;
+    }
+
+    uint64_t index = 0;
+    switch(evict_policy){
+        case EVICT_CLOCK:
+            index = select_victim_clock();
+            break;
+        case EVICT_LRU_AGING:
+            index = select_victim_lru_aging();
+            break;
+        case EVICT_WORKING_SET:
+            index = select_victim_working_set();
+            break;
+        default:
+            printf("paging: unknown eviction policy %d\n",evict_policy);
+            exit(1);
+    }
+    uint64_t ppn = resident_ppn(index);
+    evict(ppn);
+    return ppn;
+}
+
+/**
+ * @brief bind the frame to its user page
+ *
+ * @param ppn
+ * @param vaddr
+ * @param pte_paddr
+ */
+void paging_track_frame(uint64_t ppn, uint64_t vaddr, uint64_t pte_paddr){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    meta->vaddr = vaddr & ~PHYSICAL_PAGE_OFFSET_MASK;
+    meta->pte_paddr = pte_paddr;
+    meta->last_use = paging_stats.virtual_time;
+    meta->age = 0x80000000;
+}
+
+/**
+ * @brief the frame no longer backs a swappable user page,
+ *        e.g. its page has been promoted into a huge page
+ *
+ * @param ppn
+ */
+void paging_untrack_frame(uint64_t ppn){
+    pm_frame_meta_t* meta = pm_meta(ppn);
+    if(meta->resident_id == 0){
+        return;
+    }
+    uint64_t index = meta->resident_id - 1;
+    uint64_t last = resident->count - 1;
+    assert(resident_ppn(index) == ppn);
+    if(index != last){
+        // the last page fills the hole, the clock hand gets to it there
+        uint64_t moved = resident_ppn(last);
+        resident->table[index] = moved;
+        pm_meta(moved)->resident_id = index + 1;
+    }
+    array_delete(resident,last);
+    meta->resident_id = 0;
+    if(clock_hand >= resident->count){
+        clock_hand = 0;
+    }
+}
+
+void paging_adopt_frame(uint64_t ppn){
+    lazy_initialize_swap();
+    resident_add(ppn);
+}
+
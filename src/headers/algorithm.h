@@ -62,6 +62,7 @@ void trie_print(trie_node_t* root);
 typedef struct{
     int             localdepth;     // the local depth
     int             counter;        // the counter of slots (have data)
+    int             capacity;       // the slots, more than size if the keys share one hash
     char**          karray;
     uint64_t*       varray;
 }hashtable_bucket_t;
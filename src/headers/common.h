@@ -16,8 +16,9 @@
 
 #define DEBUG_VERBOSE_SET         (0x241)
 
-// do page walk
-#define DEBUG_ENABLE_PAGE_WALK    (0x0)
+// do page walk: demand paging with the swap device
+// otherwise the virtual address is mapped onto the physical space directly
+#define DEBUG_ENABLE_PAGE_WALK    (0x1)
 
 // use sram cache for memory access
 #define DEBUG_ENABLE_SRAM_CACHE   (0x0)
@@ -251,6 +251,19 @@ typedef struct
 }cpu_pc_t;
 cpu_pc_t cpu_pc;
 
+// control registers
+typedef struct
+{
+    uint64_t cr0;
+    uint64_t cr1;
+    uint64_t cr2;   // the virtual address of the last page fault
+    uint64_t cr3;   // physical address of the page global directory, 0 if not created
+}cpu_cr_t;
+cpu_cr_t cpu_controls;
+
+// cycles of the emulator: one per instruction, plus the stalls on the dram
+uint64_t cpu_cycles;
+
 #define NUM_INSTRTYPE           14
 
 // CPU's instruction cycle : execution of instructions
@@ -266,5 +279,29 @@ void instruction_cycle();
 // each MMU is owned by each core
 uint64_t va2pa(uint64_t vaddr);
 
+// drop the page from the tlbs after its pte has changed
+void mmu_invalidate(uint64_t vaddr);
+// unmap and free the whole address space
+void mmu_free_address_space();
+// the address space of the forked child, sharing the pages copy on write
+uint64_t mmu_fork_address_space();
+void mmu_unmap_page(uint64_t vaddr);
+
+// tlb model: set associative tlbs for 4KB, 2MB and 1GB pages
+typedef struct{
+    uint64_t    hits;
+    uint64_t    misses;
+    uint64_t    page_walks;
+    uint64_t    walk_references;    // page table entries read by the walker
+}tlb_stats_t;
+tlb_stats_t tlb_stats;
+
+void mmu_set_tlb_model(int enable);
+void tlb_flush();
+
+// huge pages: explicit mapping and transparent promotion of 2MB regions
+void mmu_map_hugepage(uint64_t vaddr, int offset_length);
+void mmu_set_thp(int enable);
+
 // end of include guard
 #endif
\ No newline at end of file
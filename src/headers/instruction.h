@@ -20,6 +20,8 @@ typedef enum{
     INST_CMP,               //8
     INST_JNE,               //9
     INST_JMP,               //10
+    INST_SYSCALL,           //11
+    INST_LEA,               //12
 }op_t;
 
 // operand type
@@ -41,6 +43,7 @@ typedef enum{
 // operand struct
 typedef struct{
     od_type_t type;    // IMM, REG, MEM
+    uint8_t   indirect;  // "*" of jmp and call: the target is loaded from the operand
     uint64_t  imm;     // immediate number
     uint64_t  scal;    // scale number of register 2
     uint64_t  reg1;    // main register
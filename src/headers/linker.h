@@ -60,40 +60,173 @@ hashtable_t* link_constant_dict;
 typedef struct{
     /* this is what's different in our implamentation. instead of byte offset,
         we use line index+char offset to locate the symbol */
-    uint8_t    r_row;       // line index of the symbol in buffer section
+    uint32_t   r_row;       // line index of the symbol in buffer section
                             // for .rel.text, that's the line index in .text section
                             // for .rel.data, thst's the line index in .data section
-    uint8_t    r_col;       // char offset in the buffer line
+    uint32_t   r_col;       // char offset in the buffer line
     reltype_t  type;        // relocation type
-    uint8_t    sym;         // symbol table index
+    uint32_t   sym;         // symbol table index
     int    r_addrend;   // constant part of relocation expression
 }rel_entry_t;
 
 
-#define MAX_ELF_FILE_LENGTH  (64)   // max 64 effective lines -> row
-#define MAX_ELF_FILE_WIDTH   (128)  // max 128 chars per line -> columns
-
 typedef struct{
-    char buffer[MAX_ELF_FILE_LENGTH][MAX_ELF_FILE_WIDTH];
+    // the effective lines, '\0' terminated and packed in one string pool:
+    // line i starts at pool + line_offset[i]
+    char*           pool;
+    uint64_t        pool_size;      // bytes used
+    uint64_t        pool_capacity;
+    uint64_t*       line_offset;
+    uint32_t        line_capacity;
+
+    uint32_t        line_count;
 
-    uint8_t         sht_count;    // section header number
+    uint32_t        sht_count;    // section header number
     sh_entry_t*     sht;          // section header pointer
 
-    uint8_t         symt_count;   // symbol table number
+    uint32_t        symt_count;   // symbol table number
     st_entry_t*     symt;         // symbol table pointer
 
-    uint8_t         line_count;
-
-    uint8_t         reltext_count;
+    uint32_t        reltext_count;
     rel_entry_t*    reltext;
 
-    uint8_t         reldata_count;
+    uint32_t        reldata_count;
     rel_entry_t*    reldata;
+
+    // a binary object is used in place: the tables and the pool point
+    // into its private mapping
+    void*           map;
+    uint64_t        map_size;
 }elf_t;
 
+// the pointer is valid until the next line is appended
+static inline char* elf_line(elf_t* elf, uint32_t index){
+    return elf->pool + elf->line_offset[index];
+}
+
+void elf_append_line(elf_t* elf, const char* line, uint64_t len);
+void elf_append_lines(elf_t* dst, elf_t* src, uint32_t first, uint32_t count);
+void elf_replace_line(elf_t* elf, uint32_t index, const char* line);
+
+/*===================================*/
+/*      binary relocatable object    */
+/*===================================*/
+
+/*
+    header          elf_bin_header_t
+    .sht            sht_count records of sh_entry_t
+    .symtab         symt_count records of st_entry_t
+    .rel.text       reltext_count records of rel_entry_t
+    .rel.data       reldata_count records of rel_entry_t
+    line index      line_count uint64_t offsets into the string pool
+    string pool     the effective lines of the text object, '\0' terminated
+
+The records have the layout of the structures in memory, every table
+starts 8 byte aligned, the integers are in the byte order of the host:
+the binary object is a cache of the host, rebuilt from the text object
+elsewhere. The lines are the same as in the text object, so sh_offset
+still indexes them.
+
+There is no string table: the names stay in the fixed size fields of the
+records, as the linker uses the records in place. The parser checks that
+every name ends inside its field and every relocation refers to a symbol
+of the object.
+*/
+#define ELF_BIN_MAGIC       "EOBJ"
+#define ELF_BIN_VERSION     (1)
+
+typedef struct{
+    char        magic[4];
+    uint32_t    version;
+
+    uint32_t    line_count;
+    uint32_t    sht_count;
+    uint32_t    symt_count;
+    uint32_t    reltext_count;
+    uint32_t    reldata_count;
+    uint32_t    unused;
+
+    // byte offsets in the file
+    uint64_t    sht_offset;
+    uint64_t    symt_offset;
+    uint64_t    reltext_offset;
+    uint64_t    reldata_offset;
+    uint64_t    line_index_offset;
+    uint64_t    pool_offset;
+    uint64_t    pool_size;
+}elf_bin_header_t;
+
+int is_binary_elf(const char* filename);
+void parse_binary_elf(const char* filename, elf_t* elf);
+void write_binary_elf(const char* filename, elf_t* elf);
+void free_binary_elf(elf_t* elf);
+
+/*===================================*/
+/*      static archive library       */
+/*===================================*/
+
+/*
+    "!<elfarch>\n"
+    <members>,<index entries>,<bloom bits>\n      3 x 16 hex digits
+    <bloom filter>\n                             bloom bits / 4 hex digits
+    <symbol>,<member>\n                          index entries, sorted by symbol
+    <member name>,<offset>,<size>\n              members
+    the text objects of the members
+
+The names are padded with spaces to ARCHIVE_NAME_WIDTH, the numbers are
+fixed width hex, so the archive is searched in place without a scan: the
+Bloom filter of the global symbols is tested first, then the index is
+binary searched. Bit b of the filter is bit b % 4 of the hex digit b / 4.
+The offset and the size of a member are in bytes from the file start.
+*/
+#define ARCHIVE_MAGIC           "!<elfarch>\n"
+#define ARCHIVE_NAME_WIDTH      (MAX_CHAR_SYMBOL_NAME - 1)
+#define ARCHIVE_BLOOM_HASHES    (4)
+#define ARCHIVE_BLOOM_BITS_PER_SYMBOL   (16)
+
+typedef struct ARCHIVE_STRUCT archive_t;
+
+typedef struct{
+    uint64_t    lookups;
+    uint64_t    bloom_rejects;  // the misses answered by the filter alone
+    uint64_t    members_extracted;
+}archive_stats_t;
+archive_stats_t archive_stats;
+
+int is_archive(const char* filename);
+void write_archive(const char* filename, char** members, int num_members);
+archive_t* archive_open(const char* filename);
+void archive_close(archive_t* ar);
+// the member defining the global symbol name, -1 if there is none
+int archive_lookup(archive_t* ar, const char* name);
+// append to srcs the members resolving the undefined symbols of srcs,
+// the members are owned by the archives
+int archive_extract(archive_t** ars, int num_ars, elf_t*** srcs, int* num_srcs);
+
 void parse_elf(char* filename, elf_t* elf);
+void parse_elf_stream(FILE* fp, elf_t* elf);
 void free_elf(elf_t* elf);
 void link_elf(elf_t** src, int num_src, elf_t* dst);
+void link_elf_placement(elf_t** srcs, int num_srcs, elf_t* dst, int** placement);
+void relocate_elf(elf_t** srcs, int num_srcs, elf_t* dst, int** placement);
+// threads of link_elf at most, 0 for the online processors
+void link_set_threads(int num_threads);
+// drop the symbols not reachable from main, off by default
+void link_set_gc_sections(int enable);
+// fold the identical functions of .text into one copy, off by default
+void link_set_icf(int enable);
+// the run-time address of .text, 0x00400000 by default
+void link_set_base(uint64_t base);
+// the shared EOF images the undefined functions are imported from, bound on the first call
+void link_set_needed(char** images, int num_images);
 void write_eof(const char* filename,elf_t* eof);
+// links into <eof_filename>.state as well, 1 if relinked incrementally
+int link_elf_incremental(char** filenames, int num_srcs, const char* eof_filename);
+
+typedef struct{
+    uint64_t    lines_patched;  // lines written in place in the EOF
+    uint64_t    rewrites;       // relinks writing the whole EOF: a line changed its length
+}incremental_stats_t;
+incremental_stats_t incremental_stats;
 
  #endif
@@ -9,26 +9,236 @@
 /*       physical memory on dram chips         */
 /*=============================================*/
 
+// 4KB page: the low 12 bits of an address are the in-page offset
+#define PHYSICAL_PAGE_OFFSET_LENGTH  (12)
+#define PHYSICAL_PAGE_SIZE           (1 << PHYSICAL_PAGE_OFFSET_LENGTH)
+#define PHYSICAL_PAGE_OFFSET_MASK    ((uint64_t)PHYSICAL_PAGE_SIZE - 1)
+
+// huge pages: mapped by a PMD (2MB) or PUD (1GB) entry with the hugepage bit
+#define PAGE_2M_OFFSET_LENGTH        (21)
+#define PAGE_2M_SIZE                 ((uint64_t)1 << PAGE_2M_OFFSET_LENGTH)
+#define PAGE_1G_OFFSET_LENGTH        (30)
+#define PAGE_1G_SIZE                 ((uint64_t)1 << PAGE_1G_OFFSET_LENGTH)
+
 // physical memory space is decided by the physical address
-// in this simulator, there are 4 + 4 + 6 = 16 bits physical address
-// then the physical space is (1 << 16) = 65536
-// total 16 physical memory
-#define PHYSICAL_MEMORY_SPACE      65536
-#define MAX_INDEX_PHYSICAL_PAGE    15
+// in this simulator, there are 36 bits physical address
+// then the physical space is (1 << 36) = 64GB, that is (1 << 24) pages of 4KB
+// the frames are allocated on first touch, so only the touched
+// frames consume host memory
+#define PHYSICAL_ADDRESS_LENGTH    (36)
+#define PHYSICAL_MEMORY_SPACE      ((uint64_t)1 << PHYSICAL_ADDRESS_LENGTH)
+#define MAX_INDEX_PHYSICAL_PAGE    ((PHYSICAL_MEMORY_SPACE >> PHYSICAL_PAGE_OFFSET_LENGTH) - 1)
 
 // physical memory
-// 16 physical memory pages
-uint8_t pm[PHYSICAL_MEMORY_SPACE];
+// sparse: host address of the physical frame / byte, allocated on first touch
+uint8_t* pm_frame(uint64_t ppn);
+uint8_t* pm_host(uint64_t paddr);
+uint64_t pm_frame_count();
+
+// bookkeeping of a physical frame handed out by pm_frame_alloc()
+typedef struct{
+    uint8_t     allocated;  // owned by page table or user page
+    uint8_t     pinned;     // page table frame: never evicted
+    uint32_t    refcount;   // page tables mapping the frame, > 1 if shared by fork
+    uint32_t    age;        // lru approximation: aging counter
+    uint64_t    vaddr;      // reverse mapping: page aligned vaddr of the user page
+    uint64_t    pte_paddr;  // reverse mapping: physical address of its level 4 pte
+    uint64_t    swap_id;    // swap slot + 1 holding a clean copy, 0 if none
+    uint64_t    last_use;   // working set: virtual time of the last reference
+    uint64_t    resident_id;// position in the resident pages + 1, 0 if not there
+}pm_frame_meta_t;
+
+// frame allocator: the frames below 1MB are never handed out
+#define PM_ALLOC_FIRST_PPN  (0x100)
+uint64_t pm_frame_alloc();
+void pm_frame_free(uint64_t ppn);
+pm_frame_meta_t* pm_meta(uint64_t ppn);
+// one more / one less mapping of the frame, the last put frees it
+void pm_frame_get(uint64_t ppn);
+int pm_frame_put(uint64_t ppn);
+// num contiguous frames aligned to num, pinned, to back a huge page
+uint64_t pm_frame_alloc_contiguous(uint64_t num);
+
+/*=============================================*/
+/*            4-level page table               */
+/*=============================================*/
+
+/*
+    |  VPN1 (9)  |  VPN2 (9)  |  VPN3 (9)  |  VPN4 (9)  |  VPO (12)  |
+    +------------------------------------------------------------------+
+    cr3 -> PGD[VPN1] -> PUD[VPN2] -> PMD[VPN3] -> PT[VPN4] -> frame
+
+The tables are physical frames themselves, so the walker reads the
+entries from DRAM. A table frame is pinned: it is never swapped out.
+*/
+#define PAGE_TABLE_ENTRY_LENGTH     (9)
+#define PAGE_TABLE_ENTRY_NUM        (1 << PAGE_TABLE_ENTRY_LENGTH)
+
+typedef union{
+    uint64_t pte_value;
+
+    // present == 1
+    struct{
+        uint64_t present        : 1;
+        uint64_t readonly       : 1;
+        uint64_t usermode       : 1;
+        uint64_t writethough    : 1;
+        uint64_t cachedisabled  : 1;
+        uint64_t reference      : 1;
+        uint64_t dirty          : 1;
+        uint64_t hugepage       : 1;    // PUD / PMD entry maps a 1GB / 2MB page
+        uint64_t unused8        : 1;
+        uint64_t cow            : 1;    // software bit: read-only until copied on write
+        uint64_t unused10_11    : 2;
+        uint64_t ppn            : 40;
+        uint64_t unused52_62    : 11;
+        uint64_t xdisabled      : 1;
+    };
+
+    // present == 0
+    // swap_id == 0: the page is never touched, demand zero
+    // swap_id != 0: the page is swapped out to slot (swap_id - 1)
+    struct{
+        uint64_t _present       : 1;
+        uint64_t swap_id        : 63;
+    };
+}pte_t;
+
+/*=============================================*/
+/*         demand paging and swap device       */
+/*=============================================*/
+
+// eviction policy when the resident frames reach the budget
+typedef enum{
+    EVICT_CLOCK,            // second chance on the reference bit
+    EVICT_LRU_AGING,        // lru approximation by aging counters
+    EVICT_WORKING_SET,      // wsclock: evict pages out of the working set window
+}evict_policy_t;
+
+typedef struct{
+    uint64_t    minor_faults;   // demand zero page, no disk I/O
+    uint64_t    major_faults;   // page read back from the swap device
+    uint64_t    evictions;      // resident page taken away
+    uint64_t    swap_outs;      // page written to the swap device
+    uint64_t    swap_ins;       // page read from the swap device
+    uint64_t    virtual_time;   // count of page walks
+    uint64_t    thp_promotions; // 2MB regions promoted to a huge page
+    uint64_t    cow_shared;     // pages mapped into the child by fork
+    uint64_t    cow_copied;     // write faults copying a shared page
+    uint64_t    cow_reused;     // write faults on a page no longer shared
+    uint64_t    frames_freed;   // frames released when the last mapping goes
+    uint64_t    swap_slots;     // slots referenced by a pte or a clean copy
+}paging_stats_t;
+paging_stats_t paging_stats;
+
+// the swap device is an anonymous temporary file unless opened here
+void swap_open(const char* filename);
+void paging_set_policy(evict_policy_t policy);
+void paging_set_frame_budget(uint64_t frames);
+void paging_set_working_set_window(uint64_t window);
+
+// a resident frame for the faulting user page: under the budget a new
+// frame is allocated, otherwise a victim is evicted and its frame reused
+uint64_t paging_acquire_frame();
+// record that ppn now holds the user page vaddr mapped by pte_paddr
+void paging_track_frame(uint64_t ppn, uint64_t vaddr, uint64_t pte_paddr);
+void paging_untrack_frame(uint64_t ppn);
+// the frame is resident and swappable again, e.g. no longer shared
+void paging_adopt_frame(uint64_t ppn);
+// one more / one less reference to the swap slot, the last put frees it
+void swap_slot_get(uint64_t swap_id);
+void swap_slot_put(uint64_t swap_id);
+void swap_in(uint64_t swap_id, uint64_t ppn);
+
+/*=============================================*/
+/*         loader of the EOF executable        */
+/*=============================================*/
+
+// map .text/.data/.rodata/.bss of the EOF file into a new address space,
+// the pages are populated from the mmap-ed file on the first touch
+void load_eof(const char* filename);
+uint64_t loader_section_address(const char* name);
+// bind the import [index] of the executable on its first call, see SYS_dl_resolve
+uint64_t loader_resolve(uint64_t index);
+// called by the page fault handler
+void loader_populate(uint64_t vaddr, uint8_t* frame);
+int loader_is_readonly(uint64_t vaddr);
+
+typedef struct{
+    uint64_t    resolutions;    // imports bound on their first call
+    uint64_t    images_loaded;  // shared images mapped by the resolver
+}dynamic_stats_t;
+dynamic_stats_t dynamic_stats;
 
 /*=============================================*/
 /*                   memory R/W                */
 /*=============================================*/
 
-// used by instructions: read or write uint64_t to DRAM
+// used by instructions: read or write 8/16/32/64 bits to DRAM
+// little-endian, paddr needs no alignment
+uint8_t read8bits_dram(uint64_t paddr);
+uint16_t read16bits_dram(uint64_t paddr);
+uint32_t read32bits_dram(uint64_t paddr);
 uint64_t read64bits_dram(uint64_t paddr);
+void write8bits_dram(uint64_t paddr, uint8_t data);
+void write16bits_dram(uint64_t paddr, uint16_t data);
+void write32bits_dram(uint64_t paddr, uint32_t data);
 void write64bits_dram(uint64_t paddr, uint64_t data);
+
+// bulk copy between DRAM and host buffer, len can span many frames
+void readblock_dram(uint64_t paddr, void* buf, uint64_t len);
+void writeblock_dram(uint64_t paddr, const void* buf, uint64_t len);
+void fillblock_dram(uint64_t paddr, uint8_t val, uint64_t len);
+
 void readinst_dram(uint64_t paddr, char* buf);
 void writeinst_dram(uint64_t paddr, const char* str);
 
+/*=============================================*/
+/*              dram timing model              */
+/*=============================================*/
+
+typedef enum{
+    DRAM_SCHED_FCFS,        // in arrival order
+    DRAM_SCHED_FR_FCFS,     // row hits first, then in arrival order
+}dram_sched_t;
+
+typedef struct{
+    uint64_t    requests;       // 64 byte lines
+    uint64_t    row_hits;       // the row is open in the row buffer
+    uint64_t    row_empty;      // the bank has no open row
+    uint64_t    bank_conflicts; // another row is open: precharge first
+    uint64_t    total_latency;  // cycles from arrival to the end of the burst
+    uint64_t    cycles;         // the cycle the last request is done
+}dram_timing_stats_t;
+dram_timing_stats_t dram_timing_stats;
+
+// the dram accessors charge every access to the timing model
+int dram_timing_enabled;
+
+void dram_timing_reset();
+void dram_timing_set_policy(dram_sched_t policy);
+// queue requests, then serve them all with the scheduling policy
+void dram_timing_enqueue(uint64_t paddr, int write, uint64_t arrival);
+uint64_t dram_timing_drain();
+// one access of the emulator arriving at its cycle, the queue stays open:
+// return the cycles the emulator stalls, a posted write none unless full
+uint64_t dram_timing_access(uint64_t paddr, uint64_t len, int write, uint64_t arrival);
+
+/*=============================================*/
+/*          virtual memory R/W (soft tlb)      */
+/*=============================================*/
+
+// used by instructions: read or write guest virtual address
+// the soft tlb caches guest virtual page -> host address of the page,
+// so a hit costs one compare and one host load/store.
+// a miss falls back to va2pa() and fills the soft tlb
+uint64_t read64bits_vaddr(uint64_t vaddr);
+void write64bits_vaddr(uint64_t vaddr, uint64_t data);
+void readinst_vaddr(uint64_t vaddr, char* buf);
+
+// drop all cached translations, call it whenever va2pa() mapping changes
+void softtlb_flush();
+void softtlb_invalidate(uint64_t vaddr);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,98 @@
+// include guards to prevent double declaration of any identifiers
+// such as types, enums and static variables
+#ifndef PROCESS_GUARD
+#define PROCESS_GUARD
+
+#include <stdint.h>
+#include "headers/cpu.h"
+
+/*=============================================*/
+/*              guest processes                */
+/*=============================================*/
+
+typedef enum{
+    PROCESS_RUNNABLE,
+    PROCESS_ZOMBIE,
+}process_state_t;
+
+// the context saved when the process is switched out
+typedef struct{
+    uint64_t            pid;
+    uint64_t            ppid;
+    process_state_t     state;
+    uint64_t            exit_code;
+
+    cpu_reg_t           reg;
+    cpu_flag_t          flags;
+    cpu_pc_t            pc;
+    uint64_t            cr3;
+
+    // the heap is [brk_start, brk)
+    uint64_t            brk_start;
+    uint64_t            brk;
+}process_t;
+
+// the process running on the cpu, pid 1 is created on first use
+uint64_t process_current();
+process_t* process_get(uint64_t pid);
+// save the context of the current process and load pid
+void process_switch(uint64_t pid);
+
+/*=============================================*/
+/*                 system calls                */
+/*=============================================*/
+
+// linux x86-64 numbers: rax holds the number, rdi the first argument
+#define SYS_brk     (12)
+#define SYS_fork    (57)
+#define SYS_exit    (60)
+// not a linux number: PLT0 traps into the lazy binding resolver of the loader,
+// r11 holds the index of the import, the resolved function runs next
+#define SYS_dl_resolve  (500)
+
+// called by the syscall instruction, the result is in rax
+void do_syscall();
+
+// the heap of every process starts here, and can grow to PROCESS_HEAP_MAX bytes
+#define PROCESS_HEAP_START  (0x01000000)
+#define PROCESS_HEAP_MAX    ((uint64_t)1 << 30)
+
+// set the program break of the current process, addr 0 queries it
+// return the new break, or the old one if addr is out of the heap
+uint64_t process_brk(uint64_t addr);
+// move the break by incr bytes, return the old break, 0 if it fails
+uint64_t process_sbrk(int64_t incr);
+
+/*=============================================*/
+/*        guest heap allocator (libc side)     */
+/*=============================================*/
+
+/*
+The allocator keeps all its state in the guest heap and only reaches it
+through the virtual memory accessors, as a malloc linked into the guest
+program would. The heap grows by sbrk.
+*/
+typedef struct{
+    uint64_t    mallocs;
+    uint64_t    frees;
+    uint64_t    reallocs;
+    uint64_t    cache_hits;     // served from a size class cache
+    uint64_t    extends;        // sbrk calls to grow the heap
+    uint64_t    payload;        // usable bytes of the blocks allocated now
+    uint64_t    peak_payload;   // the maximum of payload
+    uint64_t    host_ns;        // host time spent in malloc, free and realloc
+}heap_stats_t;
+heap_stats_t heap_stats;
+
+// return the guest virtual address of the payload, 0 if out of memory
+uint64_t heap_malloc(uint64_t size);
+void heap_free(uint64_t ptr);
+uint64_t heap_realloc(uint64_t ptr, uint64_t size);
+// bytes usable in the block of ptr
+uint64_t heap_usable_size(uint64_t ptr);
+// the peak payload over the heap of the current process, up to its break
+double heap_utilization();
+// calls of malloc, free and realloc per second of the host time in them
+double heap_throughput();
+
+#endif
@@ -0,0 +1,96 @@
+// include guards to prevent double declaration of any identifiers
+// such as types, enums and static variables
+#ifndef TRACE_GUARD
+#define TRACE_GUARD
+
+#include <stdint.h>
+
+/*=============================================*/
+/*          memory access trace format         */
+/*=============================================*/
+
+/*
+    file header     "ETRC" + uint32 version
+    block           uint32 raw size
+                    uint32 stored size
+                    uint32 count of records
+                    uint32 flags: TRACE_BLOCK_COMPRESSED
+                    stored size bytes of payload
+    block ...
+
+The raw payload of a block is the sequence of records:
+
+    uint8       type (2 bits) | log2 of size (3 bits) << 2 | same rip (1 bit) << 5
+    varint      zigzag of (addr - addr of the previous record)
+    varint      zigzag of (rip - rip of the previous record), absent if same rip
+
+The deltas start from 0 in every block, so the blocks decode independently.
+The stored payload is the raw payload compressed by a byte oriented LZ77.
+All integers are little-endian.
+*/
+#define TRACE_MAGIC             "ETRC"
+#define TRACE_VERSION           (1)
+#define TRACE_BLOCK_COMPRESSED  (0x1)
+
+// raw payload of a block, at most
+#define TRACE_BLOCK_SIZE        (256 * 1024)
+// bytes of one encoded record, at most
+#define TRACE_RECORD_MAX_SIZE   (1 + 10 + 10)
+
+typedef enum{
+    TRACE_LOAD,
+    TRACE_STORE,
+    TRACE_FETCH,
+}trace_type_t;
+
+typedef struct{
+    trace_type_t    type;
+    uint32_t        size;   // bytes accessed, a power of 2 up to 128
+    uint64_t        addr;   // virtual address
+    uint64_t        rip;    // the instruction doing the access
+}trace_record_t;
+
+// codec shared by the writer and the reader
+uint64_t trace_encode(uint8_t* buf, trace_record_t* rec, trace_record_t* prev);
+uint64_t trace_decode(const uint8_t* buf, trace_record_t* rec, trace_record_t* prev);
+uint64_t trace_compress(const uint8_t* src, uint64_t len, uint8_t* dst, uint64_t cap);
+int trace_decompress(const uint8_t* src, uint64_t len, uint8_t* dst, uint64_t raw_len);
+
+/*=============================================*/
+/*       writer: the emulator captures         */
+/*=============================================*/
+
+// checked by the memory accessors before calling trace_capture()
+int trace_capture_enabled;
+
+// the blocks are compressed and written by a writer thread
+void trace_open(const char* filename);
+void trace_capture(trace_type_t type, uint64_t addr, uint32_t size, uint64_t rip);
+void trace_close();
+
+/*=============================================*/
+/*       reader: standalone library            */
+/*=============================================*/
+
+typedef struct TRACE_READER_STRUCT trace_reader_t;
+
+trace_reader_t* trace_reader_open(const char* filename);
+// 1 if rec is filled, 0 at the end of the trace
+int trace_reader_next(trace_reader_t* reader, trace_record_t* rec);
+void trace_reader_close(trace_reader_t* reader);
+
+/*=============================================*/
+/*       LRU stack distance cache analysis     */
+/*=============================================*/
+
+typedef struct STACKDIST_STRUCT stackdist_t;
+
+// one pass over the references covers the LRU caches with 1, 2, 4, ...
+// (1 << max_sets_length) sets and associativity 1 to max_distance
+stackdist_t* stackdist_construct(int line_length, int max_sets_length, uint64_t max_distance);
+void stackdist_free(stackdist_t* sd);
+void stackdist_access(stackdist_t* sd, uint64_t addr);
+uint64_t stackdist_misses(stackdist_t* sd, uint64_t num_sets, uint64_t assoc);
+uint64_t stackdist_references(stackdist_t* sd);
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers/linker.h"
+#include "headers/common.h"
+#include "headers/algorithm.h"
+
+#define ARCHIVE_HEADER_SIZE     (sizeof(ARCHIVE_MAGIC) - 1 + 3 * 17)
+#define ARCHIVE_INDEX_SIZE      (ARCHIVE_NAME_WIDTH + 1 + 16 + 1)
+#define ARCHIVE_MEMBER_SIZE     (ARCHIVE_NAME_WIDTH + 1 + 16 + 1 + 16 + 1)
+
+struct ARCHIVE_STRUCT{
+    char*       map;
+    uint64_t    size;
+
+    uint64_t    num_members;
+    uint64_t    num_index;
+    uint64_t    bloom_bits;
+
+    const char* bloom;
+    const char* index;
+    const char* members;
+
+    elf_t**     extracted;  // the parsed members, NULL until extracted
+};
+
+static uint64_t hash_name(const char* name){
+    uint64_t hash = 0xcbf29ce484222325;
+    for(int i=0; name[i]!='\0'; ++i){
+        hash = (hash ^ (uint8_t)name[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// the bit of the i-th hash: double hashing of one FNV-1a
+static inline uint64_t bloom_bit(uint64_t hash, int i, uint64_t bits){
+    return (hash + i * ((hash >> 32) | 1)) % bits;
+}
+
+static inline int hex_value(char c){
+    return c <= '9' ? c - '0' : c - 'a' + 10;
+}
+
+static uint64_t hex_field(const char* str){
+    uint64_t value = 0;
+    for(int i=0; i<16; ++i){
+        value = (value << 4) | hex_value(str[i]);
+    }
+    return value;
+}
+
+// compare name with the space padded name of a record
+static int compare_record_name(const char* name, const char* record){
+    int i = 0;
+    for(; i<ARCHIVE_NAME_WIDTH && name[i]!='\0'; ++i){
+        if(name[i] != record[i]){
+            return (uint8_t)name[i] - (uint8_t)record[i];
+        }
+    }
+    return i == ARCHIVE_NAME_WIDTH || record[i] == ' ' ? 0 : -1;
+}
+
+/*======================================*/
+/*      writer                          */
+/*======================================*/
+
+typedef struct{
+    char*       name;
+    uint64_t    member;
+}archive_entry_t;
+
+static int compare_entry(const void* a, const void* b){
+    const archive_entry_t* ea = a;
+    const archive_entry_t* eb = b;
+    int c = strcmp(ea->name,eb->name);
+    if(c != 0){
+        return c;
+    }
+    return (ea->member > eb->member) - (ea->member < eb->member);
+}
+
+static char* read_file(const char* filename, uint64_t* size){
+    FILE* fp = fopen(filename,"rb");
+    if(fp == NULL){
+        printf("unable to open file %s\n",filename);
+        exit(1);
+    }
+    fseek(fp,0,SEEK_END);
+    *size = ftell(fp);
+    fseek(fp,0,SEEK_SET);
+    char* buf = malloc(*size + 1);
+    if(fread(buf,1,*size,fp) != *size){
+        printf("unable to read file %s\n",filename);
+        exit(1);
+    }
+    fclose(fp);
+    return buf;
+}
+
+static int is_defined(st_entry_t* sym){
+    return sym->bind != STB_LOCAL &&
+        strcmp(sym->st_shndx,"SHN_UNDEF") != 0 && strcmp(sym->st_shndx,"COMMON") != 0;
+}
+
+/**
+ * @brief bundle the text objects into an archive indexing their global symbols
+ *
+ * @param filename
+ * @param members the text object files
+ * @param num_members
+ */
+void write_archive(const char* filename, char** members, int num_members){
+    // the defined global symbols of every member
+    uint64_t num_entries = 0;
+    uint64_t capacity = 64;
+    archive_entry_t* entries = malloc(capacity * sizeof(archive_entry_t));
+    for(int m=0; m<num_members; ++m){
+        elf_t elf;
+        parse_elf(members[m],&elf);
+        for(int k=0; k<elf.symt_count; ++k){
+            if(!is_defined(&elf.symt[k])){
+                continue;
+            }
+            if(num_entries == capacity){
+                capacity *= 2;
+                entries = realloc(entries,capacity * sizeof(archive_entry_t));
+            }
+            entries[num_entries].name = strdup(elf.symt[k].st_name);
+            entries[num_entries].member = m;
+            num_entries += 1;
+        }
+        free_elf(&elf);
+    }
+    // the first member defining a symbol is the one linked
+    qsort(entries,num_entries,sizeof(archive_entry_t),&compare_entry);
+    uint64_t num_index = 0;
+    for(uint64_t i=0; i<num_entries; ++i){
+        if(num_index > 0 && strcmp(entries[num_index - 1].name,entries[i].name) == 0){
+            free(entries[i].name);
+            continue;
+        }
+        entries[num_index] = entries[i];
+        num_index += 1;
+    }
+
+    uint64_t bloom_bits = (num_index * ARCHIVE_BLOOM_BITS_PER_SYMBOL + 63) / 64 * 64;
+    bloom_bits = bloom_bits == 0 ? 64 : bloom_bits;
+    uint8_t* nibbles = calloc(bloom_bits / 4,1);
+    for(uint64_t i=0; i<num_index; ++i){
+        uint64_t hash = hash_name(entries[i].name);
+        for(int h=0; h<ARCHIVE_BLOOM_HASHES; ++h){
+            uint64_t b = bloom_bit(hash,h,bloom_bits);
+            nibbles[b / 4] |= 1 << (b % 4);
+        }
+    }
+
+    FILE* fp = fopen(filename,"w");
+    if(fp == NULL){
+        printf("unable to open file: %s\n",filename);
+        exit(1);
+    }
+    fprintf(fp,"%s%016lx,%016lx,%016lx\n",ARCHIVE_MAGIC,(uint64_t)num_members,num_index,bloom_bits);
+    for(uint64_t i=0; i<bloom_bits / 4; ++i){
+        fputc("0123456789abcdef"[nibbles[i]],fp);
+    }
+    fputc('\n',fp);
+    for(uint64_t i=0; i<num_index; ++i){
+        fprintf(fp,"%-*s,%016lx\n",ARCHIVE_NAME_WIDTH,entries[i].name,entries[i].member);
+        free(entries[i].name);
+    }
+
+    // the members follow the member table
+    uint64_t offset = ARCHIVE_HEADER_SIZE + bloom_bits / 4 + 1 +
+        num_index * ARCHIVE_INDEX_SIZE + num_members * ARCHIVE_MEMBER_SIZE;
+    uint64_t* sizes = malloc((num_members + 1) * sizeof(uint64_t));
+    for(int m=0; m<num_members; ++m){
+        free(read_file(members[m],&sizes[m]));
+        const char* name = strrchr(members[m],'/') == NULL ? members[m] : strrchr(members[m],'/') + 1;
+        if(strlen(name) > ARCHIVE_NAME_WIDTH){
+            printf("the member name %s is too long\n",name);
+            exit(1);
+        }
+        fprintf(fp,"%-*s,%016lx,%016lx\n",ARCHIVE_NAME_WIDTH,name,offset,sizes[m]);
+        offset += sizes[m];
+    }
+    for(int m=0; m<num_members; ++m){
+        uint64_t size;
+        char* buf = read_file(members[m],&size);
+        assert(size == sizes[m]);
+        fwrite(buf,1,size,fp);
+        free(buf);
+    }
+    assert(ftell(fp) == offset);
+    fclose(fp);
+
+    free(sizes);
+    free(nibbles);
+    free(entries);
+}
+
+/*======================================*/
+/*      reader                          */
+/*======================================*/
+
+int is_archive(const char* filename){
+    FILE* fp = fopen(filename,"rb");
+    if(fp == NULL){
+        return 0;
+    }
+    char magic[sizeof(ARCHIVE_MAGIC) - 1];
+    int archive = fread(magic,1,sizeof(magic),fp) == sizeof(magic) &&
+        memcmp(magic,ARCHIVE_MAGIC,sizeof(magic)) == 0;
+    fclose(fp);
+    return archive;
+}
+
+/**
+ * @brief map the archive, nothing is read until a symbol is looked up
+ *
+ * @param filename
+ * @return archive_t*
+ */
+archive_t* archive_open(const char* filename){
+    int fd = open(filename,O_RDONLY);
+    struct stat st;
+    if(fd == -1 || fstat(fd,&st) == -1){
+        printf("unable to open file %s\n",filename);
+        exit(1);
+    }
+    uint64_t size = st.st_size;
+    if(size < ARCHIVE_HEADER_SIZE){
+        printf("archive %s is truncated\n",filename);
+        exit(1);
+    }
+    char* map = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(map == MAP_FAILED){
+        printf("unable to map file %s\n",filename);
+        exit(1);
+    }
+
+    archive_t* ar = calloc(1,sizeof(archive_t));
+    ar->map = map;
+    ar->size = size;
+    const char* header = map + sizeof(ARCHIVE_MAGIC) - 1;
+    ar->num_members = hex_field(header);
+    ar->num_index = hex_field(header + 17);
+    ar->bloom_bits = hex_field(header + 34);
+    ar->bloom = map + ARCHIVE_HEADER_SIZE;
+    ar->index = ar->bloom + ar->bloom_bits / 4 + 1;
+    ar->members = ar->index + ar->num_index * ARCHIVE_INDEX_SIZE;
+    if(memcmp(map,ARCHIVE_MAGIC,sizeof(ARCHIVE_MAGIC) - 1) != 0 ||
+        ar->bloom_bits == 0 || ar->bloom_bits % 64 != 0 ||
+        ar->members + ar->num_members * ARCHIVE_MEMBER_SIZE > map + size){
+        printf("archive %s is corrupted\n",filename);
+        exit(1);
+    }
+    ar->extracted = calloc(ar->num_members + 1,sizeof(elf_t*));
+    return ar;
+}
+
+void archive_close(archive_t* ar){
+    for(uint64_t m=0; m<ar->num_members; ++m){
+        if(ar->extracted[m] != NULL){
+            free_elf(ar->extracted[m]);
+            free(ar->extracted[m]);
+        }
+    }
+    free(ar->extracted);
+    munmap(ar->map,ar->size);
+    free(ar);
+}
+
+int archive_lookup(archive_t* ar, const char* name){
+    archive_stats.lookups += 1;
+    uint64_t hash = hash_name(name);
+    for(int h=0; h<ARCHIVE_BLOOM_HASHES; ++h){
+        uint64_t b = bloom_bit(hash,h,ar->bloom_bits);
+        if((hex_value(ar->bloom[b / 4]) & (1 << (b % 4))) == 0){
+            archive_stats.bloom_rejects += 1;
+            return -1;
+        }
+    }
+
+    int64_t low = 0;
+    int64_t high = ar->num_index - 1;
+    while(low <= high){
+        int64_t mid = low + (high - low) / 2;
+        const char* record = ar->index + mid * ARCHIVE_INDEX_SIZE;
+        int c = compare_record_name(name,record);
+        if(c == 0){
+            return hex_field(record + ARCHIVE_NAME_WIDTH + 1);
+        }else if(c < 0){
+            high = mid - 1;
+        }else{
+            low = mid + 1;
+        }
+    }
+    return -1;
+}
+
+// parse the member from its text in the mapping
+static elf_t* extract_member(archive_t* ar, uint64_t m){
+    if(ar->extracted[m] != NULL){
+        return ar->extracted[m];
+    }
+    const char* record = ar->members + m * ARCHIVE_MEMBER_SIZE;
+    uint64_t offset = hex_field(record + ARCHIVE_NAME_WIDTH + 1);
+    uint64_t size = hex_field(record + ARCHIVE_NAME_WIDTH + 18);
+    assert(offset <= ar->size && size <= ar->size - offset);
+    int name_length = 0;
+    while(name_length < ARCHIVE_NAME_WIDTH && record[name_length] != ' '){
+        name_length += 1;
+    }
+    debug_printf(DEBUG_LINKER,"archive: extract %.*s\n",name_length,record);
+
+    FILE* fp = fmemopen(ar->map + offset,size,"r");
+    elf_t* elf = malloc(sizeof(elf_t));
+    parse_elf_stream(fp,elf);
+    fclose(fp);
+    ar->extracted[m] = elf;
+    archive_stats.members_extracted += 1;
+    return elf;
+}
+
+// push the undefined globals of elf, record the defined ones
+static void scan_symbols(elf_t* elf, hashtable_t** defined, array_t** undefined){
+    for(int k=0; k<elf->symt_count; ++k){
+        st_entry_t* sym = &elf->symt[k];
+        uint64_t value;
+        if(is_defined(sym) || strcmp(sym->st_shndx,"COMMON") == 0){
+            if(hashtable_get(*defined,sym->st_name,&value) == 0){
+                hashtable_insert(defined,sym->st_name,1);
+            }
+        }else if(strcmp(sym->st_shndx,"SHN_UNDEF") == 0){
+            array_insert(undefined,(uint64_t)sym->st_name);
+        }
+    }
+}
+
+/**
+ * @brief extract the members defining the undefined symbols, the members
+ *        extracted may have undefined symbols of their own
+ *
+ * @param ars searched in order for every symbol
+ * @param num_ars
+ * @param srcs the objects to link, reallocated to append the members
+ * @param num_srcs
+ * @return int the number of members extracted
+ */
+int archive_extract(archive_t** ars, int num_ars, elf_t*** srcs, int* num_srcs){
+    hashtable_t* defined = hashtable_construct(8);
+    array_t* undefined = array_construct(64);
+    for(int i=0; i<*num_srcs; ++i){
+        scan_symbols((*srcs)[i],&defined,&undefined);
+    }
+
+    int num_extracted = 0;
+    // the symbols are taken in the order they became undefined
+    for(uint64_t u=0; u<undefined->count; ++u){
+        uint64_t address;
+        array_get(undefined,u,&address);
+        char* name = (char*)address;
+        uint64_t value;
+        if(hashtable_get(defined,name,&value) == 1){
+            continue;
+        }
+        for(int a=0; a<num_ars; ++a){
+            int m = archive_lookup(ars[a],name);
+            if(m < 0 || ars[a]->extracted[m] != NULL){
+                continue;
+            }
+            elf_t* elf = extract_member(ars[a],m);
+            *srcs = realloc(*srcs,(*num_srcs + 1) * sizeof(elf_t*));
+            (*srcs)[*num_srcs] = elf;
+            *num_srcs += 1;
+            num_extracted += 1;
+            scan_symbols(elf,&defined,&undefined);
+            break;
+        }
+    }
+    hashtable_free(defined);
+    array_free(undefined);
+    return num_extracted;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "headers/linker.h"
+#include "headers/common.h"
+
+// the records are written as they are in memory
+_Static_assert(sizeof(reltype_t) == 4,"rel_entry_t layout of the binary object");
+
+static inline uint64_t align8(uint64_t offset){
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+/**
+ * @brief check the magic of the file
+ *
+ * @param filename
+ * @return int 1 if it is a binary object
+ */
+int is_binary_elf(const char* filename){
+    FILE* fp = fopen(filename,"rb");
+    if(fp == NULL){
+        return 0;
+    }
+    char magic[4];
+    int binary = fread(magic,1,4,fp) == 4 && memcmp(magic,ELF_BIN_MAGIC,4) == 0;
+    fclose(fp);
+    return binary;
+}
+
+// the table [offset, offset + count * size) is inside the file
+static int table_in_file(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size){
+    return offset % 8 == 0 && offset <= file_size && count * size <= file_size - offset;
+}
+
+// the name field holds a '\0' terminated string
+static int name_in_field(const char* name, uint64_t size){
+    return memchr(name,'\0',size) != NULL;
+}
+
+static void corrupted(const char* filename){
+    printf("binary object %s is corrupted\n",filename);
+    exit(1);
+}
+
+/**
+ * @brief map the binary object and use its records in place,
+ *        the mapping is private: the linker may update the symbols
+ *
+ * @param filename
+ * @param elf
+ */
+void parse_binary_elf(const char* filename, elf_t* elf){
+    assert(elf != NULL);
+    memset(elf,0,sizeof(elf_t));
+
+    int fd = open(filename,O_RDONLY);
+    struct stat st;
+    if(fd == -1 || fstat(fd,&st) == -1){
+        debug_printf(DEBUG_LINKER,"unable to open file %s\n",filename);
+        exit(1);
+    }
+    uint64_t file_size = st.st_size;
+    if(file_size < sizeof(elf_bin_header_t)){
+        printf("binary object %s is truncated\n",filename);
+        exit(1);
+    }
+    uint8_t* map = mmap(NULL,file_size,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(map == MAP_FAILED){
+        printf("unable to map file %s\n",filename);
+        exit(1);
+    }
+
+    elf_bin_header_t* h = (elf_bin_header_t*)map;
+    if(memcmp(h->magic,ELF_BIN_MAGIC,4) != 0 || h->version != ELF_BIN_VERSION ||
+        !table_in_file(h->sht_offset,h->sht_count,sizeof(sh_entry_t),file_size) ||
+        !table_in_file(h->symt_offset,h->symt_count,sizeof(st_entry_t),file_size) ||
+        !table_in_file(h->reltext_offset,h->reltext_count,sizeof(rel_entry_t),file_size) ||
+        !table_in_file(h->reldata_offset,h->reldata_count,sizeof(rel_entry_t),file_size) ||
+        !table_in_file(h->line_index_offset,h->line_count,sizeof(uint64_t),file_size) ||
+        h->pool_offset > file_size || h->pool_size > file_size - h->pool_offset ||
+        h->pool_size == 0 || map[h->pool_offset + h->pool_size - 1] != '\0'){
+        corrupted(filename);
+    }
+
+    elf->map = map;
+    elf->map_size = file_size;
+
+    elf->pool = (char*)(map + h->pool_offset);
+    elf->pool_size = h->pool_size;
+    elf->pool_capacity = h->pool_size;
+    elf->line_offset = (uint64_t*)(map + h->line_index_offset);
+    elf->line_count = h->line_count;
+    elf->line_capacity = h->line_count;
+
+    elf->sht_count = h->sht_count;
+    elf->sht = (sh_entry_t*)(map + h->sht_offset);
+    elf->symt_count = h->symt_count;
+    elf->symt = (st_entry_t*)(map + h->symt_offset);
+    elf->reltext_count = h->reltext_count;
+    elf->reltext = (rel_entry_t*)(map + h->reltext_offset);
+    elf->reldata_count = h->reldata_count;
+    elf->reldata = (rel_entry_t*)(map + h->reldata_offset);
+
+    // the records are used as they are: their names and indexes must be
+    // inside them and their tables
+    for(uint32_t i=0; i<elf->line_count; ++i){
+        if(elf->line_offset[i] >= elf->pool_size){
+            corrupted(filename);
+        }
+    }
+    for(uint32_t i=0; i<elf->sht_count; ++i){
+        if(!name_in_field(elf->sht[i].sh_name,sizeof(elf->sht[i].sh_name))){
+            corrupted(filename);
+        }
+    }
+    for(uint32_t i=0; i<elf->symt_count; ++i){
+        if(!name_in_field(elf->symt[i].st_name,sizeof(elf->symt[i].st_name)) ||
+            !name_in_field(elf->symt[i].st_shndx,sizeof(elf->symt[i].st_shndx))){
+            corrupted(filename);
+        }
+    }
+    for(uint32_t i=0; i<elf->reltext_count; ++i){
+        if(elf->reltext[i].sym >= elf->symt_count){
+            corrupted(filename);
+        }
+    }
+    for(uint32_t i=0; i<elf->reldata_count; ++i){
+        if(elf->reldata[i].sym >= elf->symt_count){
+            corrupted(filename);
+        }
+    }
+}
+
+void free_binary_elf(elf_t* elf){
+    munmap(elf->map,elf->map_size);
+    memset(elf,0,sizeof(elf_t));
+}
+
+static void write_table(FILE* fp, uint64_t* offset, const void* table, uint64_t size){
+    uint64_t aligned = align8(*offset);
+    for(; *offset<aligned; ++(*offset)){
+        fputc(0,fp);
+    }
+    if(size > 0 && fwrite(table,1,size,fp) != size){
+        printf("unable to write the binary object\n");
+        exit(1);
+    }
+    *offset += size;
+}
+
+/**
+ * @brief write the parsed object elf as a binary object
+ *
+ * @param filename
+ * @param elf
+ */
+void write_binary_elf(const char* filename, elf_t* elf){
+    FILE* fp = fopen(filename,"wb");
+    if(fp == NULL){
+        debug_printf(DEBUG_LINKER,"unable to open file: %s\n",filename);
+        exit(1);
+    }
+
+    elf_bin_header_t h;
+    memset(&h,0,sizeof(elf_bin_header_t));
+    memcpy(h.magic,ELF_BIN_MAGIC,4);
+    h.version = ELF_BIN_VERSION;
+    h.line_count = elf->line_count;
+    h.sht_count = elf->sht_count;
+    h.symt_count = elf->symt_count;
+    h.reltext_count = elf->reltext_count;
+    h.reldata_count = elf->reldata_count;
+
+    // lay out the tables after the header
+    uint64_t offset = sizeof(elf_bin_header_t);
+    h.sht_offset = align8(offset);
+    offset = h.sht_offset + h.sht_count * sizeof(sh_entry_t);
+    h.symt_offset = align8(offset);
+    offset = h.symt_offset + h.symt_count * sizeof(st_entry_t);
+    h.reltext_offset = align8(offset);
+    offset = h.reltext_offset + h.reltext_count * sizeof(rel_entry_t);
+    h.reldata_offset = align8(offset);
+    offset = h.reldata_offset + h.reldata_count * sizeof(rel_entry_t);
+    h.line_index_offset = align8(offset);
+    offset = h.line_index_offset + h.line_count * sizeof(uint64_t);
+    h.pool_offset = align8(offset);
+    h.pool_size = elf->pool_size;
+
+    // copy the records with their names zero padded: the same object
+    // always converts to the same bytes
+    sh_entry_t* sht = calloc(h.sht_count + 1,sizeof(sh_entry_t));
+    for(uint32_t i=0; i<h.sht_count; ++i){
+        strcpy(sht[i].sh_name,elf->sht[i].sh_name);
+        sht[i].sh_addr = elf->sht[i].sh_addr;
+        sht[i].sh_offset = elf->sht[i].sh_offset;
+        sht[i].sh_size = elf->sht[i].sh_size;
+    }
+    st_entry_t* symt = calloc(h.symt_count + 1,sizeof(st_entry_t));
+    for(uint32_t i=0; i<h.symt_count; ++i){
+        strcpy(symt[i].st_name,elf->symt[i].st_name);
+        symt[i].bind = elf->symt[i].bind;
+        symt[i].type = elf->symt[i].type;
+        strcpy(symt[i].st_shndx,elf->symt[i].st_shndx);
+        symt[i].st_value = elf->symt[i].st_value;
+        symt[i].st_size = elf->symt[i].st_size;
+    }
+
+    offset = 0;
+    write_table(fp,&offset,&h,sizeof(elf_bin_header_t));
+    write_table(fp,&offset,sht,h.sht_count * sizeof(sh_entry_t));
+    write_table(fp,&offset,symt,h.symt_count * sizeof(st_entry_t));
+    write_table(fp,&offset,elf->reltext,h.reltext_count * sizeof(rel_entry_t));
+    write_table(fp,&offset,elf->reldata,h.reldata_count * sizeof(rel_entry_t));
+    write_table(fp,&offset,elf->line_offset,h.line_count * sizeof(uint64_t));
+    write_table(fp,&offset,elf->pool,h.pool_size);
+    assert(offset == h.pool_offset + h.pool_size);
+    fclose(fp);
+    free(sht);
+    free(symt);
+}
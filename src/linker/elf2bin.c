@@ -0,0 +1,21 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headers/common.h"
+#include "headers/linker.h"
+
+// converter: text relocatable object -> binary relocatable object
+int main(int argc,char** argv){
+    if(argc != 3 || strcmp(argv[1],"-h") == 0 || strcmp(argv[1],"--help") == 0){
+        printf("./bin/elf2bin <ELF text file> <ELF binary file>\n");
+        exit(argc == 3 ? 0 : 1);
+    }
+
+    elf_t elf;
+    parse_elf(argv[1],&elf);
+    write_binary_elf(argv[2],&elf);
+    free_elf(&elf);
+
+    finally_cleanup();
+    return 0;
+}
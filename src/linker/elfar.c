@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headers/common.h"
+#include "headers/linker.h"
+
+// archiver: text relocatable objects -> static archive library
+int main(int argc,char** argv){
+    if(argc < 3 || strcmp(argv[1],"-h") == 0 || strcmp(argv[1],"--help") == 0){
+        printf("./bin/elfar <archive file> <ELF text file> ... <ELF text file>\n");
+        exit(argc < 3 ? 1 : 0);
+    }
+
+    write_archive(argv[1],&argv[2],argc - 2);
+
+    finally_cleanup();
+    return 0;
+}
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "headers/linker.h"
+#include "headers/common.h"
+#include "headers/algorithm.h"
+
+/*
+The state of an incremental link is kept next to the EOF file, in
+<EOF file>.state:
+
+    <number of inputs>
+    <input file>,<content hash>,<symbol count>      for every input
+    <placement of symbol 0>,<placement of symbol 1>,...
+
+The placement of a symbol is its index in the .symtab of the EOF, -1 if
+it is not placed: undefined, or a COMMON losing to a definition. The EOF
+itself has the section placement and the address of every symbol.
+
+A relink parses the changed inputs only. If a changed input has the same
+symbols as before, with the same sizes, its lines are copied over its old
+lines in the EOF and its relocations are applied again. The other lines
+and their relocations stay valid since no symbol moved. Otherwise the
+layout does not fit any more and it is a full link.
+
+The EOF has no comments or blank lines, so a line is at the same byte
+offset in the file as in the string pool of its parse. The relocations of
+an input are in the lines of its symbols: only the copied lines change,
+and they are written over their old bytes when they keep their lengths.
+A line of another length shifts the rest of the file, which is then
+written again as a whole. The EOF is still parsed for its symbols and
+the lines the relocations write to.
+*/
+
+typedef struct{
+    char*       filename;
+    uint64_t    hash;
+    int         symt_count;
+    int*        placement;
+}link_input_t;
+
+typedef struct{
+    int             num_inputs;
+    link_input_t*   inputs;
+}link_state_t;
+
+// FNV-1a of the content of the file
+static uint64_t hash_file(const char* filename){
+    FILE* fp = fopen(filename,"rb");
+    if(fp == NULL){
+        printf("unable to open file %s\n",filename);
+        exit(1);
+    }
+    uint64_t hash = 0xcbf29ce484222325;
+    uint8_t buf[65536];
+    size_t n;
+    while((n = fread(buf,1,sizeof(buf),fp)) > 0){
+        for(size_t i=0; i<n; ++i){
+            hash = (hash ^ buf[i]) * 0x100000001b3;
+        }
+    }
+    fclose(fp);
+    return hash;
+}
+
+static void free_state(link_state_t* state){
+    if(state == NULL){
+        return;
+    }
+    for(int i=0; i<state->num_inputs; ++i){
+        free(state->inputs[i].filename);
+        free(state->inputs[i].placement);
+    }
+    free(state->inputs);
+    free(state);
+}
+
+/**
+ * @brief read the state of the last link
+ *
+ * @param filename
+ * @return link_state_t* NULL if there is no state or it is corrupted
+ */
+static link_state_t* read_state(const char* filename){
+    FILE* fp = fopen(filename,"r");
+    if(fp == NULL){
+        return NULL;
+    }
+    link_state_t* state = calloc(1,sizeof(link_state_t));
+    char* line = NULL;
+    size_t line_size = 0;
+    int ok = getline(&line,&line_size,fp) > 0 && sscanf(line,"%d",&state->num_inputs) == 1 &&
+        state->num_inputs > 0;
+    if(ok){
+        state->inputs = calloc(state->num_inputs,sizeof(link_input_t));
+    }
+    for(int i=0; ok && i<state->num_inputs; ++i){
+        link_input_t* in = &state->inputs[i];
+        // <input file>,<content hash>,<symbol count>
+        ok = getline(&line,&line_size,fp) > 0;
+        char* comma = ok ? strrchr(line,',') : NULL;
+        ok = comma != NULL && sscanf(comma + 1,"%d",&in->symt_count) == 1 && in->symt_count >= 0;
+        if(ok){
+            *comma = '\0';
+            comma = strrchr(line,',');
+            ok = comma != NULL && sscanf(comma + 1,"0x%lx",&in->hash) == 1;
+        }
+        if(ok){
+            *comma = '\0';
+            in->filename = strdup(line);
+            in->placement = malloc((in->symt_count + 1) * sizeof(int));
+            ok = getline(&line,&line_size,fp) > 0;
+        }
+        char* p = line;
+        for(int k=0; ok && k<in->symt_count; ++k){
+            char* end;
+            in->placement[k] = strtol(p,&end,10);
+            ok = end != p && (*end == ',' || *end == '\n' || *end == '\0');
+            p = end + (*end == ',');
+        }
+    }
+    free(line);
+    fclose(fp);
+    if(!ok){
+        debug_printf(DEBUG_LINKER,"link state %s is corrupted\n",filename);
+        free_state(state);
+        return NULL;
+    }
+    return state;
+}
+
+static void write_state(const char* filename, link_state_t* state){
+    FILE* fp = fopen(filename,"w");
+    if(fp == NULL){
+        printf("unable to open file: %s\n",filename);
+        exit(1);
+    }
+    fprintf(fp,"%d\n",state->num_inputs);
+    for(int i=0; i<state->num_inputs; ++i){
+        link_input_t* in = &state->inputs[i];
+        fprintf(fp,"%s,0x%016lx,%d\n",in->filename,in->hash,in->symt_count);
+        for(int k=0; k<in->symt_count; ++k){
+            fprintf(fp,k == 0 ? "%d" : ",%d",in->placement[k]);
+        }
+        fprintf(fp,"\n");
+    }
+    fclose(fp);
+}
+
+static sh_entry_t* find_section(elf_t* elf, const char* name){
+    for(int i=0; i<elf->sht_count; ++i){
+        if(strcmp(elf->sht[i].sh_name,name) == 0){
+            return &elf->sht[i];
+        }
+    }
+    return NULL;
+}
+
+static int is_placed_section(const char* name){
+    return strcmp(name,".text") == 0 || strcmp(name,".rodata") == 0 || strcmp(name,".data") == 0;
+}
+
+/**
+ * @brief the changed input elf still fits in the layout of eof if every
+ *        symbol resolves as before: a placed symbol is the same EOF symbol,
+ *        an unplaced one is undefined or COMMON and loses to a definition
+ *
+ * @param elf
+ * @param in the input as it was linked
+ * @param eof
+ * @param eof_defined the names of the global symbols defined in eof
+ * @return int
+ */
+static int layout_fits(elf_t* elf, link_input_t* in, elf_t* eof, hashtable_t* eof_defined){
+    if(elf->symt_count != in->symt_count){
+        return 0;
+    }
+    for(int k=0; k<elf->symt_count; ++k){
+        st_entry_t* sym = &elf->symt[k];
+        int d = in->placement[k];
+        if(d >= (int)eof->symt_count){
+            return 0;
+        }
+        if(d >= 0){
+            st_entry_t* old = &eof->symt[d];
+            if(strcmp(sym->st_name,old->st_name) != 0 || sym->bind != old->bind ||
+                sym->type != old->type || strcmp(sym->st_shndx,old->st_shndx) != 0 ||
+                sym->st_size != old->st_size || !is_placed_section(sym->st_shndx) ||
+                find_section(elf,sym->st_shndx) == NULL){
+                return 0;
+            }
+            continue;
+        }
+        if(strcmp(sym->st_shndx,"SHN_UNDEF") != 0 && strcmp(sym->st_shndx,"COMMON") != 0){
+            return 0;
+        }
+        // the definition it resolves to
+        uint64_t index;
+        if(hashtable_get(eof_defined,sym->st_name,&index) == 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// a line of the EOF copied over, where it is in the file
+typedef struct{
+    uint32_t    index;
+    uint64_t    offset;
+    uint64_t    length;
+}patched_line_t;
+
+typedef struct{
+    patched_line_t* lines;
+    uint64_t        count;
+    uint64_t        capacity;
+    uint64_t        file_size;  // lines below it are still at their file offsets
+}patch_list_t;
+
+// copy the lines of every placed symbol of elf over its lines in eof
+static void patch_lines(elf_t* elf, link_input_t* in, elf_t* eof, patch_list_t* patched){
+    for(int k=0; k<elf->symt_count; ++k){
+        if(in->placement[k] < 0){
+            continue;
+        }
+        st_entry_t* sym = &elf->symt[k];
+        st_entry_t* old = &eof->symt[in->placement[k]];
+        uint64_t src_line = find_section(elf,sym->st_shndx)->sh_offset + sym->st_value;
+        uint64_t dst_line = find_section(eof,old->st_shndx)->sh_offset + old->st_value;
+        for(uint64_t j=0; j<sym->st_size; ++j){
+            uint64_t offset = eof->line_offset[dst_line + j];
+            // a line folded into several symbols is recorded once
+            if(offset < patched->file_size){
+                if(patched->count == patched->capacity){
+                    patched->capacity = patched->capacity == 0 ? 64 : patched->capacity * 2;
+                    patched->lines = realloc(patched->lines,patched->capacity * sizeof(patched_line_t));
+                }
+                patched_line_t* p = &patched->lines[patched->count];
+                p->index = dst_line + j;
+                p->offset = offset;
+                p->length = strlen(elf_line(eof,dst_line + j));
+                patched->count += 1;
+            }
+            elf_replace_line(eof,dst_line + j,elf_line(elf,src_line + j));
+        }
+    }
+}
+
+/**
+ * @brief write the patched lines over their old bytes in the EOF file
+ *
+ * @param eof_filename
+ * @param eof
+ * @param patched
+ * @return int 0 if a line changed its length: nothing is written
+ */
+static int write_patched_lines(const char* eof_filename, elf_t* eof, patch_list_t* patched){
+    for(uint64_t i=0; i<patched->count; ++i){
+        if(strlen(elf_line(eof,patched->lines[i].index)) != patched->lines[i].length){
+            return 0;
+        }
+    }
+    int fd = open(eof_filename,O_WRONLY);
+    if(fd == -1){
+        printf("unable to open file: %s\n",eof_filename);
+        exit(1);
+    }
+    for(uint64_t i=0; i<patched->count; ++i){
+        patched_line_t* p = &patched->lines[i];
+        if(pwrite(fd,elf_line(eof,p->index),p->length,p->offset) != (ssize_t)p->length){
+            printf("unable to write file: %s\n",eof_filename);
+            exit(1);
+        }
+    }
+    close(fd);
+    incremental_stats.lines_patched += patched->count;
+    return 1;
+}
+
+// relink the changed inputs into the EOF, 0 if it needs a full link
+static int relink(link_state_t* state, uint64_t* hash, const char* eof_filename){
+    int num_changed = 0;
+    for(int i=0; i<state->num_inputs; ++i){
+        num_changed += state->inputs[i].hash != hash[i];
+    }
+    if(access(eof_filename,R_OK) != 0){
+        return 0;
+    }
+    if(num_changed == 0){
+        debug_printf(DEBUG_LINKER,"incremental link: %s is up to date\n",eof_filename);
+        return 1;
+    }
+
+    elf_t eof;
+    parse_elf((char*)eof_filename,&eof);
+    // the pool is the file, '\0' in place of '\n', unless it was edited by hand
+    struct stat st;
+    patch_list_t patched;
+    memset(&patched,0,sizeof(patch_list_t));
+    if(stat(eof_filename,&st) == 0 && (uint64_t)st.st_size == eof.pool_size){
+        patched.file_size = eof.pool_size;
+    }
+    hashtable_t* eof_defined = hashtable_construct(8);
+    for(int t=0; t<eof.symt_count; ++t){
+        if(eof.symt[t].bind == STB_GLOBAL && is_placed_section(eof.symt[t].st_shndx)){
+            hashtable_insert(&eof_defined,eof.symt[t].st_name,t);
+        }
+    }
+    elf_t* changed = malloc(num_changed * sizeof(elf_t));
+    elf_t** changed_ptr = malloc(num_changed * sizeof(elf_t*));
+    int** placement = malloc(num_changed * sizeof(int*));
+    int num_parsed = 0;
+    int fits = 1;
+    for(int i=0; fits && i<state->num_inputs; ++i){
+        link_input_t* in = &state->inputs[i];
+        if(in->hash == hash[i]){
+            continue;
+        }
+        parse_elf(in->filename,&changed[num_parsed]);
+        changed_ptr[num_parsed] = &changed[num_parsed];
+        placement[num_parsed] = in->placement;
+        num_parsed += 1;
+        fits = layout_fits(&changed[num_parsed - 1],in,&eof,eof_defined);
+        debug_printf(DEBUG_LINKER,"incremental link: %s changed, %s\n",
+            in->filename,fits ? "patched" : "the layout does not fit");
+    }
+
+    if(fits){
+        for(int i=0, c=0; i<state->num_inputs; ++i){
+            if(state->inputs[i].hash != hash[i]){
+                patch_lines(&changed[c],&state->inputs[i],&eof,&patched);
+                state->inputs[i].hash = hash[i];
+                c += 1;
+            }
+        }
+        relocate_elf(changed_ptr,num_changed,&eof,placement);
+        if(patched.file_size == 0 || write_patched_lines(eof_filename,&eof,&patched) == 0){
+            incremental_stats.rewrites += 1;
+            write_eof(eof_filename,&eof);
+        }
+    }
+
+    for(int i=0; i<num_parsed; ++i){
+        free_elf(&changed[i]);
+    }
+    free(changed);
+    free(changed_ptr);
+    free(placement);
+    free(patched.lines);
+    hashtable_free(eof_defined);
+    free_elf(&eof);
+    return fits;
+}
+
+static void full_link(char** filenames, int num_srcs, uint64_t* hash, const char* eof_filename, const char* state_filename){
+    elf_t* srcs = malloc(num_srcs * sizeof(elf_t));
+    elf_t** srcp = malloc(num_srcs * sizeof(elf_t*));
+    link_state_t state;
+    state.num_inputs = num_srcs;
+    state.inputs = malloc(num_srcs * sizeof(link_input_t));
+    int** placement = malloc(num_srcs * sizeof(int*));
+    for(int i=0; i<num_srcs; ++i){
+        parse_elf(filenames[i],&srcs[i]);
+        srcp[i] = &srcs[i];
+        state.inputs[i].filename = filenames[i];
+        state.inputs[i].hash = hash[i];
+        state.inputs[i].symt_count = srcs[i].symt_count;
+        state.inputs[i].placement = malloc((srcs[i].symt_count + 1) * sizeof(int));
+        placement[i] = state.inputs[i].placement;
+    }
+
+    elf_t dst;
+    link_elf_placement(srcp,num_srcs,&dst,placement);
+    write_eof(eof_filename,&dst);
+    write_state(state_filename,&state);
+
+    for(int i=0; i<num_srcs; ++i){
+        free_elf(&srcs[i]);
+        free(state.inputs[i].placement);
+    }
+    free_elf(&dst);
+    free(srcs);
+    free(srcp);
+    free(state.inputs);
+    free(placement);
+}
+
+/**
+ * @brief link the inputs into the EOF file, relinking only the inputs
+ *        changed since the last link when the layout still fits
+ *
+ * @param filenames
+ * @param num_srcs
+ * @param eof_filename
+ * @return int 1 if the EOF was relinked incrementally, 0 for a full link
+ */
+int link_elf_incremental(char** filenames, int num_srcs, const char* eof_filename){
+    char* state_filename = malloc(strlen(eof_filename) + strlen(".state") + 1);
+    sprintf(state_filename,"%s.state",eof_filename);
+
+    uint64_t* hash = malloc(num_srcs * sizeof(uint64_t));
+    for(int i=0; i<num_srcs; ++i){
+        hash[i] = hash_file(filenames[i]);
+    }
+
+    int incremental = 0;
+    link_state_t* state = read_state(state_filename);
+    if(state != NULL && state->num_inputs == num_srcs){
+        int same_inputs = 1;
+        for(int i=0; i<num_srcs && same_inputs; ++i){
+            same_inputs = strcmp(state->inputs[i].filename,filenames[i]) == 0;
+        }
+        incremental = same_inputs && relink(state,hash,eof_filename);
+    }
+    if(incremental){
+        write_state(state_filename,state);
+    }else{
+        full_link(filenames,num_srcs,hash,eof_filename,state_filename);
+    }
+
+    free_state(state);
+    free(hash);
+    free(state_filename);
+    return incremental;
+}
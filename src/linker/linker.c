@@ -3,16 +3,68 @@
 #include <assert.h>
 #include <string.h>
 #include <dlfcn.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "headers/common.h"
 #include "headers/linker.h"
 
 const char* EXECUTABLE_DIRECTORY = "./files/exe";
 
+// the input files are parsed by a pool of workers taking the next file
+typedef struct{
+    void        (*parse_elf)(const char*,elf_t*);
+    char**      fullpath;
+    elf_t**     srcs;
+    int         count;
+    int         next;   // the next file to parse
+    pthread_mutex_t lock;
+}parse_pool_t;
+
+static void* parse_worker(void* arg){
+    parse_pool_t* pool = (parse_pool_t*)arg;
+    while(1){
+        pthread_mutex_lock(&pool->lock);
+        int i = pool->next;
+        pool->next += 1;
+        pthread_mutex_unlock(&pool->lock);
+
+        if(i >= pool->count){
+            return NULL;
+        }
+        pool->parse_elf(pool->fullpath[i],pool->srcs[i]);
+    }
+}
+
+static void parse_parallel(parse_pool_t* pool, int num_workers){
+    pthread_mutex_init(&pool->lock,NULL);
+    pool->next = 0;
+
+    pthread_t* workers = malloc(num_workers * sizeof(pthread_t));
+    for(int i=0; i<num_workers; ++i){
+        if(pthread_create(&workers[i],NULL,&parse_worker,pool) != 0){
+            printf("unable to create the parse worker\n");
+            exit(1);
+        }
+    }
+    for(int i=0; i<num_workers; ++i){
+        pthread_join(workers[i],NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&pool->lock);
+}
+
 //linker front end
 int main(int argc,char** argv){
-    char* elf_fn[64];
-    char* eof_fn;
+    char** elf_fn = malloc(argc * sizeof(char*));
+    char* eof_fn = NULL;
     int elf_num = 0;
+    int num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int incremental = 0;
+    int gc_sections = 0;
+    int icf = 0;
+    char** needed = malloc(argc * sizeof(char*));
+    int needed_num = 0;
+    uint64_t image_base = 0x00400000;
 
     // parse the arguments
     int eof_flag = 0;
@@ -20,7 +72,36 @@ int main(int argc,char** argv){
         char* str = argv[i];
         if(strcmp(str,"-h") == 0 || strcmp(str,"--help") == 0){
             printf("./bin/link <ELF file> ... <ELF file> -o <EOF file>\n");
+            printf("an ELF file is <name> for <name>.elf.txt, or a complete file name such as <name>.elf.bin\n");
+            printf("an archive made by ./bin/elfar is linked by the members resolving undefined symbols\n");
+            printf("-j <N>: parse and relocate with N threads, the online processors by default\n");
+            printf("-i: relink only the changed ELF files, keeping the state in <EOF file>.state\n");
+            printf("--gc-sections: link only the symbols reachable from main\n");
+            printf("--icf: fold the identical functions into one copy, not with -i\n");
+            printf("-l <EOF file>: import the undefined functions from the shared EOF image, bound on the first call, not with -i\n");
+            printf("--image-base <addr>: the run-time address of .text, 0x00400000 by default\n");
             exit(0);
+        }else if(strcmp(str,"-j") == 0 && i + 1 < argc){
+            num_workers = atoi(argv[++i]);
+            continue;
+        }else if(strcmp(str,"-i") == 0){
+            incremental = 1;
+            continue;
+        }else if(strcmp(str,"--gc-sections") == 0){
+            gc_sections = 1;
+            continue;
+        }else if(strcmp(str,"--icf") == 0){
+            icf = 1;
+            continue;
+        }else if(strcmp(str,"-l") == 0 && i + 1 < argc){
+            char image_fullpath[256];
+            snprintf(image_fullpath,sizeof(image_fullpath),"%s/%s.eof.txt",EXECUTABLE_DIRECTORY,argv[++i]);
+            needed[needed_num] = strdup(image_fullpath);
+            needed_num += 1;
+            continue;
+        }else if(strcmp(str,"--image-base") == 0 && i + 1 < argc){
+            image_base = strtoull(argv[++i],NULL,0);
+            continue;
         }else if(strcmp(argv[i],"-o") == 0){
             eof_flag = 1;
             continue;
@@ -52,33 +133,129 @@ int main(int argc,char** argv){
     write_eof = dlsym(linklib,"write_eof");
     parse_elf = dlsym(linklib,"parse_elf");
     free_elf = dlsym(linklib,"free_elf");
+    void (*link_set_threads)(int) = dlsym(linklib,"link_set_threads");
+    void (*link_set_gc_sections)(int) = dlsym(linklib,"link_set_gc_sections");
+    void (*link_set_icf)(int) = dlsym(linklib,"link_set_icf");
+    void (*link_set_base)(uint64_t) = dlsym(linklib,"link_set_base");
+    void (*link_set_needed)(char**,int) = dlsym(linklib,"link_set_needed");
+    int (*link_elf_incremental)(char**,int,const char*) = dlsym(linklib,"link_elf_incremental");
+    int (*is_archive)(const char*) = dlsym(linklib,"is_archive");
+    archive_t* (*archive_open)(const char*) = dlsym(linklib,"archive_open");
+    void (*archive_close)(archive_t*) = dlsym(linklib,"archive_close");
+    int (*archive_extract)(archive_t**,int,elf_t***,int*) = dlsym(linklib,"archive_extract");
 
     // do front and logic
     printf("we are DYNAMICALLY LINKING ./bin/linker.so to do STATIC linking:\nlinking ");
-    elf_t** srcs = tag_malloc(elf_num * sizeof(elf_t*),"link");
+    parse_pool_t pool;
+    pool.parse_elf = parse_elf;
+    pool.fullpath = malloc(elf_num * sizeof(char*));
+    pool.srcs = malloc(elf_num * sizeof(elf_t*));
+    // the archives are searched after all the objects are parsed
+    char** ar_fullpath = malloc(elf_num * sizeof(char*));
+    int ar_num = 0;
+    int obj_num = 0;
     for(int i=0; i<elf_num; ++i){
-        char elf_fullpath[100];
-        sprintf(elf_fullpath,"%s/%s.elf.txt",EXECUTABLE_DIRECTORY,elf_fn[i]);
+        char elf_fullpath[256];
+        if(strchr(elf_fn[i],'.') != NULL){
+            // the file name is complete: e.g. sum.elf.bin
+            snprintf(elf_fullpath,sizeof(elf_fullpath),"%s/%s",EXECUTABLE_DIRECTORY,elf_fn[i]);
+        }else{
+            snprintf(elf_fullpath,sizeof(elf_fullpath),"%s/%s.elf.txt",EXECUTABLE_DIRECTORY,elf_fn[i]);
+        }
         printf("%s\n",elf_fullpath);
-        
-        srcs[i] = tag_malloc(sizeof(elf_t),"link");
-        parse_elf(elf_fullpath,srcs[i]);
+
+        if(is_archive(elf_fullpath)){
+            ar_fullpath[ar_num] = strdup(elf_fullpath);
+            ar_num += 1;
+            continue;
+        }
+        pool.fullpath[obj_num] = strdup(elf_fullpath);
+        pool.srcs[obj_num] = malloc(sizeof(elf_t));
+        obj_num += 1;
+    }
+    elf_num = obj_num;
+    pool.count = elf_num;
+    if(incremental == 1 && ar_num > 0){
+        printf("-i is ignored with archives\n");
+        incremental = 0;
     }
+    if(incremental == 1 && icf == 1){
+        // a patched function must not overwrite the lines it shares
+        printf("--icf is ignored with -i\n");
+        icf = 0;
+    }
+    if(incremental == 1 && needed_num > 0){
+        // the patched lines do not know the stubs of the imports
+        printf("-l is ignored with -i\n");
+        for(int i=0; i<needed_num; ++i){
+            free(needed[i]);
+        }
+        needed_num = 0;
+    }
+    if(num_workers < 1){
+        num_workers = 1;
+    }
+    link_set_threads(num_workers);
+    link_set_gc_sections(gc_sections);
+    link_set_icf(icf);
+    link_set_base(image_base);
+    link_set_needed(needed,needed_num);
 
-    elf_t linked;
-    link_elf(srcs,elf_num,&linked);
+    char eof_fullparh[256];
+    snprintf(eof_fullparh,sizeof(eof_fullparh),"%s/%s.eof.txt",EXECUTABLE_DIRECTORY,eof_fn);
 
-    char eof_fullparh[100];
-    sprintf(eof_fullparh,"%s/%s.eof.txt",EXECUTABLE_DIRECTORY,eof_fn);
-    printf("into %s\n",eof_fullparh);
+    elf_t** srcs = pool.srcs;
+    if(incremental == 1){
+        // the changed files are parsed by the incremental link
+        int relinked = link_elf_incremental(pool.fullpath,elf_num,eof_fullparh);
+        printf("into %s: %s\n",eof_fullparh,relinked ? "relinked the changed files" : "full link");
+        elf_num = 0;
+    }else{
+        parse_parallel(&pool,num_workers < elf_num ? num_workers : elf_num);
 
-    write_eof(eof_fullparh,&linked);
+        // the members resolving the undefined symbols join the objects
+        int num_srcs = elf_num;
+        elf_t** link_srcs = malloc((elf_num + 1) * sizeof(elf_t*));
+        memcpy(link_srcs,srcs,elf_num * sizeof(elf_t*));
+        archive_t** ars = malloc((ar_num + 1) * sizeof(archive_t*));
+        for(int i=0; i<ar_num; ++i){
+            ars[i] = archive_open(ar_fullpath[i]);
+        }
+        int extracted = archive_extract(ars,ar_num,&link_srcs,&num_srcs);
+        if(ar_num > 0){
+            printf("%d archive members extracted\n",extracted);
+        }
+
+        elf_t linked;
+        link_elf(link_srcs,num_srcs,&linked);
+
+        printf("into %s\n",eof_fullparh);
+        write_eof(eof_fullparh,&linked);
+
+        for(int i=0; i<ar_num; ++i){
+            archive_close(ars[i]);
+            free(ar_fullpath[i]);
+        }
+        free(ars);
+        free(link_srcs);
+    }
 
     // release elf heap
-    for(int i=0; i<elf_num; ++i){
-        free_elf(srcs[i]);
+    for(int i=0; i<pool.count; ++i){
+        if(i < elf_num){
+            free_elf(srcs[i]);
+        }
+        free(srcs[i]);
+        free(pool.fullpath[i]);
     }
     free(srcs);
+    free(pool.fullpath);
+    free(ar_fullpath);
+    free(elf_fn);
+    for(int i=0; i<needed_num; ++i){
+        free(needed[i]);
+    }
+    free(needed);
 
     return 0;
 }
@@ -3,57 +3,62 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "headers/linker.h"
 #include "headers/common.h"
 
 
+#define MAX_TABLE_COLUMNS   (6)
+
+// a column of a table entry: the chars [start, end] of the line
+typedef struct{
+    int     start;
+    int     end;    // start - 1 if the column is empty
+}column_t;
+
 /**
- * @brief parse one line (entey) from char* str
+ * @brief split one line (entey) from char* str into its columns,
+ *        nothing is copied: the columns are ranges of str
  * 
  * @param str 
- * @param ent 
- * @return int 
+ * @param cols MAX_TABLE_COLUMNS columns
+ * @return int the count of columns, those after MAX_TABLE_COLUMNS are not set
  */
-static int parse_table_entry(char* str, char*** ent){
-    // parse line as table entries
-    uint8_t count_col = 1;
-    uint8_t len = strlen(str);
-
-    // count columns
-    for(int i=0;i<len;++i){
-        if(str[i] == ','){
+static int parse_table_entry(const char* str, column_t* cols){
+    int count_col = 0;
+    int start = 0;
+    for(int i=0; ; ++i){
+        if(str[i] == ',' || str[i] == '\0'){
+            assert(i - start < MAX_CHAR_SYMBOL_NAME);
+            if(count_col < MAX_TABLE_COLUMNS){
+                cols[count_col].start = start;
+                cols[count_col].end = i - 1;
+            }
             count_col++;
+            if(str[i] == '\0'){
+                return count_col;
+            }
+            start = i + 1;
         }
     }
+}
 
-    // malloc and create list
-    char** arr = tag_malloc(count_col * sizeof(char*),"parse_table_entry");
-    (*ent) = arr;
-    uint8_t col_index = 0;
-    uint8_t col_width = 0;
-    char col_buf[32];
-    for(int i=0;i<len+1;++i){
-        if(str[i] == ',' || str[i] == '\0'){
-            assert(col_index < count_col);
+// copy the column to buf of size chars, '\0' terminated
+static void copy_column(const char* str, column_t* col, char* buf, int size){
+    int len = col->end - col->start + 1;
+    assert(len < size);
+    memcpy(buf,str + col->start,len);
+    buf[len] = '\0';
+}
 
-            // malloc and copy
-            char* col = tag_malloc((col_width + 1) * sizeof(char),"parse_table_entry");
-            for(int j=0;j<col_width;++j){
-                col[j] = col_buf[j];
-            }
-            col[col_width] = '\0';
-
-            // update
-            (*ent)[col_index] = col;
-            col_index++;
-            col_width = 0;
-        }else{
-            assert(col_width < 32);
-            col_buf[col_width] = str[i];
-            col_width++;
-        }
+static uint64_t column2uint(const char* str, column_t* col){
+    if(col->end < col->start){
+        return string2uint("");
     }
-    return count_col;
+    return string2uint_range(str,col->start,col->end);
 }
 
 /**
@@ -64,14 +69,14 @@ static int parse_table_entry(char* str, char*** ent){
  */
 static void parse_sh(char* str, sh_entry_t* sh){
     // .text,0x0,4,22
-    char** cols;
-    int num_cols = parse_table_entry(str,&cols);
+    column_t cols[MAX_TABLE_COLUMNS];
+    int num_cols = parse_table_entry(str,cols);
     assert(num_cols == 4);
 
-    strcpy(sh->sh_name,cols[0]);
-    sh->sh_addr = string2uint(cols[1]);
-    sh->sh_offset = string2uint(cols[2]);
-    sh->sh_size = string2uint(cols[3]);
+    copy_column(str,&cols[0],sh->sh_name,MAX_CHAR_SECTION_NAME);
+    sh->sh_addr = column2uint(str,&cols[1]);
+    sh->sh_offset = column2uint(str,&cols[2]);
+    sh->sh_size = column2uint(str,&cols[3]);
 }
 
 /**
@@ -91,17 +96,18 @@ static void print_sh_entry(sh_entry_t* sh){
  */
 static void parse_symtab(char* str,st_entry_t* ste){
     // sum,STB_GLOBAL,STT_FUNC,.text,0,22
-    char** cols;
-    int num_cols = parse_table_entry(str,&cols);
+    column_t cols[MAX_TABLE_COLUMNS];
+    int num_cols = parse_table_entry(str,cols);
     assert(num_cols == 6);
     assert(ste != NULL);
 
-    strcpy(ste->st_name,cols[0]);
+    copy_column(str,&cols[0],ste->st_name,MAX_CHAR_SYMBOL_NAME);
 
     // elsect symbol table bind
     uint64_t bind_value;
-
-    if(hashtable_get(link_constant_dict,cols[1],&bind_value) == 0){
+    char key[MAX_CHAR_SYMBOL_NAME];
+    copy_column(str,&cols[1],key,MAX_CHAR_SYMBOL_NAME);
+    if(hashtable_get(link_constant_dict,key,&bind_value) == 0){
         // failed
         printf("symbol bind is neither LOCAL,GLOBAL,nor WEAK\n");
         exit(0);
@@ -110,16 +116,17 @@ static void parse_symtab(char* str,st_entry_t* ste){
 
     // select symbol table type
     uint64_t type_value;
-    if(hashtable_get(link_constant_dict,cols[2],&type_value) == 0){
+    copy_column(str,&cols[2],key,MAX_CHAR_SYMBOL_NAME);
+    if(hashtable_get(link_constant_dict,key,&type_value) == 0){
         // failed
         printf("symbol bind is neiter NOTYPE,OBJECT,nor FUNC\n");
         exit(1);
     }
     ste->type = (st_type_t)type_value;
 
-    strcpy(ste->st_shndx,cols[3]);
-    ste->st_value = string2uint(cols[4]);
-    ste->st_size = string2uint(cols[5]);
+    copy_column(str,&cols[3],ste->st_shndx,MAX_CHAR_SYMBOL_NAME);
+    ste->st_value = column2uint(str,&cols[4]);
+    ste->st_size = column2uint(str,&cols[5]);
 }
 
 /**
@@ -142,25 +149,27 @@ static void print_symtab_entry(st_entry_t* ste){
  */
 static void parse_relocation(char* str, rel_entry_t* rte){
     // 4,7,R_X86_64_PC32,0,-4
-    char** cols;
-    int num_cols = parse_table_entry(str,&cols);
+    column_t cols[MAX_TABLE_COLUMNS];
+    int num_cols = parse_table_entry(str,cols);
     assert(num_cols == 5);
 
     assert(rte != NULL);
-    rte->r_row = string2uint(cols[0]);
-    rte->r_col = string2uint(cols[1]);
+    rte->r_row = column2uint(str,&cols[0]);
+    rte->r_col = column2uint(str,&cols[1]);
 
     // select relocation type
     uint64_t type_value;
-    if(hashtable_get(link_constant_dict,cols[2],&type_value) == 0){
+    char key[MAX_CHAR_SYMBOL_NAME];
+    copy_column(str,&cols[2],key,MAX_CHAR_SYMBOL_NAME);
+    if(hashtable_get(link_constant_dict,key,&type_value) == 0){
         // failed
         printf("relocation type is neiter R_X86_64_32,R_X86_64_PC32,nor R_X86_64_PLT32\n");
         exit(0);
     }
     rte->type = (st_type_t)type_value;
 
-    rte->sym = string2uint(cols[3]);
-    uint64_t bitmap = string2uint(cols[4]);
+    rte->sym = column2uint(str,&cols[3]);
+    uint64_t bitmap = column2uint(str,&cols[4]);
     rte->r_addrend = *(int64_t *)&bitmap;
 }
 
@@ -179,27 +188,100 @@ static void print_relocation_entry(rel_entry_t* rte){
 }
 
 /**
- * @brief 
+ * @brief append one line of len chars to the string pool of elf
  * 
- * @param filename 
- * @param bufaddr 
- * @return int 
+ * @param elf 
+ * @param line 
+ * @param len 
  */
-static int read_elf(const char* filename, uint64_t bufaddr){
-    // open file and read
-    FILE* fp;
-    fp = fopen(filename,"r");
-    if(fp == NULL){
-        debug_printf(DEBUG_LINKER,"unable to open file %s\n",filename);
-        exit(1);
+void elf_append_line(elf_t* elf, const char* line, uint64_t len){
+    if(elf->pool_size + len + 1 > elf->pool_capacity){
+        elf->pool_capacity = elf->pool_capacity == 0 ? 4096 : elf->pool_capacity;
+        while(elf->pool_size + len + 1 > elf->pool_capacity){
+            elf->pool_capacity *= 2;
+        }
+        elf->pool = realloc(elf->pool,elf->pool_capacity);
+    }
+    if(elf->line_count == elf->line_capacity){
+        elf->line_capacity = elf->line_capacity == 0 ? 64 : elf->line_capacity * 2;
+        elf->line_offset = realloc(elf->line_offset,elf->line_capacity * sizeof(uint64_t));
     }
+    elf->line_offset[elf->line_count] = elf->pool_size;
+    memcpy(elf->pool + elf->pool_size,line,len);
+    elf->pool[elf->pool_size + len] = '\0';
+    elf->pool_size += len + 1;
+    elf->line_count++;
+}
+
+/**
+ * @brief replace line index of elf: the new line goes to the end of the pool,
+ *        so the lines are no longer in pool order for elf_append_lines()
+ * 
+ * @param elf 
+ * @param index 
+ * @param line 
+ */
+void elf_replace_line(elf_t* elf, uint32_t index, const char* line){
+    assert(index < elf->line_count && elf->map == NULL);
+    uint32_t line_count = elf->line_count;
+    elf_append_line(elf,line,strlen(line));
+    elf->line_count = line_count;
+    elf->line_offset[index] = elf->line_offset[line_count];
+}
 
-    // read text file line by line
-    char line[MAX_ELF_FILE_WIDTH];
-    uint8_t line_counter = 0;
+/**
+ * @brief append the lines [first, first + count) of src to dst,
+ *        they are contiguous in the pool so one copy does
+ * 
+ * @param dst 
+ * @param src 
+ * @param first 
+ * @param count 
+ */
+void elf_append_lines(elf_t* dst, elf_t* src, uint32_t first, uint32_t count){
+    if(count == 0){
+        return;
+    }
+    assert(first + count <= src->line_count);
+    uint64_t begin = src->line_offset[first];
+    uint64_t end = first + count == src->line_count ? src->pool_size : src->line_offset[first + count];
 
-    while(fgets(line,MAX_ELF_FILE_WIDTH,fp) != NULL){
-        uint8_t len = strlen(line);
+    if(dst->pool_size + (end - begin) > dst->pool_capacity){
+        while(dst->pool_size + (end - begin) > dst->pool_capacity){
+            dst->pool_capacity = dst->pool_capacity == 0 ? 4096 : dst->pool_capacity * 2;
+        }
+        dst->pool = realloc(dst->pool,dst->pool_capacity);
+    }
+    if(dst->line_count + count > dst->line_capacity){
+        while(dst->line_count + count > dst->line_capacity){
+            dst->line_capacity = dst->line_capacity == 0 ? 64 : dst->line_capacity * 2;
+        }
+        dst->line_offset = realloc(dst->line_offset,dst->line_capacity * sizeof(uint64_t));
+    }
+
+    memcpy(dst->pool + dst->pool_size,src->pool + begin,end - begin);
+    for(uint32_t i=0; i<count; ++i){
+        dst->line_offset[dst->line_count + i] = src->line_offset[first + i] - begin + dst->pool_size;
+    }
+    dst->pool_size += end - begin;
+    dst->line_count += count;
+}
+
+/**
+ * @brief read the effective lines of the stream into the string pool of elf
+ * 
+ * @param fp 
+ * @param elf 
+ * @return int 
+ */
+static int read_elf(FILE* fp, elf_t* elf){
+    // read text file line by line, of any length
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t read;
+
+    while((read = getline(&line,&line_size,fp)) != -1){
+        uint64_t len = read;
         if((len == 0) ||
             (len >= 1 && (line[0] == '\n' || line[0] == '\r' || line[0] == '\t')) ||
             (len >= 2 && (line[0] == '/' && line[1] == '/'))
@@ -209,7 +291,7 @@ static int read_elf(const char* filename, uint64_t bufaddr){
 
         // check if is empty or white line
         uint8_t iswhite = 1;
-        for (int i=0;i<len;++i){
+        for (uint64_t i=0;i<len;++i){
             iswhite = iswhite && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r');
         }
         if(iswhite){
@@ -217,37 +299,32 @@ static int read_elf(const char* filename, uint64_t bufaddr){
         }
 
         // to this line, this line is not white and contains information
-        if(line_counter < MAX_ELF_FILE_LENGTH){
-            // store this line to buffer[line_counter]
-            uint64_t addr = bufaddr + line_counter * MAX_ELF_FILE_WIDTH * sizeof(char);
-            char* linebuf = (char*)addr;
-            int i = 0;
-            while(i<len && i<MAX_ELF_FILE_WIDTH){
-                if(line[i] == '\n' || line[i] == '\r' || ((i+1<len) && (i+1<MAX_ELF_FILE_WIDTH) && line[i] == '/' &&line[i+1] == '/')){
-                    break;
-                }
-                linebuf[i] = line[i];
-                i++;
+        // store it up to the line end or the comment
+        uint64_t i = 0;
+        while(i<len){
+            if(line[i] == '\n' || line[i] == '\r' || ((i+1<len) && line[i] == '/' &&line[i+1] == '/')){
+                break;
             }
-            linebuf[i] = '\0';
-            line_counter ++;
-        }else{
-            debug_printf(DEBUG_LINKER,"elf file %s is too long (> %d)\n",filename,MAX_ELF_FILE_WIDTH);
-            fclose(fp);
-            exit(1);
+            i++;
         }
+        elf_append_line(elf,line,i);
     }
-    fclose(fp);
-    assert(string2uint((char*)bufaddr) == line_counter);
-    return line_counter;
+    free(line);
+    assert(elf->line_count > 0 && string2uint(elf_line(elf,0)) == elf->line_count);
+    return elf->line_count;
 }
 
+// the files may be parsed in parallel: one of them builds the dictionary
+static pthread_mutex_t dict_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * @brief 
  * 
  */
 static void init_dictionary(){
+    pthread_mutex_lock(&dict_lock);
     if(link_constant_dict != NULL){
+        pthread_mutex_unlock(&dict_lock);
         return ;
     }
 
@@ -266,6 +343,7 @@ static void init_dictionary(){
     hashtable_insert(&link_constant_dict,"STB_WEAK",STB_WEAK);
 
     print_hashtable(link_constant_dict);
+    pthread_mutex_unlock(&dict_lock);
 }
 
 /**
@@ -276,21 +354,48 @@ static void init_dictionary(){
  */
 void parse_elf(char* filename, elf_t* elf){
     assert(elf != NULL);
-    int line_count = read_elf(filename,(uint64_t)(&(elf->buffer)));
-    for(int i=0;i<line_count;++i){
-        printf("[%d]\t%s\n",i,elf->buffer[i]);
+    if(is_binary_elf(filename)){
+        parse_binary_elf(filename,elf);
+        return;
+    }
+    FILE* fp = fopen(filename,"r");
+    if(fp == NULL){
+        debug_printf(DEBUG_LINKER,"unable to open file %s\n",filename);
+        exit(1);
+    }
+    parse_elf_stream(fp,elf);
+    fclose(fp);
+}
+
+/**
+ * @brief parse the text object read from fp, e.g. a member of an archive
+ * 
+ * @param fp 
+ * @param elf 
+ */
+void parse_elf_stream(FILE* fp, elf_t* elf){
+    assert(elf != NULL);
+    memset(elf,0,sizeof(elf_t));
+    uint32_t line_count = read_elf(fp,elf);
+    if((DEBUG_VERBOSE_SET & DEBUG_LINKER) != 0){
+        // not interleaved with the dumps of the other threads
+        flockfile(stdout);
+        for(uint32_t i=0;i<line_count;++i){
+            printf("[%d]\t%s\n",i,elf_line(elf,i));
+        }
+        funlockfile(stdout);
     }
 
     init_dictionary();
 
     // parse section header
-    elf->sht_count = (uint8_t)string2uint(elf->buffer[1]);
+    elf->sht_count = string2uint(elf_line(elf,1));
     elf->sht = tag_malloc(elf->sht_count * sizeof(sh_entry_t),"parse_elf");
     sh_entry_t* symt_sh = NULL;
     sh_entry_t* rtext_sh = NULL;
     sh_entry_t* rdata_sh = NULL;
     for(int i=0;i<elf->sht_count;++i){
-        parse_sh(elf->buffer[2 + i],&(elf->sht[i]));
+        parse_sh(elf_line(elf,2 + i),&(elf->sht[i]));
         print_sh_entry(&(elf->sht[i]));
         // get symbol table information from section header entry
         if(strcmp(elf->sht[i].sh_name,".symtab") == 0){
@@ -307,7 +412,7 @@ void parse_elf(char* filename, elf_t* elf){
     elf->symt_count = symt_sh->sh_size;
     elf->symt = tag_malloc(elf->symt_count * (sizeof(st_entry_t)),"parse_elf");
     for(int i=0;i<elf->symt_count;++i){
-        parse_symtab(elf->buffer[symt_sh->sh_offset + i],&(elf->symt[i]));
+        parse_symtab(elf_line(elf,symt_sh->sh_offset + i),&(elf->symt[i]));
         print_symtab_entry(&(elf->symt[i]));
     }
 
@@ -316,7 +421,7 @@ void parse_elf(char* filename, elf_t* elf){
         elf->reltext_count = rtext_sh->sh_size;
         elf->reltext = tag_malloc(elf->reltext_count * sizeof(rel_entry_t),"parse_elf");
         for(int i=0; i<elf->reltext_count; ++i){
-            parse_relocation(elf->buffer[rtext_sh->sh_offset + i],&(elf->reltext[i]));
+            parse_relocation(elf_line(elf,rtext_sh->sh_offset + i),&(elf->reltext[i]));
             int st = elf->reltext[i].sym;
             assert(0<=st && st < elf->symt_count);
             print_relocation_entry(&(elf->reltext[i]));
@@ -331,7 +436,7 @@ void parse_elf(char* filename, elf_t* elf){
         elf->reldata_count = rdata_sh->sh_size;
         elf->reldata = tag_malloc(elf->reldata_count * sizeof(rel_entry_t),"parse_elf");
         for(int i=0; i<elf->reldata_count; ++i){
-            parse_relocation(elf->buffer[rdata_sh->sh_offset + i],&(elf->reldata[i]));
+            parse_relocation(elf_line(elf,rdata_sh->sh_offset + i),&(elf->reldata[i]));
             int st = elf->reldata[i].sym;
             assert(0<=st && st < elf->symt_count);
             print_relocation_entry(&(elf->reldata[i]));
@@ -340,32 +445,54 @@ void parse_elf(char* filename, elf_t* elf){
         elf->reldata_count = 0;
         elf->reldata = NULL;
     }
-
-    tag_sweep("parse_table_entry");
 }
 
 /**
- * @brief 
+ * @brief write the lines of eof: the file is sized up front and mapped,
+ *        the lines are copied into it with their '\n'
  * 
  * @param filename 
  * @param eof 
  */
 void write_eof(const char* filename,elf_t* eof){
     // open destation elf file
-    FILE* fp;
-    fp = fopen(filename,"w");
-    if (fp == NULL){
+    int fd = open(filename,O_RDWR | O_CREAT | O_TRUNC,0644);
+    if (fd == -1){
         debug_printf(DEBUG_LINKER,"unable to open file: %s\n",filename);
         exit(1);
     }
 
-    for(int i=0; i< eof->line_count; i++){
-        fprintf(fp,"%s\n",eof->buffer[i]);
+    uint64_t size = 0;
+    for(uint32_t i=0; i< eof->line_count; i++){
+        size += strlen(elf_line(eof,i)) + 1;
     }
-    fclose(fp);
+    if(size > 0){
+        char* image = MAP_FAILED;
+        if(ftruncate(fd,size) == 0){
+            image = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+        }
+        if(image == MAP_FAILED){
+            printf("unable to write file: %s\n",filename);
+            exit(1);
+        }
+        uint64_t offset = 0;
+        for(uint32_t i=0; i< eof->line_count; i++){
+            char* line = elf_line(eof,i);
+            uint64_t len = strlen(line);
+            memcpy(image + offset,line,len);
+            image[offset + len] = '\n';
+            offset += len + 1;
+        }
+        assert(offset == size);
+        munmap(image,size);
+    }
+    close(fd);
 
-    // free hash table
+    // free hash table, the next parse_elf builds it again
+    pthread_mutex_lock(&dict_lock);
     hashtable_free(link_constant_dict);
+    link_constant_dict = NULL;
+    pthread_mutex_unlock(&dict_lock);
 }
 
 /**
@@ -375,9 +502,18 @@ void write_eof(const char* filename,elf_t* eof){
  */
 void free_elf(elf_t* elf){
     assert(elf != NULL);
+    if(elf->map != NULL){
+        // nothing was allocated for a binary object
+        free_binary_elf(elf);
+        return;
+    }
     tag_free(elf->sht);
     tag_free(elf->symt);
     tag_free(elf->reltext);
     tag_free(elf->reldata);
+    free(elf->pool);
+    free(elf->line_offset);
+    elf->pool = NULL;
+    elf->line_offset = NULL;
 //    tag_free(elf);
 }
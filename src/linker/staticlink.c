@@ -2,40 +2,92 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "headers/linker.h"
 #include "headers/common.h"
 #include "headers/algorithm.h"
 #include "headers/instruction.h"
+#include "headers/process.h"
 
 
-#define MAX_SYMBOL_MAP_LENGTH         (64)
 #define MAX_SECTION_BUFFER_LENGTH     (64)
 #define MAX_RELOCATION_LINES          (64)
-
+#define MAX_FORMATTED_LINE            (256)
+// fewer relocations are not worth a thread
+#define MIN_RELOCATIONS_PER_THREAD    (4096)
+// fewer functions to hash are not worth a thread
+#define MIN_FUNCTIONS_PER_THREAD      (256)
+
+/*
+The lazy binding stubs at the end of .text, run by the emulator:
+
+    PLT0:       mov    $SYS_dl_resolve,%rax
+                syscall
+    PLT[n]:     jmp    *GOT[n]
+                mov    $n,%r11
+                jmp    PLT0
+
+GOT[n] in .got.plt points to the second line of PLT[n] until the resolver
+binds it to the function found in the shared images of .dynamic. .dynsym
+holds the name of import n. The absolute addresses of the stubs follow the
+section headers: MAX_INSTRUCTION_CHAR per line, as the emulator fetches.
+*/
+#define PLT_HEADER_LINES              (2)
+#define PLT_ENTRY_LINES               (3)
+
+
+// the functions imported from the shared images, called through the PLT
+typedef struct{
+    char        (*names)[MAX_CHAR_SYMBOL_NAME];
+    int         count;
+    uint64_t    plt_row;    // the row of PLT0 in .text
+}import_table_t;
 
 // internal mapping between source and destination synbol entries
-typedef struct{
+typedef struct SMAP_STRUCT{
     elf_t*        elf;   // source elf file
+    int           elf_index;    // index of elf in srcs
     st_entry_t*   src;   // source symbol
     st_entry_t*   dst;  // dst symbol: used for relocation - find the function
+    struct SMAP_STRUCT* fold;   // the identical function whose lines it shares, or NULL
 }smap_t;
 
 /**************************************/
 /*           Symbol Processing        */
 /**************************************/
-static void simple_resolution(st_entry_t* sym, elf_t* sym_elf, smap_t* candidate);
-static void symbol_processing(elf_t** src,int num_elf,elf_t* dst, smap_t* smap_table, int *smap_count);
+static void simple_resolution(st_entry_t* sym, elf_t* sym_elf, int sym_elf_index, smap_t* candidate);
+static void symbol_processing(elf_t** src,int num_elf,elf_t* dst, smap_t* smap_table, int *smap_count,import_table_t* imports);
+static void import_undefined(elf_t** src,int num_elf,smap_t* smap_table,int* smap_count,import_table_t* imports);
+static int** build_smap_of(elf_t** srcs,int num_srcs,smap_t* smap_table,int smap_count);
+static void free_smap_of(int** smap_of,int num_srcs);
+static void gc_sections(elf_t** srcs,int num_srcs,smap_t* smap_table,int* smap_count);
+static void fold_identical_code(elf_t** srcs,int num_srcs,smap_t* smap_table,int smap_count);
 
 /**************************************/
 /*           Section Merging          */
 /**************************************/
-static void merge_section(elf_t** srcs,int num_srcs,elf_t* dst,smap_t* smap_table,int* smap_count);
-static void compute_section_header(elf_t* dst,smap_t *smap_table,int *smap_count);
+static void merge_section(elf_t** srcs,int num_srcs,elf_t* dst,smap_t* smap_table,int* smap_count,int** smap_of,import_table_t* imports);
+static void write_relocation(char* dst, uint64_t val);
+static void compute_section_header(elf_t* dst,smap_t *smap_table,int *smap_count,import_table_t* imports);
 
 /**************************************/
 /*           Relocation               */
 /**************************************/
-static void relocation_processing(elf_t** srcs,int num_srcs,elf_t* dst,smap_t* smap_table,int* smap_count);
+// a relocation resolved to the line it updates in EOF
+typedef struct{
+    uint64_t        line;   // the line in dst
+    sh_entry_t*     sh;     // the section in EOF
+    int             row;    // the row in the section
+    int             col;
+    int             addend;
+    reltype_t       type;
+    st_entry_t*     sym;    // the referenced EOF symbol, NULL if not resolved
+}eof_rel_t;
+
+static void relocation_processing(elf_t** srcs,int num_srcs,elf_t* dst,int** placement);
+static void resolve_relocations(sh_entry_t* eof_sh,elf_t* elf,rel_entry_t* rels,int rel_count,
+    const char* section,int* placement,elf_t* dst,hashtable_t* dst_globals,eof_rel_t* resolved);
 static void R_X86_64_32_handler(elf_t* dst,sh_entry_t* sh,int row_referencing,int col_referencing,int addend, st_entry_t* sym_referenced);
 static void R_X86_64_PC32_handler(elf_t* dst,sh_entry_t* sh,int row_referencing,int col_referencing,int addend, st_entry_t* sym_referenced);
 typedef void (*rela_handler_t)(elf_t* dst,sh_entry_t* sh,int row_referencing,int col_referencing,int addend, st_entry_t* sym_referenced);
@@ -53,10 +105,60 @@ static const char* get_stb_string(st_bind_t bind);
 static const char* get_stt_string(st_type_t type);
 static inline uint8_t symbol_precefence(st_entry_t* sym);
 
+// a line of dst built without a formatter
+typedef struct{
+    char    buf[MAX_FORMATTED_LINE];
+    int     len;
+}line_builder_t;
+static void put_str(line_builder_t* line,const char* str);
+static void put_int(line_builder_t* line,int64_t value);
+static void put_hex(line_builder_t* line,uint64_t value);
+static void append_int_line(elf_t* dst,int64_t value);
+static void put_section_header(elf_t* dst,sh_entry_t* sh);
+
 
 /* ------------------------------------- */
 /*  Exposed Interface for Static Linking */
 /* ------------------------------------- */
+static int link_threads = 0;
+
+void link_set_threads(int num_threads){
+    link_threads = num_threads;
+}
+
+static int link_gc_sections = 0;
+
+void link_set_gc_sections(int enable){
+    link_gc_sections = enable;
+}
+
+static int link_icf = 0;
+
+void link_set_icf(int enable){
+    link_icf = enable;
+}
+
+static uint64_t link_base = 0x00400000;
+
+void link_set_base(uint64_t base){
+    link_base = base;
+}
+
+static char** link_needed = NULL;
+static int link_num_needed = 0;
+
+void link_set_needed(char** images, int num_images){
+    for(int i=0; i<link_num_needed; ++i){
+        free(link_needed[i]);
+    }
+    free(link_needed);
+    link_needed = malloc((num_images + 1) * sizeof(char*));
+    for(int i=0; i<num_images; ++i){
+        link_needed[i] = strdup(images[i]);
+    }
+    link_num_needed = num_images;
+}
+
 /**
  * @brief Interface for Static Linking
  * 
@@ -65,62 +167,127 @@ static inline uint8_t symbol_precefence(st_entry_t* sym);
  * @param dst 
  */
 void link_elf(elf_t** srcs, int num_srcs, elf_t* dst){
+    link_elf_placement(srcs,num_srcs,dst,NULL);
+}
+
+/**
+ * @brief static linking, telling where the source symbols are placed
+ * 
+ * @param srcs 
+ * @param num_srcs 
+ * @param dst 
+ * @param placement NULL, or placement[i] of srcs[i]->symt_count entries,
+ *        set to the index of the symbol in dst->symt, -1 if it is not placed
+ */
+void link_elf_placement(elf_t** srcs, int num_srcs, elf_t* dst, int** placement){
 
     // reset the destination since it`s a new 
     memset(dst,0,sizeof(elf_t));
     // create the map table to connect the source and destination elf files symbol
+    // every symbol takes one entry at most
     int smap_count = 0;
-    smap_t smap_table[MAX_SYMBOL_MAP_LENGTH];
+    int smap_length = 0;
+    for(int i=0; i<num_srcs; ++i){
+        smap_length += srcs[i]->symt_count;
+    }
+    // calloc: the dst of a symbol is NULL until it is merged
+    smap_t* smap_table = calloc(smap_length + 1,sizeof(smap_t));
+    import_table_t imports = {NULL,0,0};
 
     // update the smap table - symbol proccessing
-    symbol_processing(srcs,num_srcs,dst,(smap_t*)&smap_table,&smap_count);
+    symbol_processing(srcs,num_srcs,dst,smap_table,&smap_count,&imports);
 
-    printf("link_elf--------------------------link_elf\n");
-    for (int i = 0; i < smap_count; ++ i){
-        st_entry_t *ste = smap_table[i].src;
-        debug_printf(DEBUG_LINKER, "%s\t%d\t%d\t%s\t%d\t%d\n",
-            ste->st_name,
-            ste->bind,
-            ste->type,
-            ste->st_shndx,
-            ste->st_value,
-            ste->st_size);
+    // drop the symbols not reachable from main
+    if(link_gc_sections != 0){
+        gc_sections(srcs,num_srcs,smap_table,&smap_count);
+    }
+    // the identical functions share one copy of their lines
+    if(link_icf != 0){
+        fold_identical_code(srcs,num_srcs,smap_table,smap_count);
+    }
+
+    if((DEBUG_LINKER & DEBUG_VERBOSE_SET) != 0){
+        printf("link_elf--------------------------link_elf\n");
+        for (int i = 0; i < smap_count; ++ i){
+            st_entry_t *ste = smap_table[i].src;
+            debug_printf(DEBUG_LINKER, "%s\t%d\t%d\t%s\t%d\t%d\n",
+                ste->st_name,
+                ste->bind,
+                ste->type,
+                ste->st_shndx,
+                ste->st_value,
+                ste->st_size);
+        }
     }
 
     // compute dst Section Header nad write into buffer
     // UPDATE section header table: compute suntime address of each section
     // UPDATE buffer: EOF file header: file line count,section header table line count,section header table
     // compute running address of each section: .text, .rodata, .data, .symbol
-    // eof starting from 0x00400000
-    compute_section_header(dst,smap_table,&smap_count);
+    // eof starting from link_base, 0x00400000 by default
+    compute_section_header(dst,smap_table,&smap_count,&imports);
 
-    // malloc the dst.symt
-    dst->symt_count = smap_count;
+    // malloc the dst.symt: the stubs of the imports have their symbols
+    dst->symt_count = smap_count + imports.count;
     dst->symt = malloc(dst->symt_count * sizeof(st_entry_t));
 
     // to this point, the EOF file header and section header table is palced
     // merge the left sections and relocate the entrirs in .text and .dsts
 
+    // the smap_table entry of every source symbol
+    int** smap_of = build_smap_of(srcs,num_srcs,smap_table,smap_count);
+
     // merge the symbol content fron ELF src into dst sectopns
-    merge_section(srcs,num_srcs,dst,smap_table,&smap_count);
+    merge_section(srcs,num_srcs,dst,smap_table,&smap_count,smap_of,&imports);
 
-    printf("-----------------------------\n");
-    printf("after merging the sections:\n");
-    for(int i=0; i< dst->line_count; ++i){
-        printf("%s\n",dst->buffer[i]);
+    if((DEBUG_LINKER & DEBUG_VERBOSE_SET) != 0){
+        printf("-----------------------------\n");
+        printf("after merging the sections:\n");
+        for(uint32_t i=0; i< dst->line_count; ++i){
+            printf("%s\n",elf_line(dst,i));
+        }
     }
 
+    // the smap_table entry of a source symbol -> its dst symbol
+    for(int i=0; i<num_srcs; ++i){
+        for(int k=0; k<srcs[i]->symt_count; ++k){
+            int t = smap_of[i][k];
+            smap_of[i][k] = t == -1 || smap_table[t].dst == NULL ? -1 : smap_table[t].dst - dst->symt;
+        }
+    }
+    int** dst_of = smap_of;
+
     // UPDATE buffer: relocate the referencing in buffer
     // relocating: update the relocaation entries from ELF files into EOF buffer
-    relocation_processing(srcs,num_srcs,dst,smap_table,&smap_count);
+    relocation_processing(srcs,num_srcs,dst,dst_of);
 
     // finally: check the EOF file
     if((DEBUG_LINKER & DEBUG_VERBOSE_SET) != 0){
         printf("----\nfinal output EOF:\n");
-        for(int i=0; i< dst->line_count; ++i){
-            printf("%s\n",dst->buffer[i]);
+        for(uint32_t i=0; i< dst->line_count; ++i){
+            printf("%s\n",elf_line(dst,i));
+        }
+    }
+    if(placement != NULL){
+        for(int i=0; i<num_srcs; ++i){
+            memcpy(placement[i],dst_of[i],srcs[i]->symt_count * sizeof(int));
         }
     }
+    free_smap_of(dst_of,num_srcs);
+    free(smap_table);
+    free(imports.names);
+}
+
+/**
+ * @brief relocate the lines of srcs placed in dst, e.g. after patching them
+ * 
+ * @param srcs 
+ * @param num_srcs 
+ * @param dst 
+ * @param placement the index of every source symbol in dst->symt, or -1
+ */
+void relocate_elf(elf_t** srcs, int num_srcs, elf_t* dst, int** placement){
+    relocation_processing(srcs,num_srcs,dst,placement);
 }
 
 
@@ -166,6 +333,67 @@ static const char* get_stt_string(st_type_t type){
     }
 }
 
+static void put_str(line_builder_t* line,const char* str){
+    int len = strlen(str);
+    assert(line->len + len < MAX_FORMATTED_LINE);
+    memcpy(line->buf + line->len,str,len);
+    line->len += len;
+}
+
+// "%ld"
+static void put_int(line_builder_t* line,int64_t value){
+    char digits[24];
+    int n = 0;
+    uint64_t v = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do{
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    }while(v != 0);
+    assert(line->len + n + 1 < MAX_FORMATTED_LINE);
+    if(value < 0){
+        line->buf[line->len++] = '-';
+    }
+    while(n > 0){
+        line->buf[line->len++] = digits[--n];
+    }
+}
+
+// "0x%lx"
+static void put_hex(line_builder_t* line,uint64_t value){
+    char digits[16];
+    int n = 0;
+    do{
+        digits[n++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    }while(value != 0);
+    assert(line->len + n + 2 < MAX_FORMATTED_LINE);
+    line->buf[line->len++] = '0';
+    line->buf[line->len++] = 'x';
+    while(n > 0){
+        line->buf[line->len++] = digits[--n];
+    }
+}
+
+// the line of one integer
+static void append_int_line(elf_t* dst,int64_t value){
+    line_builder_t line = {.len = 0};
+    put_int(&line,value);
+    elf_append_line(dst,line.buf,line.len);
+}
+
+// name,0xaddr,offset,size
+static void put_section_header(elf_t* dst,sh_entry_t* sh){
+    line_builder_t line = {.len = 0};
+    put_str(&line,sh->sh_name);
+    put_str(&line,",");
+    put_hex(&line,sh->sh_addr);
+    put_str(&line,",");
+    put_int(&line,sh->sh_offset);
+    put_str(&line,",");
+    put_int(&line,sh->sh_size);
+    elf_append_line(dst,line.buf,line.len);
+}
+
 /**
  * @brief 
  * 
@@ -211,7 +439,7 @@ static inline uint8_t symbol_precefence(st_entry_t* sym){
  * @param src 
  * @param map 
  */
-static void simple_resolution(st_entry_t* sym, elf_t* sym_elf, smap_t* candidate){
+static void simple_resolution(st_entry_t* sym, elf_t* sym_elf, int sym_elf_index, smap_t* candidate){
     // sym: symbol from current elf file
     // candidate: pointer to the internal map table slot: src -> dst
 
@@ -243,6 +471,7 @@ static void simple_resolution(st_entry_t* sym, elf_t* sym_elf, smap_t* candidate
             // use stronger one as best match
             candidate->src = sym;
             candidate->elf = sym_elf;
+            candidate->elf_index = sym_elf_index;
         }
         return;
     }else if(pre1 == 2){
@@ -255,6 +484,7 @@ static void simple_resolution(st_entry_t* sym, elf_t* sym_elf, smap_t* candidate
         // select sym as best match
         candidate->src = sym;
         candidate->elf = sym_elf;
+        candidate->elf_index = sym_elf_index;
     }
     /* rule 2
             pre1     pre2
@@ -274,7 +504,10 @@ static void simple_resolution(st_entry_t* sym, elf_t* sym_elf, smap_t* candidate
  * @param map 
  * @param smap_count 
  */
-static void symbol_processing(elf_t** src,int num_elf,elf_t* dst, smap_t* smap_table, int *smap_count){
+static void symbol_processing(elf_t** src,int num_elf,elf_t* dst, smap_t* smap_table, int *smap_count,import_table_t* imports){
+    // name of the global symbol -> its index in smap_table
+    // so a name conflict is found in O(1) instead of scanning the whole table
+    hashtable_t* global_index = hashtable_construct(8);
 
     // for every elf files
     for(int i=0;i<num_elf;++i){
@@ -286,33 +519,31 @@ static void symbol_processing(elf_t** src,int num_elf,elf_t* dst, smap_t* smap_t
             if(sym->bind == STB_LOCAL){
                 // insert the static (local) symbol to new elf qith confidence:
                 // compiler would check if the symbol is redeclared in one *.c file
-                assert(*smap_count < MAX_SYMBOL_MAP_LENGTH);
                 // even if local symbol has the same name, just insert into dst
                 smap_table[*smap_count].src = sym;
                 smap_table[*smap_count].elf = elfp;
+                smap_table[*smap_count].elf_index = i;
                 // we have not created dst here
                 (*smap_count)++;
             }else if(sym->bind == STB_GLOBAL){
                 // for this bind: STB_GLOBAL, it's possible to have name conflict
                 // check if this symbol has been cached in the map
-                for(int k=0;k<*smap_count;++k){
-                    // check name conflict
-                    // what if the caches symbol is STB_LOCAL?
-                    st_entry_t* candidate = smap_table[k].src;
-                    if(candidate->bind == STB_GLOBAL && (strcmp(candidate->st_name,sym->st_name) == 0)){
-                        // having name conflict, do simple symbol resolution
-                        // pick one symbol from current sym and cached map[k]
-                        simple_resolution(sym,elfp,&smap_table[k]);
-                        goto NEXT_SYMBOL_PROCESS;
-                    }
+                // the local symbols are not in the index: they never conflict
+                uint64_t k;
+                if(hashtable_get(global_index,sym->st_name,&k) == 1){
+                    // having name conflict, do simple symbol resolution
+                    // pick one symbol from current sym and cached map[k]
+                    simple_resolution(sym,elfp,i,&smap_table[k]);
+                    goto NEXT_SYMBOL_PROCESS;
                 }
 
                 // not fine any name conflict
                 // cache surrent symbol sym to the map since there is no name conflict
-                assert(*smap_count <= MAX_SYMBOL_MAP_LENGTH);
+                hashtable_insert(&global_index,sym->st_name,*smap_count);
                 // update map table
                 smap_table[*smap_count].src = sym;
                 smap_table[*smap_count].elf = elfp;
+                smap_table[*smap_count].elf_index = i;
                 // we have not created dst here
                 (*smap_count)++;
             }else if( sym->bind == STB_WEAK){
@@ -323,6 +554,13 @@ static void symbol_processing(elf_t** src,int num_elf,elf_t* dst, smap_t* smap_t
             ;
         }
     }
+    hashtable_free(global_index);
+
+    // the dynamic link: the functions still undefined are imported from the
+    // shared images, they leave the map table
+    if(link_num_needed > 0){
+        import_undefined(src,num_elf,smap_table,smap_count,imports);
+    }
     
     // all elf files have been processed
     // cleanup: check if there is any undefined symbol in the map table
@@ -347,14 +585,128 @@ static void symbol_processing(elf_t** src,int num_elf,elf_t* dst, smap_t* smap_t
     }
 }
 
+/**
+ * @brief move the undefined symbols of smap_table into the imports,
+ *        only the functions: all their references are calls through the PLT
+ *
+ * @param src
+ * @param num_elf
+ * @param smap_table
+ * @param smap_count
+ * @param imports
+ */
+static void import_undefined(elf_t** src,int num_elf,smap_t* smap_table,int* smap_count,import_table_t* imports){
+    // the undefined names referenced by a call, and by anything else
+    hashtable_t* called = hashtable_construct(8);
+    hashtable_t* not_called = hashtable_construct(8);
+    for(int i=0; i<num_elf; ++i){
+        elf_t* elf = src[i];
+        for(int s=0; s<2; ++s){
+            rel_entry_t* rels = s == 0 ? elf->reltext : elf->reldata;
+            int rel_count = s == 0 ? elf->reltext_count : elf->reldata_count;
+            for(int j=0; j<rel_count; ++j){
+                st_entry_t* ref = &elf->symt[rels[j].sym];
+                if(strcmp(ref->st_shndx,"SHN_UNDEF") != 0){
+                    continue;
+                }
+                hashtable_t** names = s == 0 && rels[j].type == R_X86_64_PLT32 ? &called : &not_called;
+                uint64_t value;
+                if(hashtable_get(*names,ref->st_name,&value) == 0){
+                    hashtable_insert(names,ref->st_name,1);
+                }
+            }
+        }
+    }
+
+    imports->names = malloc((*smap_count + 1) * MAX_CHAR_SYMBOL_NAME);
+    int kept = 0;
+    for(int i=0; i<*smap_count; ++i){
+        st_entry_t* s = smap_table[i].src;
+        if(strcmp(s->st_shndx,"SHN_UNDEF") != 0){
+            smap_table[kept] = smap_table[i];
+            kept += 1;
+            continue;
+        }
+        uint64_t value;
+        if(hashtable_get(called,s->st_name,&value) == 0 || hashtable_get(not_called,s->st_name,&value) == 1){
+            // an object or an address taken can not be bound lazily
+            printf("undefined symbol %s\n",s->st_name);
+            exit(1);
+        }
+        if(strlen(s->st_name) + strlen("@plt") >= MAX_CHAR_SYMBOL_NAME){
+            printf("the name of the import %s is too long\n",s->st_name);
+            exit(1);
+        }
+        strcpy(imports->names[imports->count],s->st_name);
+        imports->count += 1;
+        debug_printf(DEBUG_LINKER,"import '%s'\n",s->st_name);
+    }
+    *smap_count = kept;
+    hashtable_free(called);
+    hashtable_free(not_called);
+}
+
+/**
+ * @brief the smap_table entry of every source symbol: smap_of[elf][symbol],
+ *        -1 if the symbol is not linked
+ * 
+ * @param srcs 
+ * @param num_srcs 
+ * @param smap_table 
+ * @param smap_count 
+ * @return int** 
+ */
+static int** build_smap_of(elf_t** srcs,int num_srcs,smap_t* smap_table,int smap_count){
+    int** smap_of = malloc(num_srcs * sizeof(int*));
+    for(int i=0; i<num_srcs; ++i){
+        smap_of[i] = malloc((srcs[i]->symt_count + 1) * sizeof(int));
+        for(int k=0; k<srcs[i]->symt_count; ++k){
+            smap_of[i][k] = -1;
+        }
+    }
+    for(int t=0; t<smap_count; ++t){
+        smap_t* m = &smap_table[t];
+        smap_of[m->elf_index][m->src - srcs[m->elf_index]->symt] = t;
+    }
+    return smap_of;
+}
+
+static void free_smap_of(int** smap_of,int num_srcs){
+    for(int i=0; i<num_srcs; ++i){
+        free(smap_of[i]);
+    }
+    free(smap_of);
+}
+
+// write the next entry of the section header table
+static void add_section_header(elf_t* dst,int* sh_index,uint64_t* section_offset,
+    const char* name,uint64_t addr,uint64_t size){
+    assert(*sh_index < dst->sht_count);
+    sh_entry_t* sh = &(dst->sht[*sh_index]);
+
+    // write the fields
+    strcpy(sh->sh_name,name);
+    sh->sh_addr = addr;
+    sh->sh_offset = *section_offset;
+    sh->sh_size = size;
+
+    // write to buffer
+    put_section_header(dst,sh);
+
+    // update the index
+    *sh_index += 1;
+    *section_offset += sh->sh_size;
+}
+
 /**
  * @brief 
  * 
  * @param dst 
  * @param smap_table 
  * @param smap_count 
+ * @param imports the stubs of the imports are appended to .text
  */
-static void compute_section_header(elf_t* dst,smap_t *smap_table,int *smap_count){
+static void compute_section_header(elf_t* dst,smap_t *smap_table,int *smap_count,import_table_t* imports){
     // we only have .text, .rodata, .data as symbols in the section
     // .bss is not taking any section memory
 
@@ -363,6 +715,10 @@ static void compute_section_header(elf_t* dst,smap_t *smap_table,int *smap_count
     int count_data = 0;
     for(int i=0;i<*smap_count; ++i){
         st_entry_t *sym = smap_table[i].src;
+        if(smap_table[i].fold != NULL){
+            // its lines are the lines of the function it is folded into
+            continue;
+        }
         if(strcmp(sym->st_shndx,".text") == 0){
             count_text += sym->st_size;
         }else if(strcmp(sym->st_shndx,".rodata") == 0){
@@ -371,233 +727,796 @@ static void compute_section_header(elf_t* dst,smap_t *smap_table,int *smap_count
             count_data += sym->st_size;
         }
     }
-    // count the section: with .symtab
-    dst->sht_count = (count_text != 0) + (count_rodata != 0) + (count_data != 0) + 1;
+    // the PLT follows the functions
+    int count_plt = 0;
+    imports->plt_row = count_text;
+    if(imports->count > 0){
+        count_plt = PLT_HEADER_LINES + imports->count * PLT_ENTRY_LINES;
+        count_text += count_plt;
+    }
+    // count the section: with .symtab, and .got.plt, .dynsym, .dynamic for the imports
+    dst->sht_count = (count_text != 0) + (count_rodata != 0) + (count_data != 0) + 1 +
+        (imports->count > 0) * 3;
     // count the total lines
-    dst->line_count = 1 + 1 + dst->sht_count + count_text + count_rodata + count_data + *smap_count;
+    uint32_t line_count = 1 + 1 + dst->sht_count + count_text + count_rodata + count_data + *smap_count;
+    if(imports->count > 0){
+        // GOT entries, stub symbols, .dynsym
+        line_count += imports->count * 3 + link_num_needed;
+    }
 
     // the target dst: line_count, sht_count, sht, .text, ,rodata, .data, .symtab
     // print to buffer
-    sprintf(dst->buffer[0],"%d",dst->line_count);
-    sprintf(dst->buffer[1],"%d",dst->sht_count);
+    assert(dst->line_count == 0);
+    append_int_line(dst,line_count);
+    append_int_line(dst,dst->sht_count);
 
     // compute the run-time address of the sections: compact in memory
-    u_int64_t text_runtime_addr = 0x00400000;
+    u_int64_t text_runtime_addr = link_base;
 
     // 
     u_int64_t rodata_runtime_addr = text_runtime_addr + count_text * MAX_INSTRUCTION_CHAR * sizeof(char);
     u_int64_t data_runtime_addr = rodata_runtime_addr + count_rodata * sizeof(uint64_t);
+    u_int64_t got_runtime_addr = data_runtime_addr + count_data * sizeof(uint64_t);
     u_int64_t symtab_runtime_addr = 0; // for EOF, .symtab is not loaded into run-time memory but still on disk
 
     // write the section header table
     assert(dst->sht == NULL);
     dst->sht = malloc(dst->sht_count * sizeof(sh_entry_t));
 
-    // write in .data, .rodata, .text order
+    // write in .text, .rodata, .data order
     // the start of the offset
     uint64_t section_offset = 1 + 1 + dst->sht_count;
     int sh_index = 0;
-    sh_entry_t* sh = NULL;
-    // .text
     if(count_text > 0){
-        //get the pointer
-        assert(sh_index < dst->sht_count);
-        sh = &(dst->sht[sh_index]);
+        add_section_header(dst,&sh_index,&section_offset,".text",text_runtime_addr,count_text);
+    }
+    if(count_rodata > 0){
+        add_section_header(dst,&sh_index,&section_offset,".rodata",rodata_runtime_addr,count_rodata);
+    }
+    if(count_data > 0){
+        add_section_header(dst,&sh_index,&section_offset,".data",data_runtime_addr,count_data);
+    }
+    if(imports->count > 0){
+        add_section_header(dst,&sh_index,&section_offset,".got.plt",got_runtime_addr,imports->count);
+    }
+    add_section_header(dst,&sh_index,&section_offset,".symtab",symtab_runtime_addr,*smap_count + imports->count);
+    if(imports->count > 0){
+        // the names of the imports and the shared images, not loaded either
+        add_section_header(dst,&sh_index,&section_offset,".dynsym",0,imports->count);
+        add_section_header(dst,&sh_index,&section_offset,".dynamic",0,link_num_needed);
+    }
+    assert(sh_index == dst->sht_count);
 
-        // write the fields
-        strcpy(sh->sh_name,".text");
-        sh->sh_addr = text_runtime_addr;
-        sh->sh_offset = section_offset;
-        sh->sh_size = count_text;
+    // print and check
+    if((DEBUG_VERBOSE_SET & DEBUG_LINKER) != 0){
+        printf("compute_section_header------------compute_section_header\n");
+        printf("Destination ELF's SHT in Buffer:\n");
+        for(int i=0;i<2 + dst->sht_count;++i){
+            printf("%s\n",elf_line(dst,i));
+        }
+    }
+}
 
-        // write to buffer
-        sprintf(dst->buffer[2 + sh_index],"%s,0x%lx,%ld,%ld",sh->sh_name,sh->sh_addr,sh->sh_offset,sh->sh_size);
+// the symbol of a PLT stub: <name>@plt
+static int is_plt_stub(const char* name){
+    const char* suffix = strstr(name,"@plt");
+    return suffix != NULL && suffix[strlen("@plt")] == '\0';
+}
 
-        // update the index
-        sh_index++;
-        section_offset += sh->sh_size;
+// the run-time address of a row of .text, as the emulator fetches the lines
+static uint64_t plt_address(elf_t* dst,uint64_t row){
+    return dst->sht[0].sh_addr + row * MAX_INSTRUCTION_CHAR;
+}
+
+// append PLT0 and one stub per import to .text, with their symbols
+static void append_plt(elf_t* dst,import_table_t* imports,int* symt_written){
+    sh_entry_t* got = NULL;
+    for(int i=0; i<dst->sht_count; ++i){
+        if(strcmp(dst->sht[i].sh_name,".got.plt") == 0){
+            got = &dst->sht[i];
+        }
     }
-    // .rodata
-    if(count_rodata > 0){
-        // get the pointer
-        assert(sh_index < dst->sht_count);
-        sh = &(dst->sht[sh_index]);
+    assert(strcmp(dst->sht[0].sh_name,".text") == 0 && got != NULL);
+    uint64_t plt0 = plt_address(dst,imports->plt_row);
+
+    line_builder_t line = {.len = 0};
+    put_str(&line,"mov    $");
+    put_hex(&line,SYS_dl_resolve);
+    put_str(&line,",%rax");
+    elf_append_line(dst,line.buf,line.len);
+    elf_append_line(dst,"syscall",strlen("syscall"));
+
+    for(int n=0; n<imports->count; ++n){
+        uint64_t row = imports->plt_row + PLT_HEADER_LINES + n * PLT_ENTRY_LINES;
+
+        line.len = 0;
+        put_str(&line,"jmp    *");
+        put_hex(&line,got->sh_addr + n * sizeof(uint64_t));
+        elf_append_line(dst,line.buf,line.len);
+
+        line.len = 0;
+        put_str(&line,"mov    $");
+        put_hex(&line,n);
+        put_str(&line,",%r11");
+        elf_append_line(dst,line.buf,line.len);
+
+        line.len = 0;
+        put_str(&line,"jmp    ");
+        put_hex(&line,plt0);
+        elf_append_line(dst,line.buf,line.len);
+
+        // the symbol of the stub, the calls to the import are relocated to it
+        assert(*symt_written < dst->symt_count);
+        st_entry_t* stub = &dst->symt[*symt_written];
+        strcpy(stub->st_name,imports->names[n]);
+        strcat(stub->st_name,"@plt");
+        stub->bind = STB_GLOBAL;
+        stub->type = STT_FUNC;
+        strcpy(stub->st_shndx,".text");
+        stub->st_value = row;
+        stub->st_size = PLT_ENTRY_LINES;
+        *symt_written += 1;
+    }
+}
 
-        // write the fields
-        strcpy(sh->sh_name,".rodata");
-        sh->sh_addr = rodata_runtime_addr;
-        sh->sh_offset = section_offset;
-        sh->sh_size = count_rodata;
+// GOT[n] starts at the second line of PLT[n]: the first call resolves it
+static void append_got(elf_t* dst,import_table_t* imports){
+    for(int n=0; n<imports->count; ++n){
+        uint64_t row = imports->plt_row + PLT_HEADER_LINES + n * PLT_ENTRY_LINES + 1;
+        char buf[MAX_FORMATTED_LINE];
+        write_relocation(buf,plt_address(dst,row));
+        elf_append_line(dst,buf,18);
+    }
+}
 
-        // write to buffer
-        sprintf(dst->buffer[2 + sh_index],"%s,0x%lx,%ld,%ld",sh->sh_name,sh->sh_addr,sh->sh_offset,sh->sh_size);
+/**
+ * @brief merge the target section lines from ELF files and update dst symtab
+ * 
+ * @param srcs 
+ * @param num_srcs 
+ * @param dst 
+ * @param smap_table 
+ * @param smap_count 
+ * @param smap_of 
+ * @param imports 
+ */
+static void merge_section(elf_t** srcs,int num_srcs,elf_t* dst,smap_t* smap_table,int* smap_count,int** smap_of,import_table_t* imports){
+    int symt_written = 0;
 
-        // update the index
-        sh_index++;
-        section_offset += sh->sh_size;
+    debug_printf(DEBUG_LINKER,"merge_section, line_written = %d\n",dst->line_count);
+    assert(dst->line_count == 1 + 1 + dst->sht_count);
+
+    // bucket the linked symbols by dst section up front, in the order of
+    // the source ELF files and of their symbol tables
+    // bucket[section] holds the smap_table indexes, src_offset the line offset
+    // of the symbol's section in its source ELF
+    int** bucket = malloc(dst->sht_count * sizeof(int*));
+    int* bucket_count = calloc(dst->sht_count,sizeof(int));
+    for(int s=0; s<dst->sht_count; ++s){
+        bucket[s] = malloc((*smap_count + 1) * sizeof(int));
     }
-    // .data
-    if(count_data > 0){
-        // get the pointer
-        assert(sh_index < dst->sht_count);
-        sh = &(dst->sht[sh_index]);
+    uint64_t* src_offset = malloc((*smap_count + 1) * sizeof(uint64_t));
 
-        // write the fields
-        strcpy(sh->sh_name,".data");
-        sh->sh_addr = data_runtime_addr;
-        sh->sh_offset = section_offset;
-        sh->sh_size = count_data;
+    int* sh_map = malloc(dst->sht_count * sizeof(int));
+    for(int i=0; i<num_srcs; ++i){
+        elf_t* elf = srcs[i];
+        // dst section -> section of this ELF, -1 if it does not have one
+        for(int s=0; s<dst->sht_count; ++s){
+            sh_map[s] = -1;
+            for(int j=0; j<elf->sht_count; ++j){
+                if(strcmp(dst->sht[s].sh_name,elf->sht[j].sh_name) == 0){
+                    sh_map[s] = j;
+                }
+            }
+        }
+        for(int k=0; k<elf->symt_count; ++k){
+            int t = smap_of[i][k];
+            if(t == -1){
+                continue;
+            }
+            st_entry_t* sym = &elf->symt[k];
+            for(int s=0; s<dst->sht_count; ++s){
+                if(sh_map[s] != -1 && strcmp(dst->sht[s].sh_name,sym->st_shndx) == 0){
+                    bucket[s][bucket_count[s]] = t;
+                    bucket_count[s]++;
+                    src_offset[t] = elf->sht[sh_map[s]].sh_offset;
+                    break;
+                }
+            }
+        }
+    }
+    free(sh_map);
+
+    // one pass: every symbol copies its contiguous lines
+    for(int s=0; s<dst->sht_count; ++s){
+        debug_printf(DEBUG_LINKER,"merging section '%s'\n",dst->sht[s].sh_name);
+        int sym_section_offset = 0;
+        for(int b=0; b<bucket_count[s]; ++b){
+            int t = bucket[s][b];
+            st_entry_t* sym = smap_table[t].src;
+            elf_t* elf = srcs[smap_table[t].elf_index];
+            debug_printf(DEBUG_LINKER,"\t\tsymbol '%s'\n",sym->st_name);
+
+            // copy this symbol from srcs[i].buffer into dst.buffer
+            // srcs[i].buffer[sh_offset + st_value,sh_offset + st_value + st_size] inclusive
+            // a folded function is placed when all others are
+            if(smap_table[t].fold == NULL){
+                uint32_t src_index = src_offset[t] + sym->st_value;
+                elf_append_lines(dst,elf,src_index,sym->st_size);
+            }
 
-        // write to buffer
-        sprintf(dst->buffer[2 + sh_index],"%s,0x%lx,%ld,%ld",sh->sh_name,sh->sh_addr,sh->sh_offset,sh->sh_size);
+            // copy the symbol table entry from srcs[i].symt[j] to dst.symt[symt_written]
+            assert(symt_written < dst->symt_count);
+            st_entry_t* dst_sym = &dst->symt[symt_written];
+            strcpy(dst_sym->st_name,sym->st_name);
+            dst_sym->bind = sym->bind;
+            dst_sym->type = sym->type;
+            strcpy(dst_sym->st_shndx,sym->st_shndx);
+            //MUST NOT BE A COMMON, so the section offset MUST NOT BE alignment
+            dst_sym->st_value = sym_section_offset;
+            dst_sym->st_size = sym->st_size;
+
+            // update the smap_table
+            // this will hep the relocation
+            smap_table[t].dst = dst_sym;
+
+            // update the counter
+            symt_written += 1;
+            if(smap_table[t].fold == NULL){
+                sym_section_offset += sym->st_size;
+            }
+        }
+        free(bucket[s]);
 
-        // update the index
-        sh_index++;
-        section_offset += sh->sh_size;
+        if(imports->count > 0 && strcmp(dst->sht[s].sh_name,".text") == 0){
+            append_plt(dst,imports,&symt_written);
+        }else if(strcmp(dst->sht[s].sh_name,".got.plt") == 0){
+            append_got(dst,imports);
+        }
+    }
+    free(bucket);
+    free(bucket_count);
+    free(src_offset);
+
+    // the folded functions are aliases of the lines they are identical to
+    for(int t=0; t<*smap_count; ++t){
+        if(smap_table[t].fold != NULL){
+            smap_table[t].dst->st_value = smap_table[t].fold->dst->st_value;
+        }
     }
 
-    // .symtab
-    assert(sh_index < dst->sht_count);
-    sh = &(dst->sht[sh_index]);
+    // finally, merge .symtab
+    for(int i=0; i < dst->symt_count; ++i){
+        st_entry_t* sym = &dst->symt[i];
+        line_builder_t line = {.len = 0};
+        put_str(&line,sym->st_name);
+        put_str(&line,",");
+        put_str(&line,get_stb_string(sym->bind));
+        put_str(&line,",");
+        put_str(&line,get_stt_string(sym->type));
+        put_str(&line,",");
+        put_str(&line,sym->st_shndx);
+        put_str(&line,",");
+        put_int(&line,sym->st_value);
+        put_str(&line,",");
+        put_int(&line,sym->st_size);
+        elf_append_line(dst,line.buf,line.len);
+    }
 
-    // write the fields
-    strcpy(sh->sh_name,".symtab");
-    sh->sh_addr = symtab_runtime_addr;
-    sh->sh_offset = section_offset;
-    sh->sh_size = *smap_count;
+    // .dynsym and .dynamic: what the resolver of the emulator binds
+    if(imports->count > 0){
+        for(int n=0; n<imports->count; ++n){
+            elf_append_line(dst,imports->names[n],strlen(imports->names[n]));
+        }
+        for(int i=0; i<link_num_needed; ++i){
+            elf_append_line(dst,link_needed[i],strlen(link_needed[i]));
+        }
+    }
+    assert(dst->line_count == string2uint(elf_line(dst,0)));
+}
 
-    sprintf(dst->buffer[2 + sh_index],"%s,0x%lx,%ld,%ld",sh->sh_name,sh->sh_addr,sh->sh_offset,sh->sh_size);
+// symbols of one section of an object, sorted by their start row
+typedef struct{
+    st_entry_t**    syms;
+    int             count;
+}sym_index_t;
+
+static int compare_symbol_start(const void* a, const void* b){
+    uint64_t va = (*(st_entry_t**)a)->st_value;
+    uint64_t vb = (*(st_entry_t**)b)->st_value;
+    return (va > vb) - (va < vb);
+}
 
-    assert(sh_index + 1 == dst->sht_count);
+/**
+ * @brief index the symbols of elf defined in section by their rows
+ * 
+ * @param elf 
+ * @param section 
+ * @param index 
+ */
+static void build_sym_index(elf_t* elf,const char* section,sym_index_t* index){
+    index->syms = malloc((elf->symt_count + 1) * sizeof(st_entry_t*));
+    index->count = 0;
+    for(int k=0; k<elf->symt_count; ++k){
+        if(strcmp(elf->symt[k].st_shndx,section) == 0){
+            index->syms[index->count] = &elf->symt[k];
+            index->count++;
+        }
+    }
+    qsort(index->syms,index->count,sizeof(st_entry_t*),&compare_symbol_start);
+}
 
-    // print and check
-    if((DEBUG_VERBOSE_SET & DEBUG_LINKER) != 0){
-        printf("compute_section_header------------compute_section_header\n");
-        printf("Destination ELF's SHT in Buffer:\n");
-        for(int i=0;i<2 + dst->sht_count;++i){
-            printf("%s\n",dst->buffer[i]);
+/**
+ * @brief binary search the symbol whose lines contain row
+ * 
+ * @param index 
+ * @param row 
+ * @return st_entry_t* NULL if no symbol contains row
+ */
+static st_entry_t* search_sym_index(sym_index_t* index,uint64_t row){
+    // the last symbol starting at or before row
+    int low = 0;
+    int high = index->count - 1;
+    int found = -1;
+    while(low <= high){
+        int mid = low + (high - low) / 2;
+        if(index->syms[mid]->st_value <= row){
+            found = mid;
+            low = mid + 1;
+        }else{
+            high = mid - 1;
         }
     }
+    if(found == -1){
+        return NULL;
+    }
+    st_entry_t* sym = index->syms[found];
+    if(row <= sym->st_value + sym->st_size - 1){
+        return sym;
+    }
+    return NULL;
 }
 
+// a worker of run_workers: the shared context and the worker index
+typedef struct{
+    void*   ctx;
+    int     id;
+}worker_arg_t;
+
+// run the worker on num_workers threads, the caller is worker 0
+static void run_workers(void* ctx,int num_workers,void* (*worker)(void*)){
+    pthread_t* threads = malloc(num_workers * sizeof(pthread_t));
+    worker_arg_t* args = malloc(num_workers * sizeof(worker_arg_t));
+    for(int i=0; i<num_workers; ++i){
+        args[i].ctx = ctx;
+        args[i].id = i;
+    }
+    for(int i=1; i<num_workers; ++i){
+        if(pthread_create(&threads[i],NULL,worker,&args[i]) != 0){
+            printf("unable to create the linker worker\n");
+            exit(1);
+        }
+    }
+    worker(&args[0]);
+    for(int i=1; i<num_workers; ++i){
+        pthread_join(threads[i],NULL);
+    }
+    free(threads);
+    free(args);
+}
+
+// the workers for amount of work, at least min_per_thread each
+static int count_workers(uint64_t amount,uint64_t min_per_thread){
+    int num_workers = link_threads > 0 ? link_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_workers > amount / min_per_thread){
+        num_workers = amount / min_per_thread;
+    }
+    return num_workers < 1 ? 1 : num_workers;
+}
+
+// the relocations between the smap_table entries, grouped by the referencing entry
+typedef struct{
+    uint64_t*       begin;  // the edges of entry t are [begin[t], begin[t + 1])
+    int*            to;     // the referenced entry, -1 if it is not linked
+    rel_entry_t**   rel;
+    uint8_t*        address_taken;  // referenced other than by a call
+}ref_graph_t;
 
 /**
- * @brief merge the target section lines from ELF files and update dst symtab
+ * @brief the relocation edges of the linked symbols: a local symbol
+ *        references its own entry, a global one the entry it resolved to
  * 
  * @param srcs 
  * @param num_srcs 
- * @param dst 
  * @param smap_table 
  * @param smap_count 
+ * @param graph 
  */
-static void merge_section(elf_t** srcs,int num_srcs,elf_t* dst,smap_t* smap_table,int* smap_count){
-    int line_written = 1 + 1 + dst->sht_count;
-    int symt_written = 0;
-    int sym_section_offset = 0;
+static void build_ref_graph(elf_t** srcs,int num_srcs,smap_t* smap_table,int smap_count,ref_graph_t* graph){
+    // name of the global symbol -> its index in smap_table
+    hashtable_t* global_index = hashtable_construct(8);
+    for(int t=0; t<smap_count; ++t){
+        if(smap_table[t].src->bind == STB_GLOBAL){
+            hashtable_insert(&global_index,smap_table[t].src->st_name,t);
+        }
+    }
+    int** smap_of = build_smap_of(srcs,num_srcs,smap_table,smap_count);
 
-    debug_printf(DEBUG_LINKER,"merge_section, line_written = %d\n",line_written);
+    uint64_t total = 0;
+    for(int i=0; i<num_srcs; ++i){
+        total += srcs[i]->reltext_count + srcs[i]->reldata_count;
+    }
+    int* edge_from = malloc((total + 1) * sizeof(int));
+    int* edge_to = malloc((total + 1) * sizeof(int));
+    rel_entry_t** edge_rel = malloc((total + 1) * sizeof(rel_entry_t*));
+    graph->address_taken = calloc(smap_count + 1,sizeof(uint8_t));
+    uint64_t num_edges = 0;
+    for(int i=0; i<num_srcs; ++i){
+        elf_t* elf = srcs[i];
+        for(int s=0; s<2; ++s){
+            const char* section = s == 0 ? ".text" : ".data";
+            rel_entry_t* rels = s == 0 ? elf->reltext : elf->reldata;
+            int rel_count = s == 0 ? elf->reltext_count : elf->reldata_count;
+            if(rel_count == 0){
+                continue;
+            }
+            sym_index_t index;
+            build_sym_index(elf,section,&index);
+            for(int j=0; j<rel_count; ++j){
+                st_entry_t* sym = search_sym_index(&index,rels[j].r_row);
+                if(sym == NULL || smap_of[i][sym - elf->symt] == -1){
+                    continue;
+                }
+                st_entry_t* referenced = &elf->symt[rels[j].sym];
+                int t = smap_of[i][rels[j].sym];
+                if(referenced->bind != STB_LOCAL){
+                    uint64_t k;
+                    t = hashtable_get(global_index,referenced->st_name,&k) == 1 ? (int)k : -1;
+                }
+                if(t != -1 && (s == 1 || rels[j].type != R_X86_64_PLT32)){
+                    graph->address_taken[t] = 1;
+                }
+                edge_from[num_edges] = smap_of[i][sym - elf->symt];
+                edge_to[num_edges] = t;
+                edge_rel[num_edges] = &rels[j];
+                num_edges += 1;
+            }
+            free(index.syms);
+        }
+    }
+    free_smap_of(smap_of,num_srcs);
+    hashtable_free(global_index);
 
-    for(int section_index = 0; section_index < dst->sht_count; ++section_index){
-        // merge by the dst.sht order in symbol unit
+    // counting sort by the referencing entry, keeping the order of the relocations
+    graph->begin = calloc(smap_count + 1,sizeof(uint64_t));
+    for(uint64_t e=0; e<num_edges; ++e){
+        graph->begin[edge_from[e] + 1] += 1;
+    }
+    for(int t=0; t<smap_count; ++t){
+        graph->begin[t + 1] += graph->begin[t];
+    }
+    uint64_t* fill = malloc((smap_count + 1) * sizeof(uint64_t));
+    memcpy(fill,graph->begin,(smap_count + 1) * sizeof(uint64_t));
+    graph->to = malloc((num_edges + 1) * sizeof(int));
+    graph->rel = malloc((num_edges + 1) * sizeof(rel_entry_t*));
+    for(uint64_t e=0; e<num_edges; ++e){
+        uint64_t slot = fill[edge_from[e]]++;
+        graph->to[slot] = edge_to[e];
+        graph->rel[slot] = edge_rel[e];
+    }
+    free(fill);
+    free(edge_rel);
+    free(edge_to);
+    free(edge_from);
+}
 
-        // get the section by section ID
-        sh_entry_t* target_sh = &dst->sht[section_index];
-        sym_section_offset = 0;
-        debug_printf(DEBUG_LINKER,"merging section '%s'\n",target_sh->sh_name);
+static void free_ref_graph(ref_graph_t* graph){
+    free(graph->begin);
+    free(graph->to);
+    free(graph->rel);
+    free(graph->address_taken);
+}
 
-        // merge the section
-        // scan every input ELF file
-        for(int i=0; i<num_srcs; ++i){
-            debug_printf(DEBUG_LINKER,"\tfrom source elf [%d]\n",i);
-            int src_section_index = -1;
-            // scan every section in this elf
-            for(int j=0; j<srcs[i]->sht_count; ++j){
-                // check if this ELF srcs[i] contains the same section as target_sh
-                if(strcmp(target_sh->sh_name,srcs[i]->sht[j].sh_name) == 0){
-                    // we have found the same section name
-                    src_section_index = j;
-                    // break 
-                }
+/**
+ * @brief section garbage collection: keep only the symbols reachable from
+ *        main by the relocation edges, the smap_table is compacted in order
+ * 
+ * @param srcs 
+ * @param num_srcs 
+ * @param smap_table 
+ * @param smap_count 
+ */
+static void gc_sections(elf_t** srcs,int num_srcs,smap_t* smap_table,int* smap_count){
+    int root = -1;
+    for(int t=0; t<*smap_count; ++t){
+        st_entry_t* sym = smap_table[t].src;
+        if(sym->bind == STB_GLOBAL && strcmp(sym->st_name,"main") == 0){
+            root = t;
+        }
+    }
+    if(root == -1){
+        debug_printf(DEBUG_LINKER,"gc sections: no main, every symbol is kept\n");
+        return;
+    }
+    ref_graph_t graph;
+    build_ref_graph(srcs,num_srcs,smap_table,*smap_count,&graph);
+
+    // mark from main
+    uint8_t* reachable = calloc(*smap_count + 1,sizeof(uint8_t));
+    int* worklist = malloc((*smap_count + 1) * sizeof(int));
+    int top = 0;
+    reachable[root] = 1;
+    worklist[top++] = root;
+    while(top > 0){
+        int t = worklist[--top];
+        for(uint64_t e=graph.begin[t]; e<graph.begin[t + 1]; ++e){
+            int u = graph.to[e];
+            if(u != -1 && reachable[u] == 0){
+                reachable[u] = 1;
+                worklist[top++] = u;
             }
+        }
+    }
 
-            // check if we have found this target section from src ELF
-            if(src_section_index == -1){
-                // search for the next ELF
-                // bacause the current ELF src[i] does not contain the target_sh
-                continue;
+    // sweep
+    int kept = 0;
+    for(int t=0; t<*smap_count; ++t){
+        if(reachable[t] != 0){
+            smap_table[kept] = smap_table[t];
+            kept += 1;
+        }else{
+            debug_printf(DEBUG_LINKER,"gc sections: drop '%s'\n",smap_table[t].src->st_name);
+        }
+    }
+    debug_printf(DEBUG_LINKER,"gc sections: %d of %d symbols kept\n",kept,*smap_count);
+    *smap_count = kept;
+
+    free(worklist);
+    free(reachable);
+    free_ref_graph(&graph);
+}
+
+// a function of .text and the hash of its lines and relocations
+typedef struct{
+    int         t;      // its smap_table entry
+    uint64_t    hash;
+}icf_function_t;
+
+typedef struct{
+    elf_t**         srcs;
+    smap_t*         smap_table;
+    ref_graph_t*    graph;
+    icf_function_t* functions;
+    int             count;
+    int             num_workers;
+}icf_context_t;
+
+static uint64_t fnv_update(uint64_t hash,const void* data,uint64_t size){
+    for(uint64_t i=0; i<size; ++i){
+        hash = (hash ^ ((const uint8_t*)data)[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// the first source line of the function of entry t
+static uint64_t function_line(smap_t* m){
+    for(int j=0; j<m->elf->sht_count; ++j){
+        if(strcmp(m->elf->sht[j].sh_name,".text") == 0){
+            return m->elf->sht[j].sh_offset + m->src->st_value;
+        }
+    }
+    assert(0);
+    return 0;
+}
+
+/**
+ * @brief the hash of the lines of the function, and of its relocations
+ *        by their rows in the function and the entries they reference
+ * 
+ * @param ctx 
+ * @param t 
+ * @return uint64_t 
+ */
+static uint64_t hash_function(icf_context_t* ctx,int t){
+    smap_t* m = &ctx->smap_table[t];
+    uint64_t hash = 0xcbf29ce484222325;
+    uint64_t first = function_line(m);
+    for(uint64_t j=0; j<m->src->st_size; ++j){
+        char* line = elf_line(m->elf,first + j);
+        hash = fnv_update(hash,line,strlen(line) + 1);
+    }
+    for(uint64_t e=ctx->graph->begin[t]; e<ctx->graph->begin[t + 1]; ++e){
+        rel_entry_t* r = ctx->graph->rel[e];
+        uint64_t fields[5] = {r->r_row - m->src->st_value,r->r_col,r->type,(uint64_t)r->r_addrend,ctx->graph->to[e]};
+        hash = fnv_update(hash,fields,sizeof(fields));
+    }
+    return hash;
+}
+
+static int same_function(icf_context_t* ctx,int a,int b){
+    smap_t* ma = &ctx->smap_table[a];
+    smap_t* mb = &ctx->smap_table[b];
+    ref_graph_t* g = ctx->graph;
+    if(ma->src->st_size != mb->src->st_size ||
+        g->begin[a + 1] - g->begin[a] != g->begin[b + 1] - g->begin[b]){
+        return 0;
+    }
+    uint64_t first_a = function_line(ma);
+    uint64_t first_b = function_line(mb);
+    for(uint64_t j=0; j<ma->src->st_size; ++j){
+        if(strcmp(elf_line(ma->elf,first_a + j),elf_line(mb->elf,first_b + j)) != 0){
+            return 0;
+        }
+    }
+    for(uint64_t k=0; k<g->begin[a + 1] - g->begin[a]; ++k){
+        rel_entry_t* ra = g->rel[g->begin[a] + k];
+        rel_entry_t* rb = g->rel[g->begin[b] + k];
+        if(ra->r_row - ma->src->st_value != rb->r_row - mb->src->st_value ||
+            ra->r_col != rb->r_col || ra->type != rb->type || ra->r_addrend != rb->r_addrend ||
+            g->to[g->begin[a] + k] != g->to[g->begin[b] + k]){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// worker i hashes the i-th slice of the functions
+static void* hash_worker(void* arg){
+    worker_arg_t* w = (worker_arg_t*)arg;
+    icf_context_t* ctx = w->ctx;
+    int first = (uint64_t)ctx->count * w->id / ctx->num_workers;
+    int last = (uint64_t)ctx->count * (w->id + 1) / ctx->num_workers;
+    for(int i=first; i<last; ++i){
+        ctx->functions[i].hash = hash_function(ctx,ctx->functions[i].t);
+    }
+    return NULL;
+}
+
+static int compare_icf_function(const void* a, const void* b){
+    const icf_function_t* fa = a;
+    const icf_function_t* fb = b;
+    if(fa->hash != fb->hash){
+        return fa->hash < fb->hash ? -1 : 1;
+    }
+    return fa->t - fb->t;
+}
+
+/**
+ * @brief identical code folding: a function of .text with the same lines and
+ *        the same relocations as an earlier one shares its lines, so the
+ *        references to it go to that copy. The functions are hashed in
+ *        parallel. A function whose address is taken keeps its own lines
+ *        so the function pointers stay distinct
+ * 
+ * @param srcs 
+ * @param num_srcs 
+ * @param smap_table 
+ * @param smap_count 
+ */
+static void fold_identical_code(elf_t** srcs,int num_srcs,smap_t* smap_table,int smap_count){
+    ref_graph_t graph;
+    build_ref_graph(srcs,num_srcs,smap_table,smap_count,&graph);
+
+    icf_context_t ctx;
+    ctx.srcs = srcs;
+    ctx.smap_table = smap_table;
+    ctx.graph = &graph;
+    ctx.functions = malloc((smap_count + 1) * sizeof(icf_function_t));
+    ctx.count = 0;
+    for(int t=0; t<smap_count; ++t){
+        st_entry_t* sym = smap_table[t].src;
+        if(sym->type != STT_FUNC || strcmp(sym->st_shndx,".text") != 0 || sym->st_size == 0){
+            continue;
+        }
+        // the relocations to the symbols not linked are not compared
+        int resolved = 1;
+        for(uint64_t e=graph.begin[t]; e<graph.begin[t + 1]; ++e){
+            resolved = resolved && graph.to[e] != -1;
+        }
+        if(resolved){
+            ctx.functions[ctx.count].t = t;
+            ctx.count += 1;
+        }
+    }
+    ctx.num_workers = count_workers(ctx.count,MIN_FUNCTIONS_PER_THREAD);
+    run_workers(&ctx,ctx.num_workers,&hash_worker);
+
+    // in a run of the same hash, fold into the first identical function
+    qsort(ctx.functions,ctx.count,sizeof(icf_function_t),&compare_icf_function);
+    int folded = 0;
+    int* keepers = malloc((ctx.count + 1) * sizeof(int));
+    for(int begin=0, end=0; begin<ctx.count; begin=end){
+        int num_keepers = 0;
+        for(end=begin; end<ctx.count && ctx.functions[end].hash == ctx.functions[begin].hash; ++end){
+            int t = ctx.functions[end].t;
+            int k = 0;
+            while(k < num_keepers && same_function(&ctx,keepers[k],t) == 0){
+                k += 1;
+            }
+            if(k < num_keepers && graph.address_taken[t] == 0){
+                smap_table[t].fold = &smap_table[keepers[k]];
+                folded += 1;
+                debug_printf(DEBUG_LINKER,"icf: fold '%s' into '%s'\n",
+                    smap_table[t].src->st_name,smap_table[keepers[k]].src->st_name);
             }else{
-                // found the section in this ELF srcs[i]
-                // check the symtab
-                for(int j=0; j< srcs[i]->symt_count; ++j){
-                    st_entry_t* sym = &srcs[i]->symt[j];
-                    if(strcmp(target_sh->sh_name,sym->st_shndx) == 0){
-                        for(int k=0; k<*smap_count; ++k){
-                            // scan the cached dst symbols to check
-                            // if this symbol should be merged into this section
-                            if(sym == smap_table[k].src){
-                                // exactly the cached symbol
-                                debug_printf(DEBUG_LINKER,"\t\tsymbol '%s'\n",sym->st_name);
-
-                                // this symbol should be merged into dst's section target_sh
-                                // copy this symbol from srcs[i].buffer into dst.buffer
-                                // srcs[i].buffer[sh_offset + st_value,sh_offset + st_value + st_size] inclusive
-                                for(int t=0; t<sym->st_size; ++t){
-                                    int dst_index = line_written + t;
-                                    int src_index = srcs[i]->sht[src_section_index].sh_offset + sym->st_value + t;
-
-                                    assert(dst_index < MAX_ELF_FILE_LENGTH);
-                                    assert(src_index < MAX_ELF_FILE_LENGTH);
-
-                                    strcpy(dst->buffer[dst_index],srcs[i]->buffer[src_index]);
-                                }
-                                // copy the symbol table entry from srcs[i].symt[j] to dst.symt[symt_written]
-                                assert(symt_written < dst->symt_count);
-                                // copy the entry
-                                strcpy(dst->symt[symt_written].st_name,sym->st_name);
-                                dst->symt[symt_written].bind = sym->bind;
-                                dst->symt[symt_written].type = sym->type;
-                                strcpy(dst->symt[symt_written].st_shndx,sym->st_shndx);
-                                //MUST NOT BE A COMMON, so the section offset MUST NOT BE alignment
-                                dst->symt[symt_written].st_value = sym_section_offset;
-                                dst->symt[symt_written].st_size = sym->st_size;
-
-                                // update the smap_table
-                                // this will hep the relocation
-                                smap_table[k].dst = &dst->symt[symt_written];
-
-                                // update the counter
-                                symt_written += 1;
-                                line_written += sym->st_size;
-                                sym_section_offset += sym->st_size;
-                            }
-                        } // symbol srcs[i].symt[j] has been checked
-                    }
-                } // all symbol in ELF file srcs[i] has been checked
+                keepers[num_keepers] = t;
+                num_keepers += 1;
             }
-        } //dst.sht[section_index] has been merged from src ELFs
-    } // all sections in dst has been merged
+        }
+    }
+    debug_printf(DEBUG_LINKER,"icf: %d of %d functions folded, %d workers\n",folded,ctx.count,ctx.num_workers);
 
-    // finally, merge .symtab
-    for(int i=0; i < dst->symt_count; ++i){
-        st_entry_t* sym = &dst->symt[i];
-        sprintf(dst->buffer[line_written],"%s,%s,%s,%s,%ld,%ld",
-            sym->st_name,get_stb_string(sym->bind),get_stt_string(sym->type),
-            sym->st_shndx,sym->st_value,sym->st_size);
-        line_written ++;
+    free(keepers);
+    free(ctx.functions);
+    free_ref_graph(&graph);
+}
+
+// one list of relocations: .rel.text or .rel.data of one object
+typedef struct{
+    elf_t*          elf;
+    sh_entry_t*     eof_sh;
+    rel_entry_t*    rels;
+    int             rel_count;
+    const char*     section;
+    int*            placement;
+    uint64_t        first;  // the index of its first entry in the resolved array
+}rel_list_t;
+
+// shared by the relocation workers
+typedef struct{
+    elf_t*          dst;
+    hashtable_t*    dst_globals;
+
+    // phase 1: the lists are taken by the workers one by one
+    rel_list_t*     lists;
+    int             list_count;
+    int             next_list;
+    pthread_mutex_t lock;
+    eof_rel_t*      resolved;
+
+    // phase 2: worker i applies the relocations of the lines in partition i
+    eof_rel_t*      sorted;
+    uint64_t*       part_begin;     // num_workers + 1 indexes into sorted
+}reloc_context_t;
+
+static void* resolve_worker(void* arg){
+    reloc_context_t* ctx = ((worker_arg_t*)arg)->ctx;
+    while(1){
+        pthread_mutex_lock(&ctx->lock);
+        int i = ctx->next_list;
+        ctx->next_list += 1;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if(i >= ctx->list_count){
+            return NULL;
+        }
+        rel_list_t* l = &ctx->lists[i];
+        resolve_relocations(l->eof_sh,l->elf,l->rels,l->rel_count,l->section,
+            l->placement,ctx->dst,ctx->dst_globals,&ctx->resolved[l->first]);
+    }
+}
+
+static void* apply_worker(void* arg){
+    worker_arg_t* w = (worker_arg_t*)arg;
+    reloc_context_t* ctx = w->ctx;
+    for(uint64_t i=ctx->part_begin[w->id]; i<ctx->part_begin[w->id + 1]; ++i){
+        eof_rel_t* r = &ctx->sorted[i];
+        (handler_table[(int)r->type])(ctx->dst,r->sh,r->row,r->col,r->addend,r->sym);
     }
-    assert(line_written == dst->line_count);
+    return NULL;
 }
 
 /**
- * @brief 
+ * @brief resolve the relocations of all objects in parallel, then partition
+ *        them by the EOF line they update and apply the partitions in parallel:
+ *        the lines are disjoint so the writes are independent
  * 
  * @param srcs 
  * @param num_srcs 
  * @param dst 
- * @param smap_table 
- * @param smap_count 
+ * @param placement the index of every source symbol in dst->symt, or -1
  */
-static void relocation_processing(elf_t** srcs,int num_srcs,elf_t* dst,smap_t* smap_table,int* smap_count){
+static void relocation_processing(elf_t** srcs,int num_srcs,elf_t* dst,int** placement){
 
     sh_entry_t* eof_text_sh = NULL;
     sh_entry_t* eof_data_sh = NULL;
@@ -609,129 +1528,154 @@ static void relocation_processing(elf_t** srcs,int num_srcs,elf_t* dst,smap_t* s
         }
     }
 
-    // update the relocation entries: r_row, r_col, sym
+    // the name of the global EOF symbol -> the EOF symbol
+    hashtable_t* dst_globals = hashtable_construct(8);
+    for(int t=0; t<dst->symt_count; ++t){
+        if(dst->symt[t].bind == STB_GLOBAL){
+            hashtable_insert(&dst_globals,dst->symt[t].st_name,(uint64_t)&dst->symt[t]);
+        }
+        // the calls to an import go to its stub
+        if(is_plt_stub(dst->symt[t].st_name)){
+            char name[MAX_CHAR_SYMBOL_NAME];
+            strcpy(name,dst->symt[t].st_name);
+            name[strlen(name) - strlen("@plt")] = '\0';
+            hashtable_insert(&dst_globals,name,(uint64_t)&dst->symt[t]);
+        }
+    }
+
+    // the relocation lists and the slots of their entries
+    reloc_context_t ctx;
+    memset(&ctx,0,sizeof(reloc_context_t));
+    ctx.dst = dst;
+    ctx.dst_globals = dst_globals;
+    ctx.lists = malloc(2 * num_srcs * sizeof(rel_list_t));
+    uint64_t total = 0;
     for(int i=0; i<num_srcs; ++i){
         elf_t* elf = srcs[i];
+        rel_list_t text = {elf,eof_text_sh,elf->reltext,elf->reltext_count,".text",placement[i],total};
+        total += elf->reltext_count;
+        rel_list_t data = {elf,eof_data_sh,elf->reldata,elf->reldata_count,".data",placement[i],total};
+        total += elf->reldata_count;
+        if(text.rel_count > 0){
+            ctx.lists[ctx.list_count++] = text;
+        }
+        if(data.rel_count > 0){
+            ctx.lists[ctx.list_count++] = data;
+        }
+    }
+    ctx.resolved = malloc((total + 1) * sizeof(eof_rel_t));
+
+    int num_workers = count_workers(total,MIN_RELOCATIONS_PER_THREAD);
+
+    // phase 1: update the relocation entries: r_row, r_col, sym
+    pthread_mutex_init(&ctx.lock,NULL);
+    run_workers(&ctx,num_workers,&resolve_worker);
+    pthread_mutex_destroy(&ctx.lock);
+
+    // phase 2: bucket the resolved entries by the range of lines,
+    // the ranges split the lines of .text and .data evenly
+    uint64_t first_line = dst->line_count;
+    uint64_t last_line = 0;
+    for(uint64_t i=0; i<total; ++i){
+        if(ctx.resolved[i].sym != NULL){
+            first_line = ctx.resolved[i].line < first_line ? ctx.resolved[i].line : first_line;
+            last_line = ctx.resolved[i].line > last_line ? ctx.resolved[i].line : last_line;
+        }
+    }
+    uint64_t range = first_line > last_line ? 1 : (last_line - first_line) / num_workers + 1;
 
-        // .rel.text
-        for(int j=0; j<elf->reltext_count; ++j){
-            rel_entry_t* r = &elf->reltext[j];
-
-            // search the referencing symbol
-            for(int k=0; k<elf->symt_count; ++k){
-                st_entry_t* sym = &elf->symt[k];
-
-                if(strcmp(sym->st_shndx,".text") == 0){
-                    // must be referenced by a .text symbol
-                    // TODO: check if this symbol is the one referencing
-                    int sym_text_start = sym->st_value;
-                    int sym_text_end = sym->st_value + sym->st_size - 1;
-
-                    if(sym_text_start <= r->r_row && r->r_row <= sym_text_end){
-                        // symt[k] is referencing reltext[j].sym
-                        // search the smap table to find the EOF location
-                        int smap_found = 0;
-                        for(int t=0; t<*smap_count; ++t){
-                            if(smap_table[t].src == sym){
-                                smap_found = 1;
-                                st_entry_t* eof_referencing = smap_table[t].dst;
-
-                                // search the being referenced symbol
-                                for(int u=0; u<*smap_count; ++u){
-                                    // what is the EOF symbol name?
-                                    // how to get the referenced symbol name
-                                    if(strcmp(elf->symt[r->sym].st_name,smap_table[u].dst->st_name) == 0 && 
-                                        smap_table[u].dst->bind == STB_GLOBAL){
-                                        // sill now, the referencing row and referenced row are all found
-                                        // update the location
-                                        st_entry_t* eof_referenced = smap_table[u].dst;
-                                        (handler_table[(int)r->type])(
-                                            dst,eof_text_sh,r->r_row - sym->st_value + eof_referencing->st_value,
-                                            r->r_col,
-                                            r->r_addrend,
-                                            eof_referenced
-                                        );
-                                        goto NEXT_REFERENCE_IN_TEXT;
-                                    }
-                                }
-                            }
-                        }
-                        // referencing must be in smap_table
-                        // because it has definition, is astrong symbol
-                        assert(smap_found == 1);
-                    }
-                }
-            }
-            NEXT_REFERENCE_IN_TEXT:
-            ;
+    ctx.part_begin = calloc(num_workers + 1,sizeof(uint64_t));
+    for(uint64_t i=0; i<total; ++i){
+        if(ctx.resolved[i].sym != NULL){
+            ctx.part_begin[(ctx.resolved[i].line - first_line) / range + 1] += 1;
+        }
+    }
+    for(int p=0; p<num_workers; ++p){
+        ctx.part_begin[p + 1] += ctx.part_begin[p];
+    }
+    uint64_t* fill = malloc((num_workers + 1) * sizeof(uint64_t));
+    memcpy(fill,ctx.part_begin,(num_workers + 1) * sizeof(uint64_t));
+    ctx.sorted = malloc((total + 1) * sizeof(eof_rel_t));
+    for(uint64_t i=0; i<total; ++i){
+        if(ctx.resolved[i].sym != NULL){
+            ctx.sorted[fill[(ctx.resolved[i].line - first_line) / range]++] = ctx.resolved[i];
         }
+    }
+    debug_printf(DEBUG_LINKER,"relocation: %lu entries, %d workers\n",total,num_workers);
 
-        // TODO: .rel.data
-        for(int j=0; j<elf->reldata_count; ++j){
-            rel_entry_t* r = &elf->reldata[j];
-
-            // search the referencing symbol
-            for(int k=0;k<elf->symt_count; ++k){
-                st_entry_t* sym = &elf->symt[k];
-
-                if(strcmp(sym->st_shndx,".data") == 0){
-                    // must be referenced by a .data symbol
-                    // check if this symbol is the one referencing
-                    int sym_data_start = sym->st_value;
-                    int sym_data_end = sym->st_value + sym->st_size - 1;
-
-                    if(sym_data_start <= r->r_row && r->r_row <= sym_data_end){
-                        // symt[k] is referencing reldata[j].sym
-                        // search the smap table to find the EOF location
-                        int smap_found = 0;
-                        for(int t=0; t<*smap_count; ++t){
-                            if(smap_table[t].src == sym){
-                                smap_found = 1;
-                                st_entry_t* eof_referencing = smap_table[t].dst;
-
-                                // search the being referenced symbol
-                                for(int u=0; u<*smap_count; ++u){
-                                    // what is the EOF symbol name?
-                                    // how to gei the referenced symbol name
-                                    if(strcmp(elf->symt[r->sym].st_name,smap_table[u].dst->st_name) == 0 &&
-                                        smap_table[u].dst->bind == STB_GLOBAL){
-                                        // till now, the referencing row and referenced row are all found
-                                        // update the location
-                                        st_entry_t* eof_referenced = smap_table[u].dst;
-
-                                        (handler_table[(int)r->type])(
-                                            dst,eof_data_sh,
-                                            r->r_row - sym->st_value + eof_referencing->st_value,
-                                            r->r_col,
-                                            r->r_addrend,
-                                            eof_referenced
-                                        );
-                                        goto NEXT_REFERENCE_IN_DATA;
-                                    }
-                                }
-                            }
-                        }
-                        // referencing must be in smap_table
-                        // because it has definition, is a strong symbol
-                        assert(smap_found == 1);
-                    }
-                }
-            }
-            NEXT_REFERENCE_IN_DATA:
-            ;
+    run_workers(&ctx,num_workers,&apply_worker);
+
+    free(fill);
+    free(ctx.part_begin);
+    free(ctx.sorted);
+    free(ctx.resolved);
+    free(ctx.lists);
+    hashtable_free(dst_globals);
+}
+
+/**
+ * @brief resolve the entries of .rel.text or .rel.data of one object
+ *        to the EOF lines they update, only reading the shared tables
+ * 
+ * @param eof_sh the section in EOF
+ * @param elf 
+ * @param rels 
+ * @param rel_count 
+ * @param section the section name of the referencing symbols
+ * @param placement the index of every symbol of elf in dst->symt, or -1
+ * @param dst 
+ * @param dst_globals 
+ * @param resolved rel_count entries, sym is NULL if the entry is skipped
+ */
+static void resolve_relocations(sh_entry_t* eof_sh,elf_t* elf,rel_entry_t* rels,int rel_count,
+    const char* section,int* placement,elf_t* dst,hashtable_t* dst_globals,eof_rel_t* resolved){
+    sym_index_t index;
+    build_sym_index(elf,section,&index);
+
+    for(int j=0; j<rel_count; ++j){
+        rel_entry_t* r = &rels[j];
+        resolved[j].sym = NULL;
+
+        // search the referencing symbol
+        st_entry_t* sym = search_sym_index(&index,r->r_row);
+        if(sym == NULL){
+            continue;
+        }
+        // referencing is placed in dst unless it was collected as garbage
+        int t = placement[sym - elf->symt];
+        if(t == -1){
+            assert(link_gc_sections != 0);
+            continue;
+        }
+        st_entry_t* eof_referencing = &dst->symt[t];
+
+        // search the being referenced symbol
+        uint64_t address;
+        if(hashtable_get(dst_globals,elf->symt[r->sym].st_name,&address) == 0){
+            continue;
         }
+        // till now, the referencing row and referenced row are all found
+        resolved[j].row = r->r_row - sym->st_value + eof_referencing->st_value;
+        resolved[j].line = eof_sh->sh_offset + resolved[j].row;
+        resolved[j].sh = eof_sh;
+        resolved[j].col = r->r_col;
+        resolved[j].addend = r->r_addrend;
+        resolved[j].type = r->type;
+        resolved[j].sym = (st_entry_t*)address;
     }
+    free(index.syms);
 }
 
 static uint64_t get_symbol_runtime_address(elf_t* dst,st_entry_t* sym){
     // get the tun_time address of symbol
-    uint64_t base = 0x00400000;
+    uint64_t base = link_base;
 
     uint64_t text_base = base;
     uint64_t rodata_base = base;
     uint64_t data_base = base;
 
-    int inst_size = sizeof(inst_t);
+    // the lines of .text are MAX_INSTRUCTION_CHAR apart, as the loader maps them
+    int inst_size = MAX_INSTRUCTION_CHAR;
     int data_size = sizeof(uint64_t);
 
     // must visit in .text, .rodata, .data order
@@ -755,25 +1699,38 @@ static uint64_t get_symbol_runtime_address(elf_t* dst,st_entry_t* sym){
     return 0xffffffffffffffff;
 }
 
+// "0x%016lx" in place, without the '\0'
 static void write_relocation(char* dst, uint64_t val){
-    char temp[20];
-    sprintf(temp,"0x%016lx",val);
-    for(int i=0; i<18; ++i){
-        dst[i] = temp[i];
+    dst[0] = '0';
+    dst[1] = 'x';
+    for(int i=17; i>=2; --i){
+        dst[i] = "0123456789abcdef"[val & 0xf];
+        val >>= 4;
     }
 }
 
 static void R_X86_64_32_handler(elf_t* dst,sh_entry_t* sh,int row_referencing,int col_referencing,int addend, st_entry_t* sym_referenced){
     uint64_t sym_address = get_symbol_runtime_address(dst,sym_referenced);
-    char* s = &dst->buffer[sh->sh_offset + row_referencing][col_referencing];
+    char* s = elf_line(dst,sh->sh_offset + row_referencing) + col_referencing;
     write_relocation(s,sym_address);
 }
 
+// the branches of the emulator take the absolute target
+static int is_branch(const char* inst){
+    return strncmp(inst,"call",4) == 0 || inst[0] == 'j';
+}
+
 static void R_X86_64_PC32_handler(elf_t* dst,sh_entry_t* sh,int row_referencing,int col_referencing,int addend, st_entry_t* sym_referenced){
     assert(strcmp(sh->sh_name,".text") == 0);
     
     uint64_t sym_address = get_symbol_runtime_address(dst,sym_referenced);
-    uint64_t rip_value = 0x00400000 + (row_referencing + 1) * sizeof(inst_t);
-    char* s = &dst->buffer[sh->sh_offset + row_referencing][col_referencing];
+    char* line = elf_line(dst,sh->sh_offset + row_referencing);
+    char* s = line + col_referencing;
+    if(is_branch(line)){
+        write_relocation(s,sym_address);
+        return;
+    }
+    // %rip is the next line, the addend of the x86 encoding does not apply
+    uint64_t rip_value = sh->sh_addr + (row_referencing + 1) * MAX_INSTRUCTION_CHAR;
     write_relocation(s,sym_address - rip_value);
-}
\ No newline at end of file
+}
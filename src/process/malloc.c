@@ -0,0 +1,447 @@
+// Heap allocator of the guest: segregated free lists over sbrk
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "headers/common.h"
+#include "headers/memory.h"
+#include "headers/process.h"
+
+/*
+Everything lives in the guest heap, starting at the brk_start of the process:
+
+    | cache heads | cache counts | class heads | pad | prologue | blocks ... | epilogue |
+
+A block has a header of (size | previous allocated | allocated) before the
+payload, and a free block a footer of its size as well, so the neighbours
+are found in O(1) for coalescing. The allocated blocks need no footer: the
+next block knows from its own header bit. The payload is 16 byte aligned
+and a block is at least 32 bytes. A free block keeps the next and the
+previous free block of its list in the payload.
+
+The free blocks are in segregated lists by size class: class i holds the
+sizes in [32 << i, 64 << i), the last class the larger ones. malloc takes
+the first fit from the class of the size up.
+
+The small sizes have caches on top: a freed block of an exact small size is
+pushed to the cache of its size, kept allocated and not coalesced, and the
+next malloc of that size pops it in O(1). A cache holds HEAP_CACHE_DEPTH
+blocks at most, the others go to the free lists.
+
+The exposed calls keep heap_stats: the counts, the payload as the usable
+bytes of the allocated blocks, and the host time they take. realloc moving
+its block uses the uncounted allocate and release.
+*/
+#define WSIZE               (8)
+#define DSIZE               (16)
+#define MIN_BLOCK_SIZE      (32)
+#define CHUNK_SIZE          (4096)
+
+#define HEAP_NUM_CACHES     (8)     // sizes 32, 48, ... 144
+#define HEAP_CACHE_DEPTH    (8)
+#define HEAP_NUM_CLASSES    (12)
+
+#define CACHE_HEADS_OFFSET  (0)
+#define CACHE_COUNTS_OFFSET (CACHE_HEADS_OFFSET + HEAP_NUM_CACHES * WSIZE)
+#define CLASS_HEADS_OFFSET  (CACHE_COUNTS_OFFSET + HEAP_NUM_CACHES * WSIZE)
+#define PROLOGUE_OFFSET     (CLASS_HEADS_OFFSET + HEAP_NUM_CLASSES * WSIZE + WSIZE)
+#define HEAP_INIT_SIZE      (PROLOGUE_OFFSET + 3 * WSIZE)
+
+/*======================================*/
+/*      words of the guest memory       */
+/*======================================*/
+
+static inline uint64_t get(uint64_t vaddr){
+    return read64bits_vaddr(vaddr);
+}
+
+static inline void put(uint64_t vaddr, uint64_t value){
+    write64bits_vaddr(vaddr,value);
+}
+
+static inline uint64_t heap_base(){
+    return process_get(process_current())->brk_start;
+}
+
+#define TAG_ALLOCATED       (0x1)
+#define TAG_PREV_ALLOCATED  (0x2)
+#define TAG_SIZE_MASK       (~(uint64_t)0xf)
+
+// bp is the address of the payload
+static inline uint64_t block_size(uint64_t bp){
+    return get(bp - WSIZE) & TAG_SIZE_MASK;
+}
+
+static inline int block_allocated(uint64_t bp){
+    return get(bp - WSIZE) & TAG_ALLOCATED;
+}
+
+static inline int prev_allocated(uint64_t bp){
+    return (get(bp - WSIZE) & TAG_PREV_ALLOCATED) != 0;
+}
+
+// write the tags of bp, keeping its previous allocated bit, and tell the next block
+static void set_tags(uint64_t bp, uint64_t size, int allocated){
+    uint64_t prev_bit = get(bp - WSIZE) & TAG_PREV_ALLOCATED;
+    put(bp - WSIZE,size | prev_bit | allocated);
+    if(allocated == 0){
+        put(bp + size - DSIZE,size);
+    }
+    uint64_t next_header = bp + size - WSIZE;
+    uint64_t tag = get(next_header);
+    put(next_header,allocated ? tag | TAG_PREV_ALLOCATED : tag & ~(uint64_t)TAG_PREV_ALLOCATED);
+}
+
+static inline uint64_t next_block(uint64_t bp){
+    return bp + block_size(bp);
+}
+
+// only if the previous block is free
+static inline uint64_t prev_block(uint64_t bp){
+    return bp - (get(bp - DSIZE) & TAG_SIZE_MASK);
+}
+
+static inline uint64_t adjusted_size(uint64_t size){
+    uint64_t asize = (size + WSIZE + DSIZE - 1) & ~(uint64_t)(DSIZE - 1);
+    return asize < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : asize;
+}
+
+/*======================================*/
+/*      segregated free lists           */
+/*======================================*/
+
+static int size_class(uint64_t size){
+    int c = 0;
+    while(c < HEAP_NUM_CLASSES - 1 && size >= ((uint64_t)MIN_BLOCK_SIZE << (c + 1))){
+        c += 1;
+    }
+    return c;
+}
+
+static inline uint64_t class_head(int c){
+    return heap_base() + CLASS_HEADS_OFFSET + c * WSIZE;
+}
+
+static void list_insert(uint64_t bp){
+    uint64_t head = class_head(size_class(block_size(bp)));
+    uint64_t first = get(head);
+    put(bp,first);
+    put(bp + WSIZE,0);
+    if(first != 0){
+        put(first + WSIZE,bp);
+    }
+    put(head,bp);
+}
+
+static void list_remove(uint64_t bp){
+    uint64_t next = get(bp);
+    uint64_t prev = get(bp + WSIZE);
+    if(prev == 0){
+        put(class_head(size_class(block_size(bp))),next);
+    }else{
+        put(prev,next);
+    }
+    if(next != 0){
+        put(next + WSIZE,prev);
+    }
+}
+
+// merge the free block bp with its free neighbours, insert the result
+static uint64_t coalesce(uint64_t bp){
+    uint64_t size = block_size(bp);
+    uint64_t next = next_block(bp);
+
+    if(block_allocated(next) == 0){
+        list_remove(next);
+        size += block_size(next);
+    }
+    if(prev_allocated(bp) == 0){
+        uint64_t prev = prev_block(bp);
+        list_remove(prev);
+        size += block_size(prev);
+        bp = prev;
+    }
+    set_tags(bp,size,0);
+    list_insert(bp);
+    return bp;
+}
+
+/*======================================*/
+/*      size class caches               */
+/*======================================*/
+
+static inline int cache_index(uint64_t asize){
+    uint64_t index = (asize - MIN_BLOCK_SIZE) / DSIZE;
+    return index < HEAP_NUM_CACHES ? index : -1;
+}
+
+static uint64_t cache_pop(int index){
+    uint64_t head = heap_base() + CACHE_HEADS_OFFSET + index * WSIZE;
+    uint64_t bp = get(head);
+    if(bp != 0){
+        uint64_t count = head - CACHE_HEADS_OFFSET + CACHE_COUNTS_OFFSET;
+        put(head,get(bp));
+        put(count,get(count) - 1);
+    }
+    return bp;
+}
+
+static int cache_push(int index, uint64_t bp){
+    uint64_t head = heap_base() + CACHE_HEADS_OFFSET + index * WSIZE;
+    uint64_t count = head - CACHE_HEADS_OFFSET + CACHE_COUNTS_OFFSET;
+    if(get(count) >= HEAP_CACHE_DEPTH){
+        return 0;
+    }
+    put(bp,get(head));
+    put(head,bp);
+    put(count,get(count) + 1);
+    return 1;
+}
+
+/*======================================*/
+/*      heap                            */
+/*======================================*/
+
+static void lazy_initialize_heap(){
+    uint64_t base = heap_base();
+    if(process_brk(0) != base){
+        return;
+    }
+    if(process_sbrk(HEAP_INIT_SIZE) == 0){
+        printf("malloc: cannot initialize the heap\n");
+        exit(1);
+    }
+    // the pages are demand zero: the heads and the counts are 0 already
+    uint64_t prologue = base + PROLOGUE_OFFSET;
+    put(prologue,DSIZE | TAG_PREV_ALLOCATED | TAG_ALLOCATED);
+    put(prologue + WSIZE,DSIZE | TAG_ALLOCATED);
+    // epilogue
+    put(prologue + DSIZE,TAG_PREV_ALLOCATED | TAG_ALLOCATED);
+}
+
+// grow the heap by size bytes, return the free block at the end
+static uint64_t extend_heap(uint64_t size){
+    uint64_t bp = process_sbrk(size);
+    if(bp == 0){
+        return 0;
+    }
+    heap_stats.extends += 1;
+    // the old epilogue is the header of the new block
+    put(bp + size - WSIZE,TAG_ALLOCATED);
+    set_tags(bp,size,0);
+    return coalesce(bp);
+}
+
+// size of the free block before the epilogue, 0 if it is allocated
+static uint64_t last_free_size(){
+    uint64_t epilogue = process_brk(0);
+    return prev_allocated(epilogue) ? 0 : get(epilogue - DSIZE) & TAG_SIZE_MASK;
+}
+
+// best fit in the first class having a fit, the classes are narrow enough
+static uint64_t find_fit(uint64_t asize){
+    for(int c=size_class(asize); c<HEAP_NUM_CLASSES; ++c){
+        uint64_t best = 0, best_size = 0;
+        for(uint64_t bp=get(class_head(c)); bp!=0; bp=get(bp)){
+            uint64_t size = block_size(bp);
+            if(size >= asize && (best == 0 || size < best_size)){
+                best = bp;
+                best_size = size;
+                if(size == asize){
+                    break;
+                }
+            }
+        }
+        if(best != 0){
+            return best;
+        }
+    }
+    return 0;
+}
+
+// allocate asize bytes at the free block bp, the rest is split off
+static void place(uint64_t bp, uint64_t asize){
+    uint64_t size = block_size(bp);
+    list_remove(bp);
+    if(size - asize >= MIN_BLOCK_SIZE){
+        set_tags(bp,asize,1);
+        uint64_t rest = bp + asize;
+        put(rest - WSIZE,TAG_PREV_ALLOCATED);
+        set_tags(rest,size - asize,0);
+        list_insert(rest);
+    }else{
+        set_tags(bp,size,1);
+    }
+}
+
+// the allocated ptr absorbs the free block after it, up to asize bytes,
+// the rest is split off as in place
+static void absorb_next(uint64_t ptr, uint64_t asize){
+    uint64_t next = next_block(ptr);
+    uint64_t total = block_size(ptr) + block_size(next);
+    list_remove(next);
+    if(total - asize >= MIN_BLOCK_SIZE){
+        set_tags(ptr,asize,1);
+        uint64_t rest = ptr + asize;
+        put(rest - WSIZE,TAG_PREV_ALLOCATED);
+        set_tags(rest,total - asize,0);
+        list_insert(rest);
+    }else{
+        set_tags(ptr,total,1);
+    }
+}
+
+/*======================================*/
+/*          exposed interface           */
+/*======================================*/
+
+static uint64_t host_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_payload(int64_t bytes){
+    heap_stats.payload += bytes;
+    if(heap_stats.payload > heap_stats.peak_payload){
+        heap_stats.peak_payload = heap_stats.payload;
+    }
+}
+
+static uint64_t allocate(uint64_t size){
+    lazy_initialize_heap();
+
+    uint64_t asize = adjusted_size(size);
+    int index = cache_index(asize);
+    if(index >= 0){
+        uint64_t bp = cache_pop(index);
+        if(bp != 0){
+            heap_stats.cache_hits += 1;
+            return bp;
+        }
+    }
+
+    uint64_t bp = find_fit(asize);
+    if(bp == 0){
+        // a free block at the end of the heap is grown by the missing bytes only
+        uint64_t grow = asize - last_free_size();
+        bp = extend_heap(grow > CHUNK_SIZE || last_free_size() > 0 ? grow : CHUNK_SIZE);
+        if(bp == 0){
+            return 0;
+        }
+    }
+    place(bp,asize);
+    return bp;
+}
+
+static void release(uint64_t ptr){
+    assert(block_allocated(ptr) == 1);
+
+    uint64_t size = block_size(ptr);
+    int index = cache_index(size);
+    if(index >= 0 && cache_push(index,ptr) == 1){
+        return;
+    }
+    set_tags(ptr,size,0);
+    coalesce(ptr);
+}
+
+uint64_t heap_malloc(uint64_t size){
+    if(size == 0){
+        return 0;
+    }
+    uint64_t begin = host_ns();
+    heap_stats.mallocs += 1;
+
+    uint64_t bp = allocate(size);
+    if(bp != 0){
+        add_payload(heap_usable_size(bp));
+    }
+    heap_stats.host_ns += host_ns() - begin;
+    return bp;
+}
+
+void heap_free(uint64_t ptr){
+    if(ptr == 0){
+        return;
+    }
+    uint64_t begin = host_ns();
+    heap_stats.frees += 1;
+
+    add_payload(-(int64_t)heap_usable_size(ptr));
+    release(ptr);
+    heap_stats.host_ns += host_ns() - begin;
+}
+
+uint64_t heap_usable_size(uint64_t ptr){
+    return block_size(ptr) - WSIZE;
+}
+
+// grow the allocated ptr to asize bytes where it is, 0 if it cannot
+static uint64_t grow_in_place(uint64_t ptr, uint64_t asize){
+    uint64_t old_size = block_size(ptr);
+    if(asize <= old_size){
+        return ptr;
+    }
+
+    // grow in place into a free next block
+    uint64_t next = next_block(ptr);
+    if(block_allocated(next) == 0 && old_size + block_size(next) >= asize){
+        absorb_next(ptr,asize);
+        return ptr;
+    }
+
+    // the last block grows with the heap: the new free block must be a
+    // block, it is the next one as ptr is allocated
+    if(next == process_brk(0)){
+        uint64_t grow = asize - old_size;
+        if(extend_heap(grow < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : grow) == 0){
+            return 0;
+        }
+        absorb_next(ptr,asize);
+        return ptr;
+    }
+    return 0;
+}
+
+uint64_t heap_realloc(uint64_t ptr, uint64_t size){
+    if(ptr == 0){
+        return heap_malloc(size);
+    }
+    if(size == 0){
+        heap_free(ptr);
+        return 0;
+    }
+    uint64_t begin = host_ns();
+    heap_stats.reallocs += 1;
+
+    uint64_t old_usable = heap_usable_size(ptr);
+    uint64_t bp = grow_in_place(ptr,adjusted_size(size));
+    if(bp == 0){
+        bp = allocate(size);
+        if(bp != 0){
+            // the old payload was rounded to words
+            for(uint64_t i=0; i<old_usable; i+=WSIZE){
+                put(bp + i,get(ptr + i));
+            }
+            release(ptr);
+        }
+    }
+    if(bp != 0){
+        add_payload((int64_t)heap_usable_size(bp) - (int64_t)old_usable);
+    }
+    heap_stats.host_ns += host_ns() - begin;
+    return bp;
+}
+
+double heap_utilization(){
+    uint64_t heap_size = process_brk(0) - heap_base();
+    return heap_size == 0 ? 0.0 : (double)heap_stats.peak_payload / heap_size;
+}
+
+double heap_throughput(){
+    uint64_t ops = heap_stats.mallocs + heap_stats.frees + heap_stats.reallocs;
+    return heap_stats.host_ns == 0 ? 0.0 : ops * 1e9 / heap_stats.host_ns;
+}
@@ -0,0 +1,197 @@
+// Guest processes and system calls
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "headers/common.h"
+#include "headers/cpu.h"
+#include "headers/memory.h"
+#include "headers/algorithm.h"
+#include "headers/process.h"
+
+static array_t* processes = NULL;   // process_t* of pid (index + 1)
+static uint64_t current = 0;
+
+static void process_cleanup(){
+    if(processes == NULL){
+        return;
+    }
+    for(uint32_t i=0; i<processes->count; ++i){
+        uint64_t address;
+        array_get(processes,i,&address);
+        free((process_t*)address);
+    }
+    array_free(processes);
+    processes = NULL;
+    current = 0;
+}
+
+static void save_context(process_t* p){
+    p->reg = cpu_reg;
+    p->flags = cpu_flags;
+    p->pc = cpu_pc;
+    p->cr3 = cpu_controls.cr3;
+}
+
+static void load_context(process_t* p){
+    cpu_reg = p->reg;
+    cpu_flags = p->flags;
+    cpu_pc = p->pc;
+    cpu_controls.cr3 = p->cr3;
+
+    // no address space identifiers: the translations of the old space go
+    softtlb_flush();
+    tlb_flush();
+}
+
+static process_t* process_create(uint64_t ppid){
+    process_t* p = calloc(1,sizeof(process_t));
+    p->pid = processes->count + 1;
+    p->ppid = ppid;
+    p->state = PROCESS_RUNNABLE;
+    p->brk_start = PROCESS_HEAP_START;
+    p->brk = PROCESS_HEAP_START;
+    array_insert(&processes,(uint64_t)p);
+    return p;
+}
+
+static void lazy_initialize_process(){
+    if(processes != NULL){
+        return;
+    }
+    processes = array_construct(8);
+    // the cpu is running pid 1 already
+    current = process_create(0)->pid;
+    add_cleanup_event(&process_cleanup);
+}
+
+uint64_t process_current(){
+    lazy_initialize_process();
+    return current;
+}
+
+process_t* process_get(uint64_t pid){
+    lazy_initialize_process();
+    uint64_t address;
+    if(pid == 0 || array_get(processes,pid - 1,&address) == 0){
+        return NULL;
+    }
+    return (process_t*)address;
+}
+
+/**
+ * @brief context switch to the runnable process pid
+ *
+ * @param pid
+ */
+void process_switch(uint64_t pid){
+    lazy_initialize_process();
+    if(pid == current){
+        return;
+    }
+    process_t* next = process_get(pid);
+    assert(next != NULL && next->state == PROCESS_RUNNABLE);
+
+    save_context(process_get(current));
+    load_context(next);
+    current = pid;
+}
+
+/*======================================*/
+/*            system calls              */
+/*======================================*/
+
+// the child returns 0, the parent gets the pid of the child
+static void sys_fork(){
+    uint64_t child_cr3 = mmu_fork_address_space();
+
+    process_t* parent = process_get(current);
+    process_t* child = process_create(current);
+    save_context(child);
+    child->cr3 = child_cr3;
+    child->brk_start = parent->brk_start;
+    child->brk = parent->brk;
+    child->reg.rax = 0;
+
+    cpu_reg.rax = child->pid;
+    debug_printf(DEBUG_MMU,"fork: pid %lu -> child %lu\n",current,child->pid);
+}
+
+// free the address space and run the parent, or any runnable process
+static void sys_exit(){
+    process_t* p = process_get(current);
+    p->exit_code = cpu_reg.rdi;
+    mmu_free_address_space();
+    p->state = PROCESS_ZOMBIE;
+    debug_printf(DEBUG_MMU,"exit: pid %lu code %lu\n",p->pid,p->exit_code);
+
+    process_t* next = process_get(p->ppid);
+    for(uint32_t i=0; (next == NULL || next->state != PROCESS_RUNNABLE) && i<processes->count; ++i){
+        next = process_get(i + 1);
+    }
+    if(next == NULL || next->state != PROCESS_RUNNABLE){
+        // nothing left to run
+        return;
+    }
+    save_context(p);
+    load_context(next);
+    current = next->pid;
+}
+
+uint64_t process_brk(uint64_t addr){
+    process_t* p = process_get(process_current());
+    if(addr < p->brk_start || addr > p->brk_start + PROCESS_HEAP_MAX){
+        return p->brk;
+    }
+
+    // the pages above the new break are unmapped, the pages below it
+    // are demand zero on the first touch
+    uint64_t page_mask = PHYSICAL_PAGE_SIZE - 1;
+    uint64_t old_end = (p->brk + page_mask) & ~page_mask;
+    uint64_t new_end = (addr + page_mask) & ~page_mask;
+    for(uint64_t page=new_end; page<old_end; page+=PHYSICAL_PAGE_SIZE){
+        mmu_unmap_page(page);
+    }
+    p->brk = addr;
+    return addr;
+}
+
+uint64_t process_sbrk(int64_t incr){
+    uint64_t old = process_brk(0);
+    if(process_brk(old + incr) != old + incr){
+        return 0;
+    }
+    return old;
+}
+
+static void sys_brk(){
+    cpu_reg.rax = process_brk(cpu_reg.rdi);
+}
+
+// bind the import r11 of the executable and jump to it, with the
+// arguments of the call untouched
+static void sys_dl_resolve(){
+    cpu_pc.rip = loader_resolve(cpu_reg.r11);
+}
+
+/*
+look-up table of the system call handlers, indexed by the number in rax
+*/
+typedef void (*syscall_t)();
+static syscall_t syscall_table[] = {
+    [SYS_brk]   = &sys_brk,
+    [SYS_fork]  = &sys_fork,
+    [SYS_exit]  = &sys_exit,
+    [SYS_dl_resolve] = &sys_dl_resolve,
+};
+
+void do_syscall(){
+    lazy_initialize_process();
+    uint64_t number = cpu_reg.rax;
+    if(number >= sizeof(syscall_table) / sizeof(syscall_t) || syscall_table[number] == NULL){
+        printf("syscall: unknown system call %lu\n",number);
+        exit(1);
+    }
+    syscall_table[number]();
+}
@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "headers/common.h"
 #include "headers/linker.h"
+#include "headers/algorithm.h"
+#include "headers/instruction.h"
 
 
 // extern int read_elf(const char* filename, uint64_t bufassr);
@@ -32,7 +37,756 @@ int main(){
 }*/
 
 
+// the index of the global symbols: 100k names
+static void TestSymbolIndex(){
+    const int num_symbols = 100000;
+    hashtable_t* index = hashtable_construct(8);
+    char name[MAX_CHAR_SYMBOL_NAME];
+
+    for(int i=0; i<num_symbols; ++i){
+        sprintf(name,"sym_%d",i);
+        hashtable_insert(&index,name,i);
+    }
+
+    int match = 1;
+    for(int i=0; i<num_symbols; ++i){
+        uint64_t value;
+        sprintf(name,"sym_%d",i);
+        match = match && (hashtable_get(index,name,&value) == 1 && value == (uint64_t)i);
+    }
+    uint64_t value;
+    match = match && (hashtable_get(index,"sym_",&value) == 0);
+    hashtable_free(index);
+
+    // "Ab" and "`a" have the same hash: so do all the strings of 6 of them
+    index = hashtable_construct(8);
+    for(int i=0; i<64; ++i){
+        for(int j=0; j<6; ++j){
+            strcpy(name + 2 * j,((i >> j) & 0x1) ? "Ab" : "`a");
+        }
+        hashtable_insert(&index,name,i);
+    }
+    // the other keys split the grown bucket
+    for(int i=0; i<1000; ++i){
+        sprintf(name,"sym_%d",i);
+        hashtable_insert(&index,name,i);
+    }
+    match = match && index->globaldepth <= 30;
+    for(int i=0; i<64; ++i){
+        for(int j=0; j<6; ++j){
+            strcpy(name + 2 * j,((i >> j) & 0x1) ? "Ab" : "`a");
+        }
+        match = match && (hashtable_get(index,name,&value) == 1 && value == (uint64_t)i);
+    }
+    for(int i=0; i<1000; ++i){
+        sprintf(name,"sym_%d",i);
+        match = match && (hashtable_get(index,name,&value) == 1 && value == (uint64_t)i);
+    }
+    hashtable_free(index);
+
+    if (match)
+    {
+        printf("symbol index match\n");
+    }
+    else
+    {
+        printf("symbol index mismatch\n");
+    }
+}
+
+// the calls take the absolute address of the row of .text, linked at 0x00400000
+static void expect_call(char* expected, int64_t row){
+    sprintf(expected,"callq  0x%016lx",(uint64_t)(0x00400000 + row * MAX_INSTRUCTION_CHAR));
+}
+
+static void write_test_elf(char* filename, void (*write)(FILE*,int), int n){
+    int fd = mkstemp(filename);
+    FILE* fp = fdopen(fd,"w");
+    write(fp,n);
+    fclose(fp);
+}
+
+// n global functions of 2 lines
+static void write_library(FILE* fp, int n){
+    fprintf(fp,"%d\n2\n",4 + 3 * n);
+    fprintf(fp,".text,0x0,4,%d\n",2 * n);
+    fprintf(fp,".symtab,0x0,%d,%d\n",4 + 2 * n,n);
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"push   %%rbp\nretq\n");
+    }
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"func_%d,STB_GLOBAL,STT_FUNC,.text,%d,2\n",i,2 * i);
+    }
+}
+
+// main calls the last function of the library
+static void write_caller(FILE* fp, int n){
+    fprintf(fp,"10\n3\n.text,0x0,5,2\n.symtab,0x0,7,2\n.rel.text,0x0,9,1\n");
+    fprintf(fp,"callq  0x0000000000000000   // func_%d\nretq\n",n - 1);
+    fprintf(fp,"main,STB_GLOBAL,STT_FUNC,.text,0,2\n");
+    fprintf(fp,"func_%d,STB_GLOBAL,STT_NOTYPE,SHN_UNDEF,0,0\n",n - 1);
+    fprintf(fp,"0,7,R_X86_64_PLT32,1,-4\n");
+}
+
+// far more lines and symbols than the fixed buffers used to hold
+static void TestLargeLink(){
+    const int n = 10000;
+    char library_fn[] = "/tmp/library_XXXXXX";
+    char caller_fn[] = "/tmp/caller_XXXXXX";
+    write_test_elf(library_fn,&write_library,n);
+    write_test_elf(caller_fn,&write_caller,n);
+
+    elf_t src[2];
+    parse_elf(library_fn,&src[0]);
+    parse_elf(caller_fn,&src[1]);
+    unlink(library_fn);
+    unlink(caller_fn);
+
+    int match = 1;
+    match = match && (src[0].line_count == 4 + 3 * n && src[0].symt_count == n);
+
+    elf_t dst;
+    elf_t* srcp[2] = {&src[0],&src[1]};
+    link_elf(srcp,2,&dst);
+
+    // .text then .symtab: main follows the 2n lines of the library
+    match = match && (dst.line_count == 4 + 2 * n + 2 + n + 1);
+    // the call in row 2n goes to func_(n-1) in row 2n - 2
+    char expected[64];
+    expect_call(expected,2 * n - 2);
+    match = match && (strncmp(elf_line(&dst,4 + 2 * n),expected,strlen(expected)) == 0);
+
+    free_elf(&src[0]);
+    free_elf(&src[1]);
+    free_elf(&dst);
+
+    if (match)
+    {
+        printf("large link match\n");
+    }
+    else
+    {
+        printf("large link mismatch\n");
+    }
+}
+
+// main calls every function of the library
+static void write_callers(FILE* fp, int n){
+    fprintf(fp,"%d\n3\n.text,0x0,5,%d\n.symtab,0x0,%d,%d\n.rel.text,0x0,%d,%d\n",
+        5 + (n + 1) + (n + 1) + n,n + 1,5 + n + 1,n + 1,5 + 2 * (n + 1),n);
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"callq  0x0000000000000000   // func_%d\n",i);
+    }
+    fprintf(fp,"retq\n");
+    fprintf(fp,"main,STB_GLOBAL,STT_FUNC,.text,0,%d\n",n + 1);
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"func_%d,STB_GLOBAL,STT_NOTYPE,SHN_UNDEF,0,0\n",i);
+    }
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"%d,7,R_X86_64_PLT32,%d,-4\n",i,i + 1);
+    }
+}
+
+// enough relocations to be applied by several workers
+static void TestParallelRelocation(){
+    const int n = 50000;
+    char library_fn[] = "/tmp/library_XXXXXX";
+    char callers_fn[] = "/tmp/callers_XXXXXX";
+    write_test_elf(library_fn,&write_library,n);
+    write_test_elf(callers_fn,&write_callers,n);
+
+    elf_t src[2];
+    parse_elf(library_fn,&src[0]);
+    parse_elf(callers_fn,&src[1]);
+    unlink(library_fn);
+    unlink(callers_fn);
+
+    elf_t dst;
+    elf_t* srcp[2] = {&src[0],&src[1]};
+    // more workers than processors is fine: the partitions are disjoint anyway
+    link_set_threads(4);
+    link_elf(srcp,2,&dst);
+    link_set_threads(0);
+
+    // the call in row i of main is at row 2n + i, func_i at row 2i
+    int match = 1;
+    for(int i=0; match && i<n; ++i){
+        char expected[64];
+        expect_call(expected,2 * i);
+        match = strncmp(elf_line(&dst,4 + 2 * n + i),expected,strlen(expected)) == 0;
+    }
+
+    free_elf(&src[0]);
+    free_elf(&src[1]);
+    free_elf(&dst);
+
+    if (match)
+    {
+        printf("parallel relocation match\n");
+    }
+    else
+    {
+        printf("parallel relocation mismatch\n");
+    }
+}
+
+// the same symbols as write_library, other instructions
+static void write_library_edited(FILE* fp, int n){
+    fprintf(fp,"%d\n2\n",4 + 3 * n);
+    fprintf(fp,".text,0x0,4,%d\n",2 * n);
+    fprintf(fp,".symtab,0x0,%d,%d\n",4 + 2 * n,n);
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"push   %%rbx\nretq\n");
+    }
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"func_%d,STB_GLOBAL,STT_FUNC,.text,%d,2\n",i,2 * i);
+    }
+}
+
+// the same layout, lines of other lengths
+static void write_library_shorter(FILE* fp, int n){
+    fprintf(fp,"%d\n2\n",4 + 3 * n);
+    fprintf(fp,".text,0x0,4,%d\n",2 * n);
+    fprintf(fp,".symtab,0x0,%d,%d\n",4 + 2 * n,n);
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"push %%rbx\nret\n");
+    }
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"func_%d,STB_GLOBAL,STT_FUNC,.text,%d,2\n",i,2 * i);
+    }
+}
+
+static int same_file(const char* a, const char* b){
+    FILE* fa = fopen(a,"r");
+    FILE* fb = fopen(b,"r");
+    int same = fa != NULL && fb != NULL;
+    while(same){
+        int ca = fgetc(fa);
+        same = ca == fgetc(fb);
+        if(ca == EOF){
+            break;
+        }
+    }
+    if(fa != NULL){
+        fclose(fa);
+    }
+    if(fb != NULL){
+        fclose(fb);
+    }
+    return same;
+}
+
+// full link into expected_fn
+static void link_files(char** filenames, const char* expected_fn){
+    elf_t src[2];
+    elf_t* srcp[2] = {&src[0],&src[1]};
+    parse_elf(filenames[0],&src[0]);
+    parse_elf(filenames[1],&src[1]);
+    elf_t dst;
+    link_elf(srcp,2,&dst);
+    write_eof(expected_fn,&dst);
+    free_elf(&src[0]);
+    free_elf(&src[1]);
+    free_elf(&dst);
+}
+
+static void TestIncrementalLink(){
+    const int n = 1000;
+    char library_fn[] = "/tmp/library_XXXXXX";
+    char caller_fn[] = "/tmp/caller_XXXXXX";
+    char eof_fn[] = "/tmp/eof_XXXXXX";
+    char expected_fn[] = "/tmp/expected_XXXXXX";
+    write_test_elf(library_fn,&write_library,n);
+    write_test_elf(caller_fn,&write_caller,n);
+    close(mkstemp(eof_fn));
+    close(mkstemp(expected_fn));
+    char state_fn[64];
+    sprintf(state_fn,"%s.state",eof_fn);
+    unlink(state_fn);
+
+    char* filenames[2] = {library_fn,caller_fn};
+    int match = 1;
+
+    // no state: full link
+    match = match && link_elf_incremental(filenames,2,eof_fn) == 0;
+    link_files(filenames,expected_fn);
+    match = match && same_file(eof_fn,expected_fn);
+
+    // nothing changed
+    match = match && link_elf_incremental(filenames,2,eof_fn) == 1;
+    match = match && same_file(eof_fn,expected_fn);
+
+    // the same layout: patched, the lines written in place
+    incremental_stats_t before = incremental_stats;
+    FILE* fp = fopen(library_fn,"w");
+    write_library_edited(fp,n);
+    fclose(fp);
+    match = match && link_elf_incremental(filenames,2,eof_fn) == 1;
+    match = match && incremental_stats.lines_patched - before.lines_patched == 2 * n;
+    match = match && incremental_stats.rewrites == before.rewrites;
+    link_files(filenames,expected_fn);
+    match = match && same_file(eof_fn,expected_fn);
+
+    // the same layout, lines of other lengths: patched, the EOF written again
+    before = incremental_stats;
+    fp = fopen(library_fn,"w");
+    write_library_shorter(fp,n);
+    fclose(fp);
+    match = match && link_elf_incremental(filenames,2,eof_fn) == 1;
+    match = match && incremental_stats.lines_patched == before.lines_patched;
+    match = match && incremental_stats.rewrites - before.rewrites == 1;
+    link_files(filenames,expected_fn);
+    match = match && same_file(eof_fn,expected_fn);
+
+    // one more function does not fit
+    fp = fopen(library_fn,"w");
+    write_library(fp,n + 1);
+    fclose(fp);
+    match = match && link_elf_incremental(filenames,2,eof_fn) == 0;
+    link_files(filenames,expected_fn);
+    match = match && same_file(eof_fn,expected_fn);
+
+    unlink(library_fn);
+    unlink(caller_fn);
+    unlink(eof_fn);
+    unlink(expected_fn);
+    unlink(state_fn);
+
+    if (match)
+    {
+        printf("incremental link match\n");
+    }
+    else
+    {
+        printf("incremental link mismatch\n");
+    }
+}
+
+#define ARCHIVE_TEST_MEMBERS    (50)
+#define ARCHIVE_TEST_FUNCS      (20)
+
+// member j defines lib_j_0 ... , lib_3_0 calls lib_7_5
+static void write_member(FILE* fp, int j){
+    int calls = j == 3;
+    int n = ARCHIVE_TEST_FUNCS;
+    fprintf(fp,"%d\n%d\n",4 + calls + 2 * n + n + 2 * calls,2 + calls);
+    fprintf(fp,".text,0x0,%d,%d\n",4 + calls,2 * n);
+    fprintf(fp,".symtab,0x0,%d,%d\n",4 + calls + 2 * n,n + calls);
+    if(calls){
+        fprintf(fp,".rel.text,0x0,%d,1\n",5 + 3 * n + 1);
+    }
+    for(int i=0; i<n; ++i){
+        if(calls && i == 0){
+            fprintf(fp,"callq  0x0000000000000000   // lib_7_5\nretq\n");
+        }else{
+            fprintf(fp,"push   %%rbp\nretq\n");
+        }
+    }
+    for(int i=0; i<n; ++i){
+        fprintf(fp,"lib_%d_%d,STB_GLOBAL,STT_FUNC,.text,%d,2\n",j,i,2 * i);
+    }
+    if(calls){
+        fprintf(fp,"lib_7_5,STB_GLOBAL,STT_NOTYPE,SHN_UNDEF,0,0\n");
+        fprintf(fp,"0,7,R_X86_64_PLT32,%d,-4\n",n);
+    }
+}
+
+static void write_archive_caller(FILE* fp, int n){
+    fprintf(fp,"10\n3\n.text,0x0,5,2\n.symtab,0x0,7,2\n.rel.text,0x0,9,1\n");
+    fprintf(fp,"callq  0x0000000000000000   // lib_3_0\nretq\n");
+    fprintf(fp,"main,STB_GLOBAL,STT_FUNC,.text,0,2\n");
+    fprintf(fp,"lib_3_0,STB_GLOBAL,STT_NOTYPE,SHN_UNDEF,0,0\n");
+    fprintf(fp,"0,7,R_X86_64_PLT32,1,-4\n");
+}
+
+// only the members resolving the undefined symbols are linked
+static void TestArchive(){
+    char member_fn[ARCHIVE_TEST_MEMBERS][32];
+    char* members[ARCHIVE_TEST_MEMBERS];
+    for(int j=0; j<ARCHIVE_TEST_MEMBERS; ++j){
+        strcpy(member_fn[j],"/tmp/member_XXXXXX");
+        write_test_elf(member_fn[j],&write_member,j);
+        members[j] = member_fn[j];
+    }
+    char archive_fn[] = "/tmp/archive_XXXXXX";
+    char caller_fn[] = "/tmp/caller_XXXXXX";
+    close(mkstemp(archive_fn));
+    write_test_elf(caller_fn,&write_archive_caller,0);
+    write_archive(archive_fn,members,ARCHIVE_TEST_MEMBERS);
+    for(int j=0; j<ARCHIVE_TEST_MEMBERS; ++j){
+        unlink(member_fn[j]);
+    }
+
+    int match = is_archive(archive_fn) && !is_archive(caller_fn);
+    archive_t* ar = archive_open(archive_fn);
+
+    // every global is found, the misses mostly stop at the filter
+    for(int j=0; j<ARCHIVE_TEST_MEMBERS; ++j){
+        for(int i=0; i<ARCHIVE_TEST_FUNCS; ++i){
+            char name[64];
+            sprintf(name,"lib_%d_%d",j,i);
+            match = match && archive_lookup(ar,name) == j;
+        }
+    }
+    uint64_t rejects = archive_stats.bloom_rejects;
+    for(int i=0; i<1000; ++i){
+        char name[64];
+        sprintf(name,"missing_%d",i);
+        match = match && archive_lookup(ar,name) == -1;
+    }
+    match = match && archive_stats.bloom_rejects - rejects >= 950;
+
+    elf_t caller;
+    parse_elf(caller_fn,&caller);
+    unlink(caller_fn);
+    int num_srcs = 1;
+    elf_t** srcs = malloc(sizeof(elf_t*));
+    srcs[0] = &caller;
+    match = match && archive_extract(&ar,1,&srcs,&num_srcs) == 2 && num_srcs == 3;
+
+    elf_t dst;
+    link_elf(srcs,num_srcs,&dst);
+    // main, then lib_3_*, then lib_7_*
+    char expected[64];
+    expect_call(expected,2);
+    match = match && strncmp(elf_line(&dst,4),expected,strlen(expected)) == 0;
+    int lib_7_5 = 2 + 2 * ARCHIVE_TEST_FUNCS + 2 * 5;
+    expect_call(expected,lib_7_5);
+    match = match && strncmp(elf_line(&dst,4 + 2),expected,strlen(expected)) == 0;
+
+    free_elf(&caller);
+    free_elf(&dst);
+    free(srcs);
+    archive_close(ar);
+    unlink(archive_fn);
+
+    if (match)
+    {
+        printf("archive match\n");
+    }
+    else
+    {
+        printf("archive mismatch\n");
+    }
+}
+
+// main -> lib_3_0 -> lib_7_5, the other functions are garbage
+static void TestGcSections(){
+    char member_fn[2][32] = {"/tmp/member_XXXXXX","/tmp/member_XXXXXX"};
+    char caller_fn[] = "/tmp/caller_XXXXXX";
+    write_test_elf(member_fn[0],&write_member,3);
+    write_test_elf(member_fn[1],&write_member,7);
+    write_test_elf(caller_fn,&write_archive_caller,0);
+
+    elf_t src[3];
+    parse_elf(caller_fn,&src[0]);
+    parse_elf(member_fn[0],&src[1]);
+    parse_elf(member_fn[1],&src[2]);
+    unlink(caller_fn);
+    unlink(member_fn[0]);
+    unlink(member_fn[1]);
+
+    elf_t dst;
+    elf_t* srcp[3] = {&src[0],&src[1],&src[2]};
+    link_set_gc_sections(1);
+    link_elf(srcp,3,&dst);
+    link_set_gc_sections(0);
+
+    // .text of main, lib_3_0, lib_7_5 then their symbols
+    int match = dst.symt_count == 3 && dst.line_count == 4 + 3 * 2 + 3;
+    match = match && strcmp(dst.symt[1].st_name,"lib_3_0") == 0 && strcmp(dst.symt[2].st_name,"lib_7_5") == 0;
+    char expected[64];
+    expect_call(expected,2);
+    match = match && strncmp(elf_line(&dst,4),expected,strlen(expected)) == 0;
+    expect_call(expected,4);
+    match = match && strncmp(elf_line(&dst,4 + 2),expected,strlen(expected)) == 0;
+    free_elf(&dst);
+
+    // without main nothing is collected
+    elf_t* libp[2] = {&src[1],&src[2]};
+    link_set_gc_sections(1);
+    link_elf(libp,2,&dst);
+    link_set_gc_sections(0);
+    match = match && dst.symt_count == 2 * ARCHIVE_TEST_FUNCS;
+    free_elf(&dst);
+
+    for(int i=0; i<3; ++i){
+        free_elf(&src[i]);
+    }
+
+    if (match)
+    {
+        printf("gc sections match\n");
+    }
+    else
+    {
+        printf("gc sections mismatch\n");
+    }
+}
+
+// f0 and f2 call g0, f1 calls g1: f2 is identical to f0, g0 to the library
+static void write_icf_object(FILE* fp, int n){
+    fprintf(fp,"31\n3\n.text,0x0,5,14\n.symtab,0x0,19,6\n.rel.text,0x0,25,6\n");
+    fprintf(fp,"callq  0x0000000000000000\ncallq  0x0000000000000000\ncallq  0x0000000000000000\nretq\n");
+    for(int i=0; i<3; ++i){
+        fprintf(fp,"callq  0x0000000000000000\nretq\n");
+    }
+    fprintf(fp,"push   %%rbp\nretq\nmov    %%rsp,%%rbp\nretq\n");
+    fprintf(fp,"main,STB_GLOBAL,STT_FUNC,.text,0,4\n");
+    fprintf(fp,"f0,STB_GLOBAL,STT_FUNC,.text,4,2\nf1,STB_GLOBAL,STT_FUNC,.text,6,2\nf2,STB_GLOBAL,STT_FUNC,.text,8,2\n");
+    fprintf(fp,"g0,STB_GLOBAL,STT_FUNC,.text,10,2\ng1,STB_GLOBAL,STT_FUNC,.text,12,2\n");
+    fprintf(fp,"0,7,R_X86_64_PLT32,1,-4\n1,7,R_X86_64_PLT32,2,-4\n2,7,R_X86_64_PLT32,3,-4\n");
+    fprintf(fp,"4,7,R_X86_64_PLT32,4,-4\n6,7,R_X86_64_PLT32,5,-4\n8,7,R_X86_64_PLT32,4,-4\n");
+}
+
+// the identical functions share one copy
+static void TestIdenticalCodeFolding(){
+    const int n = 1000;
+    char library_fn[] = "/tmp/library_XXXXXX";
+    char object_fn[] = "/tmp/object_XXXXXX";
+    write_test_elf(library_fn,&write_library,n);
+    write_test_elf(object_fn,&write_icf_object,0);
+
+    elf_t src[2];
+    parse_elf(library_fn,&src[0]);
+    parse_elf(object_fn,&src[1]);
+    unlink(library_fn);
+    unlink(object_fn);
+
+    elf_t dst;
+    elf_t* srcp[2] = {&src[0],&src[1]};
+    link_set_icf(1);
+    link_set_threads(4);
+    link_elf(srcp,2,&dst);
+    link_set_threads(0);
+    link_set_icf(0);
+
+    // .text: func_0, main, f0, f1, g1
+    int match = dst.symt_count == n + 6 && dst.line_count == 4 + 2 + 4 + 2 + 2 + 2 + n + 6;
+    for(int i=0; i<n; ++i){
+        match = match && dst.symt[i].st_value == 0;
+    }
+    match = match && dst.symt[n + 1].st_value == 6 && dst.symt[n + 3].st_value == 6;
+    match = match && dst.symt[n + 2].st_value == 8 && dst.symt[n + 4].st_value == 0;
+    match = match && dst.symt[n + 5].st_value == 10;
+    // main calls f0, f1 and f2 = f0; f0 calls g0 = func_0, f1 calls g1
+    int64_t calls[5][2] = {{2,6},{3,8},{4,6},{6,0},{8,10}};
+    for(int i=0; i<5; ++i){
+        char expected[64];
+        expect_call(expected,calls[i][1]);
+        match = match && strncmp(elf_line(&dst,4 + calls[i][0]),expected,strlen(expected)) == 0;
+    }
+
+    free_elf(&src[0]);
+    free_elf(&src[1]);
+    free_elf(&dst);
+
+    if (match)
+    {
+        printf("identical code folding match\n");
+    }
+    else
+    {
+        printf("identical code folding mismatch\n");
+    }
+}
+
+static void TestDynamicLink(){
+    char caller_fn[] = "/tmp/caller_XXXXXX";
+    char member_fn[] = "/tmp/member_XXXXXX";
+    write_test_elf(caller_fn,&write_archive_caller,0);
+    write_test_elf(member_fn,&write_member,7);
+
+    elf_t src[2];
+    parse_elf(caller_fn,&src[0]);
+    parse_elf(member_fn,&src[1]);
+    unlink(caller_fn);
+    unlink(member_fn);
+
+    // lib_3_0 is imported: main, PLT0, PLT[0]
+    elf_t dst;
+    char* needed[1] = {"/tmp/lib_3.eof.txt"};
+    elf_t* callerp[1] = {&src[0]};
+    link_set_needed(needed,1);
+    link_elf(callerp,1,&dst);
+    link_set_needed(NULL,0);
+
+    int match = dst.sht_count == 5 && dst.symt_count == 2 && dst.line_count == 2 + 5 + 7 + 1 + 2 + 1 + 1;
+    match = match && strcmp(dst.sht[0].sh_name,".text") == 0 && dst.sht[0].sh_size == 7;
+    match = match && strcmp(dst.sht[1].sh_name,".got.plt") == 0 &&
+        dst.sht[1].sh_addr == 0x00400000 + 7 * MAX_INSTRUCTION_CHAR;
+    // main calls the stub at its absolute address
+    char expected[64];
+    expect_call(expected,4);
+    match = match && strncmp(elf_line(&dst,7),expected,strlen(expected)) == 0;
+    const char* lines[10] = {
+        "mov    $0x1f4,%rax",
+        "syscall",
+        "jmp    *0x4001c0",
+        "mov    $0x0,%r11",
+        "jmp    0x400080",
+        "0x0000000000400140",
+        "main,STB_GLOBAL,STT_FUNC,.text,0,2",
+        "lib_3_0@plt,STB_GLOBAL,STT_FUNC,.text,4,3",
+        "lib_3_0",
+        "/tmp/lib_3.eof.txt",
+    };
+    for(int i=0; i<10; ++i){
+        match = match && strcmp(elf_line(&dst,9 + i),lines[i]) == 0;
+    }
+    free_elf(&dst);
+
+    // the shared image is linked at its own address
+    elf_t* memberp[1] = {&src[1]};
+    link_set_base(0x10000000);
+    link_elf(memberp,1,&dst);
+    link_set_base(0x00400000);
+    match = match && dst.sht_count == 2 && dst.sht[0].sh_addr == 0x10000000;
+    free_elf(&dst);
+
+    free_elf(&src[0]);
+    free_elf(&src[1]);
+
+    if (match)
+    {
+        printf("dynamic link match\n");
+    }
+    else
+    {
+        printf("dynamic link mismatch\n");
+    }
+}
+
+// the parsers share the constant dictionary and the tag list
+#define PARALLEL_PARSE_THREADS  (8)
+#define PARALLEL_PARSE_ROUNDS   (16)
+
+static char parallel_fn[3][32] = {"./files/exe/sum.elf.txt","./files/exe/main.elf.txt","/tmp/library_XXXXXX"};
+static elf_t parallel_expected[3];
+
+static int same_elf(elf_t* a, elf_t* b){
+    if(a->line_count != b->line_count || a->symt_count != b->symt_count ||
+        a->reltext_count != b->reltext_count || a->reldata_count != b->reldata_count){
+        return 0;
+    }
+    for(uint32_t i=0; i<a->symt_count; ++i){
+        if(strcmp(a->symt[i].st_name,b->symt[i].st_name) != 0 ||
+            a->symt[i].bind != b->symt[i].bind || a->symt[i].type != b->symt[i].type ||
+            a->symt[i].st_value != b->symt[i].st_value){
+            return 0;
+        }
+    }
+    for(uint32_t i=0; i<a->reltext_count; ++i){
+        if(a->reltext[i].sym != b->reltext[i].sym || a->reltext[i].type != b->reltext[i].type){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void* parallel_parser(void* arg){
+    uint64_t mismatches = 0;
+    for(int r=0; r<PARALLEL_PARSE_ROUNDS; ++r){
+        for(int i=0; i<3; ++i){
+            elf_t elf;
+            parse_elf(parallel_fn[(i + r) % 3],&elf);
+            mismatches += same_elf(&elf,&parallel_expected[(i + r) % 3]) == 0;
+            free_elf(&elf);
+        }
+    }
+    return (void*)mismatches;
+}
+
+static void TestParallelParse(){
+    write_test_elf(parallel_fn[2],&write_library,200);
+    for(int i=0; i<3; ++i){
+        parse_elf(parallel_fn[i],&parallel_expected[i]);
+    }
+
+    pthread_t threads[PARALLEL_PARSE_THREADS];
+    for(int i=0; i<PARALLEL_PARSE_THREADS; ++i){
+        pthread_create(&threads[i],NULL,&parallel_parser,NULL);
+    }
+    uint64_t mismatches = 0;
+    for(int i=0; i<PARALLEL_PARSE_THREADS; ++i){
+        void* result;
+        pthread_join(threads[i],&result);
+        mismatches += (uint64_t)result;
+    }
+
+    unlink(parallel_fn[2]);
+    for(int i=0; i<3; ++i){
+        free_elf(&parallel_expected[i]);
+    }
+
+    if (mismatches == 0)
+    {
+        printf("parallel parse match\n");
+    }
+    else
+    {
+        printf("parallel parse mismatch\n");
+    }
+}
+
+// the binary objects link to the same executable as the text ones
+static void TestBinaryElf(){
+    char* text_fn[2] = {"./files/exe/sum.elf.txt","./files/exe/main.elf.txt"};
+    char binary_fn[2][32] = {"/tmp/sum_XXXXXX","/tmp/main_XXXXXX"};
+
+    elf_t text[2], binary[2];
+    int match = 1;
+    for(int i=0; i<2; ++i){
+        parse_elf(text_fn[i],&text[i]);
+        close(mkstemp(binary_fn[i]));
+        write_binary_elf(binary_fn[i],&text[i]);
+        match = match && is_binary_elf(binary_fn[i]) && !is_binary_elf(text_fn[i]);
+        parse_elf(binary_fn[i],&binary[i]);
+        unlink(binary_fn[i]);
+        match = match && binary[i].map != NULL && binary[i].line_count == text[i].line_count;
+    }
+
+    elf_t text_dst, binary_dst;
+    elf_t* srcp[2] = {&text[0],&text[1]};
+    link_elf(srcp,2,&text_dst);
+    srcp[0] = &binary[0];
+    srcp[1] = &binary[1];
+    link_elf(srcp,2,&binary_dst);
+
+    match = match && text_dst.line_count == binary_dst.line_count;
+    for(uint32_t i=0; match && i<text_dst.line_count; ++i){
+        match = strcmp(elf_line(&text_dst,i),elf_line(&binary_dst,i)) == 0;
+    }
+
+    for(int i=0; i<2; ++i){
+        free_elf(&text[i]);
+        free_elf(&binary[i]);
+    }
+    free_elf(&text_dst);
+    free_elf(&binary_dst);
+
+    if (match)
+    {
+        printf("binary elf match\n");
+    }
+    else
+    {
+        printf("binary elf mismatch\n");
+    }
+}
+
 int main(){
+    TestSymbolIndex();
+    TestLargeLink();
+    TestBinaryElf();
+    TestParallelParse();
+    TestParallelRelocation();
+    TestIncrementalLink();
+    TestArchive();
+    TestGcSections();
+    TestIdenticalCodeFolding();
+    TestDynamicLink();
+
     elf_t src[2];
 
     parse_elf("./files/exe/sum.elf.txt",&(src[0]));
@@ -1,14 +1,32 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "headers/common.h"
 #include "headers/cpu.h"
 #include "headers/memory.h"
+#include "headers/trace.h"
+#include "headers/process.h"
+#include "headers/linker.h"
 
 #define MAX_NUM_INSTRUCTION_CYCLE 100
 
 static void TestAddfunctionCallAndCompution();
 static void TestString2Uint();
 static void TestSumRecursiveCondition();
+static void TestSoftTLB();
+static void TestSparsePhysicalMemory();
+static void TestDramWidthAndBlock();
+static void TestDemandPaging();
+static void TestHugePage();
+static void TestLoader();
+static void TestMemoryTrace();
+static void TestStackDistance();
+static void TestDramTiming();
+static void TestCopyOnWriteFork();
+static void TestGuestMalloc();
+static void TestLazyBinding();
+static void TestLinkedProgram();
 
 // quote from isa.c
 extern void print_register();
@@ -18,6 +36,19 @@ extern void TestParseInstruction();
 
 int main(){
     TestAddfunctionCallAndCompution();
+    TestSoftTLB();
+    TestSparsePhysicalMemory();
+    TestDramWidthAndBlock();
+    TestDemandPaging();
+    TestHugePage();
+    TestLoader();
+    TestMemoryTrace();
+    TestStackDistance();
+    TestDramTiming();
+    TestCopyOnWriteFork();
+    TestGuestMalloc();
+    TestLazyBinding();
+    TestLinkedProgram();
 //    TestString2Uint();
 //    TestParsingOperand();
 
@@ -73,7 +104,7 @@ static void TestAddfunctionCallAndCompution(){
         "mov    %rax,-0x8(%rbp)",   // 14
     };
     // copy to physical memory
-    for(int i=0;i<16;++i){
+    for(int i=0;i<15;++i){
         writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
     }
     cpu_pc.rip = MAX_INSTRUCTION_CHAR * sizeof(char) * 11 + 0x00400000;
@@ -234,4 +265,898 @@ static void TestSumRecursiveCondition(){
     {
         printf("memory mismatch\n");
     }
-}
\ No newline at end of file
+}
+
+static void TestSoftTLB(){
+    // the soft tlb must agree with va2pa() + dram, including
+    // the accesses crossing a page boundary
+    uint64_t vaddrs[4] = {
+        0x7ffffffee0f0,     // in one page
+        0x00400ff8,         // the last 8 bytes of a page
+        0x00400ffc,         // crossing the page boundary
+        0x7ffffffee0f0,     // hit
+    };
+    int match = 1;
+    for(int i=0; i<4; ++i){
+        uint64_t val = 0x0123456789abcdef + i;
+
+        // the two pages of a crossing access are not contiguous
+        // in physical memory, so compare byte by byte
+        write64bits_vaddr(vaddrs[i],val);
+        for(int j=0; j<8; ++j){
+            match = match && (read8bits_dram(va2pa(vaddrs[i] + j)) == ((val >> (j * 8)) & 0xff));
+        }
+
+        for(int j=0; j<8; ++j){
+            write8bits_dram(va2pa(vaddrs[i] + j),((~val) >> (j * 8)) & 0xff);
+        }
+        match = match && (read64bits_vaddr(vaddrs[i]) == ~val);
+    }
+
+    if (match)
+    {
+        printf("soft tlb match\n");
+    }
+    else
+    {
+        printf("soft tlb mismatch\n");
+    }
+}
+
+static void TestSparsePhysicalMemory(){
+    // touch a few frames scattered over the whole physical space
+    uint64_t before = pm_frame_count();
+    uint64_t paddrs[3] = {
+        0x0000000ff8,                           // crossing frame 0 and frame 1
+        PHYSICAL_MEMORY_SPACE / 2 + 0x123,
+        PHYSICAL_MEMORY_SPACE - 8,              // the last 8 bytes
+    };
+    int match = 1;
+    for(int i=0; i<3; ++i){
+        write64bits_dram(paddrs[i],0xdeadbeef00000000 + i);
+    }
+    for(int i=0; i<3; ++i){
+        match = match && (read64bits_dram(paddrs[i]) == 0xdeadbeef00000000 + i);
+    }
+    // an untouched neighbour frame reads as zero
+    match = match && (read64bits_dram(PHYSICAL_MEMORY_SPACE / 2 + PHYSICAL_PAGE_SIZE) == 0);
+    // at most 5 frames are touched by the accesses above
+    match = match && (pm_frame_count() - before <= 5);
+
+    if (match)
+    {
+        printf("sparse physical memory match\n");
+    }
+    else
+    {
+        printf("sparse physical memory mismatch\n");
+    }
+}
+
+static void TestDramWidthAndBlock(){
+    int match = 1;
+
+    // little-endian layout shared by all widths, across the frame boundary
+    uint64_t paddr = 0x10000 - 3;
+    write64bits_dram(paddr,0x1122334455667788);
+    match = match && (read8bits_dram(paddr) == 0x88);
+    match = match && (read16bits_dram(paddr) == 0x7788);
+    match = match && (read32bits_dram(paddr) == 0x55667788);
+    write16bits_dram(paddr + 2,0xabcd);
+    write32bits_dram(paddr + 4,0x01020304);
+    write8bits_dram(paddr + 1,0xee);
+    match = match && (read64bits_dram(paddr) == 0x01020304abcdee88);
+
+    // bulk copy spanning three frames
+    char buf[2 * PHYSICAL_PAGE_SIZE + 100];
+    char out[2 * PHYSICAL_PAGE_SIZE + 100];
+    for(int i=0; i<sizeof(buf); ++i){
+        buf[i] = (char)(i * 7);
+    }
+    paddr = 0x20000 + PHYSICAL_PAGE_SIZE - 50;
+    writeblock_dram(paddr,buf,sizeof(buf));
+    readblock_dram(paddr,out,sizeof(out));
+    match = match && (memcmp(buf,out,sizeof(buf)) == 0);
+
+    fillblock_dram(paddr + 10,0x5a,PHYSICAL_PAGE_SIZE);
+    match = match && (read8bits_dram(paddr + 9) == (uint8_t)(9 * 7));
+    match = match && (read8bits_dram(paddr + 10) == 0x5a);
+    match = match && (read8bits_dram(paddr + 9 + PHYSICAL_PAGE_SIZE) == 0x5a);
+    match = match && (read8bits_dram(paddr + 10 + PHYSICAL_PAGE_SIZE) == (uint8_t)((10 + PHYSICAL_PAGE_SIZE) * 7));
+
+    if (match)
+    {
+        printf("dram width and block match\n");
+    }
+    else
+    {
+        printf("dram width and block mismatch\n");
+    }
+}
+
+static void TestDemandPaging(){
+    // 4 resident frames for 32 pages: every policy has to swap
+    const int num_pages = 32;
+    evict_policy_t policies[3] = {EVICT_CLOCK, EVICT_LRU_AGING, EVICT_WORKING_SET};
+    const char* names[3] = {"clock", "lru aging", "working set"};
+
+    paging_set_frame_budget(4);
+    paging_set_working_set_window(8);
+    for(int p=0; p<3; ++p){
+        paging_set_policy(policies[p]);
+        paging_stats_t before = paging_stats;
+
+        uint64_t base = 0x10000000 + (uint64_t)p * 0x1000000;
+        for(int i=0; i<num_pages; ++i){
+            write64bits_vaddr(base + i * PHYSICAL_PAGE_SIZE + 8 * i,0xabcd000000000000 + i);
+        }
+        int match = 1;
+        for(int round=0; round<2; ++round){
+            for(int i=0; i<num_pages; ++i){
+                match = match && (read64bits_vaddr(base + i * PHYSICAL_PAGE_SIZE + 8 * i) == 0xabcd000000000000 + i);
+                // the rest of the page is still zero
+                match = match && (read64bits_vaddr(base + i * PHYSICAL_PAGE_SIZE + 8 * i + 8) == 0);
+            }
+        }
+        match = match && (paging_stats.minor_faults - before.minor_faults == num_pages);
+        match = match && (paging_stats.major_faults - before.major_faults >= num_pages);
+        match = match && (paging_stats.evictions > before.evictions);
+        // every page has been swapped out: unmapping gives one slot back each
+        uint64_t slots = paging_stats.swap_slots;
+        for(int i=0; i<num_pages; ++i){
+            mmu_unmap_page(base + i * PHYSICAL_PAGE_SIZE);
+        }
+        match = match && (slots - paging_stats.swap_slots == num_pages);
+
+        printf("%s: minor %lu major %lu evictions %lu swap out %lu swap in %lu\n",names[p],
+            paging_stats.minor_faults - before.minor_faults,
+            paging_stats.major_faults - before.major_faults,
+            paging_stats.evictions - before.evictions,
+            paging_stats.swap_outs - before.swap_outs,
+            paging_stats.swap_ins - before.swap_ins);
+        if (match)
+        {
+            printf("demand paging (%s) match\n",names[p]);
+        }
+        else
+        {
+            printf("demand paging (%s) mismatch\n",names[p]);
+        }
+    }
+    paging_set_frame_budget(16384);
+}
+
+// sweep the region with a 4KB stride twice, return the tlb misses
+static uint64_t tlb_sweep(uint64_t base, uint64_t size, tlb_stats_t* stats){
+    tlb_stats_t before = tlb_stats;
+    for(int round=0; round<2; ++round){
+        for(uint64_t off=0; off<size; off+=PHYSICAL_PAGE_SIZE){
+            write64bits_vaddr(base + off,off);
+        }
+    }
+    stats->hits = tlb_stats.hits - before.hits;
+    stats->misses = tlb_stats.misses - before.misses;
+    stats->page_walks = tlb_stats.page_walks - before.page_walks;
+    stats->walk_references = tlb_stats.walk_references - before.walk_references;
+    return stats->misses;
+}
+
+static void TestHugePage(){
+    const uint64_t size = 4 * PAGE_2M_SIZE;
+    const uint64_t small_base = 0x40000000;
+    const uint64_t huge_base = 0x80000000;
+
+    mmu_set_tlb_model(1);
+
+    // 2048 4KB pages do not fit in 64 entries, 4 2MB pages do
+    tlb_stats_t small, huge;
+    tlb_sweep(small_base,size,&small);
+    for(uint64_t off=0; off<size; off+=PAGE_2M_SIZE){
+        mmu_map_hugepage(huge_base + off,PAGE_2M_OFFSET_LENGTH);
+    }
+    tlb_sweep(huge_base,size,&huge);
+
+    printf("4KB pages: tlb misses %lu walks %lu references per walk %.2f\n",
+        small.misses,small.page_walks,(double)small.walk_references / small.page_walks);
+    printf("2MB pages: tlb misses %lu walks %lu references per walk %.2f\n",
+        huge.misses,huge.page_walks,(double)huge.walk_references / huge.page_walks);
+
+    int match = 1;
+    match = match && (small.misses == 2 * size / PHYSICAL_PAGE_SIZE);
+    match = match && (huge.misses == 4);
+    match = match && (huge.walk_references == 3 * huge.page_walks);
+    for(uint64_t off=0; off<size; off+=PHYSICAL_PAGE_SIZE){
+        match = match && (read64bits_vaddr(huge_base + off) == off);
+    }
+    // one 1GB page
+    mmu_map_hugepage(0x100000000,PAGE_1G_OFFSET_LENGTH);
+    tlb_stats_t giant;
+    tlb_sweep(0x100000000,size,&giant);
+    match = match && (giant.misses == 1 && giant.walk_references == 2);
+
+    // transparent huge page: the last fault of the 2MB region promotes it
+    mmu_set_thp(1);
+    uint64_t promotions = paging_stats.thp_promotions;
+    uint64_t thp_base = 0xc0000000;
+    for(uint64_t off=0; off<PAGE_2M_SIZE; off+=PHYSICAL_PAGE_SIZE){
+        write64bits_vaddr(thp_base + off + 8,0xbeef0000 + off);
+    }
+    mmu_set_thp(0);
+    match = match && (paging_stats.thp_promotions == promotions + 1);
+    // the promoting walk has filled the 2MB entry
+    tlb_stats_t thp;
+    tlb_sweep(thp_base,PAGE_2M_SIZE,&thp);
+    match = match && (thp.misses == 0);
+    for(uint64_t off=0; off<PAGE_2M_SIZE; off+=PHYSICAL_PAGE_SIZE){
+        match = match && (read64bits_vaddr(thp_base + off + 8) == 0xbeef0000 + off);
+    }
+
+    mmu_set_tlb_model(0);
+    if (match)
+    {
+        printf("huge page match\n");
+    }
+    else
+    {
+        printf("huge page mismatch\n");
+    }
+}
+
+static void TestLoader(){
+    // the program of TestAddfunctionCallAndCompution followed by
+    // filler instructions never executed: 2048 lines, 32 pages of .text
+    const char* program[15] = {
+        "push   %rbp",
+        "mov    %rsp,%rbp",
+        "mov    %rdi,-0x18(%rbp)",
+        "mov    %rsi,-0x20(%rbp)",
+        "mov    -0x18(%rbp),%rdx",
+        "mov    -0x20(%rbp),%rax",
+        "add    %rdx,%rax",
+        "mov    %rax,-0x8(%rbp)",
+        "mov    -0x8(%rbp),%rax",
+        "pop    %rbp",
+        "retq",
+        "mov    %rdx,%rsi",
+        "mov    %rax,%rdi",
+        "callq  0x00400000",
+        "mov    %rax,-0x8(%rbp)",
+    };
+    const int num_text = 2048;
+    const uint64_t text_addr = 0x00400000;
+    const uint64_t data_addr = text_addr + num_text * MAX_INSTRUCTION_CHAR;
+
+    char filename[] = "/tmp/test_loader_XXXXXX";
+    int fd = mkstemp(filename);
+    FILE* fp = fdopen(fd,"w");
+    fprintf(fp,"%d\n3\n",5 + num_text + 2);
+    fprintf(fp,".text,0x%lx,5,%d\n",text_addr,num_text);
+    fprintf(fp,".data,0x%lx,%d,2\n",data_addr,5 + num_text);
+    fprintf(fp,".bss,0x%lx,0,4\n",data_addr + 16);
+    for(int i=0; i<num_text; ++i){
+        fprintf(fp,"%s \n",i < 15 ? program[i] : "mov    %rax,%rax");
+    }
+    fprintf(fp,"0x0000000012340000\n0x000000000000abcd\n");
+    fclose(fp);
+
+    paging_stats_t before = paging_stats;
+    load_eof(filename);
+    unlink(filename);
+
+    // nothing is copied at load time
+    int match = 1;
+    match = match && (paging_stats.minor_faults == before.minor_faults);
+    match = match && (loader_section_address(".data") == data_addr);
+
+    // the new address space has no stack yet
+    cpu_reg.rax = 0xabcd;
+    cpu_reg.rdx = 0x12340000;
+    cpu_reg.rbp = 0x7ffffffee110;
+    cpu_reg.rsp = 0x7ffffffee0f0;
+    write64bits_vaddr(0x7ffffffee110,0x0000000000000000);
+    write64bits_vaddr(0x7ffffffee108,0x0000000000000000);
+    write64bits_vaddr(0x7ffffffee100,0x0000000012340000);
+    write64bits_vaddr(0x7ffffffee0f8,0x000000000000abcd);
+    write64bits_vaddr(0x7ffffffee0f0,0x0000000000000000);
+
+    cpu_pc.rip = text_addr + MAX_INSTRUCTION_CHAR * 11;
+    for(int i=0; i<15; ++i){
+        instruction_cycle();
+    }
+    match = match && (cpu_reg.rax == 0x1234abcd);
+    match = match && (cpu_reg.rsp == 0x7ffffffee0f0);
+    match = match && (read64bits_vaddr(0x7ffffffee108) == 0x1234abcd);
+
+    // the stack page and the first .text page only
+    match = match && (paging_stats.minor_faults - before.minor_faults == 2);
+
+    match = match && (read64bits_vaddr(data_addr) == 0x12340000);
+    match = match && (read64bits_vaddr(data_addr + 8) == 0xabcd);
+    match = match && (read64bits_vaddr(data_addr + 16) == 0);
+
+    char inst[MAX_INSTRUCTION_CHAR];
+    readinst_vaddr(text_addr + (num_text - 1) * MAX_INSTRUCTION_CHAR,inst);
+    match = match && (strcmp(inst,"mov    %rax,%rax") == 0);
+
+    if (match)
+    {
+        printf("loader match\n");
+    }
+    else
+    {
+        printf("loader mismatch\n");
+    }
+}
+
+static void TestMemoryTrace(){
+    // several blocks of a strided sweep and a scattered read pattern
+    const int num = 100000;
+    const uint64_t base = 0x20000000;
+
+    char filename[] = "/tmp/test_trace_XXXXXX";
+    close(mkstemp(filename));
+    trace_open(filename);
+    for(int i=0; i<num; ++i){
+        cpu_pc.rip = 0x00400000 + (i % 4) * MAX_INSTRUCTION_CHAR;
+        write64bits_vaddr(base + (uint64_t)i * 8,i);
+        read64bits_vaddr(base + (uint64_t)((i * 7919) % num) * 8);
+    }
+    char inst[MAX_INSTRUCTION_CHAR];
+    readinst_vaddr(0x00400000,inst);
+    trace_close();
+
+    int match = 1;
+    uint64_t count = 0;
+    trace_record_t rec;
+    trace_reader_t* reader = trace_reader_open(filename);
+    match = match && (reader != NULL);
+    while(match == 1 && trace_reader_next(reader,&rec) == 1){
+        if(count < 2 * num){
+            int i = count / 2;
+            uint64_t rip = 0x00400000 + (i % 4) * MAX_INSTRUCTION_CHAR;
+            if(count % 2 == 0){
+                match = match && (rec.type == TRACE_STORE && rec.addr == base + (uint64_t)i * 8);
+            }else{
+                match = match && (rec.type == TRACE_LOAD && rec.addr == base + (uint64_t)((i * 7919) % num) * 8);
+            }
+            match = match && (rec.size == 8 && rec.rip == rip);
+        }else{
+            match = match && (rec.type == TRACE_FETCH && rec.addr == 0x00400000 && rec.size == MAX_INSTRUCTION_CHAR);
+        }
+        count += 1;
+    }
+    trace_reader_close(reader);
+    match = match && (count == 2 * num + 1);
+
+    FILE* fp = fopen(filename,"rb");
+    fseek(fp,0,SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    unlink(filename);
+    printf("trace: %lu records in %ld bytes, %.2f bytes per record\n",count,size,(double)size / count);
+
+    if (match)
+    {
+        printf("memory trace match\n");
+    }
+    else
+    {
+        printf("memory trace mismatch\n");
+    }
+}
+
+// brute force LRU cache of num_sets x assoc lines of 64 bytes
+static uint64_t lru_misses(uint64_t* addrs, int num, uint64_t num_sets, uint64_t assoc){
+    uint64_t* tags = calloc(num_sets * assoc,sizeof(uint64_t));
+    uint64_t* times = calloc(num_sets * assoc,sizeof(uint64_t));
+    uint64_t misses = 0;
+    for(int i=0; i<num; ++i){
+        uint64_t block = addrs[i] >> 6;
+        uint64_t* tag = &tags[(block % num_sets) * assoc];
+        uint64_t* time = &times[(block % num_sets) * assoc];
+        uint64_t victim = 0;
+        int hit = 0;
+        for(uint64_t w=0; w<assoc; ++w){
+            if(time[w] != 0 && tag[w] == block){
+                time[w] = i + 1;
+                hit = 1;
+                break;
+            }
+            if(time[w] < time[victim]){
+                victim = w;
+            }
+        }
+        if(hit == 0){
+            misses += 1;
+            tag[victim] = block;
+            time[victim] = i + 1;
+        }
+    }
+    free(tags);
+    free(times);
+    return misses;
+}
+
+static void TestStackDistance(){
+    // loops over arrays of several sizes mixed with random references
+    const int num = 200000;
+    uint64_t* addrs = malloc(num * sizeof(uint64_t));
+    uint32_t seed = 1;
+    for(int i=0; i<num; ++i){
+        seed = seed * 1103515245 + 12345;
+        if(i % 3 == 0){
+            addrs[i] = (seed >> 8) % (1 << 18);
+        }else if(i % 3 == 1){
+            addrs[i] = 0x100000 + (i * 8) % (16 << 10);
+        }else{
+            addrs[i] = 0x200000 + (i * 64) % (256 << 10);
+        }
+    }
+
+    stackdist_t* sd = stackdist_construct(6,8,1024);
+    for(int i=0; i<num; ++i){
+        stackdist_access(sd,addrs[i]);
+    }
+
+    uint64_t configs[6][2] = {{1,1}, {1,64}, {1,1024}, {16,4}, {64,8}, {256,1}};
+    int match = 1;
+    for(int c=0; c<6; ++c){
+        uint64_t expected = lru_misses(addrs,num,configs[c][0],configs[c][1]);
+        uint64_t misses = stackdist_misses(sd,configs[c][0],configs[c][1]);
+        printf("stack distance: %lu sets x %lu ways: %lu misses, lru %lu\n",
+            configs[c][0],configs[c][1],misses,expected);
+        match = match && (misses == expected);
+    }
+    stackdist_free(sd);
+    free(addrs);
+
+    if (match)
+    {
+        printf("stack distance match\n");
+    }
+    else
+    {
+        printf("stack distance mismatch\n");
+    }
+}
+
+static void print_dram_timing(const char* name){
+    printf("dram %s: %lu requests row hit %.3f bank conflicts %lu average latency %.1f\n",name,
+        dram_timing_stats.requests,
+        (double)dram_timing_stats.row_hits / dram_timing_stats.requests,
+        dram_timing_stats.bank_conflicts,
+        (double)dram_timing_stats.total_latency / dram_timing_stats.requests);
+}
+
+static void TestDramTiming(){
+    int match = 1;
+
+    // sequential vs scattered accesses of the emulator
+    dram_timing_enabled = 1;
+    dram_timing_set_policy(DRAM_SCHED_FR_FCFS);
+    dram_timing_reset();
+    uint64_t cycles = cpu_cycles;
+    for(uint64_t i=0; i<8192; ++i){
+        read64bits_dram(0x10000000 + i * 8);
+    }
+    dram_timing_stats_t sequential = dram_timing_stats;
+    // the emulator waits for every read
+    match = match && (cpu_cycles - cycles == sequential.total_latency);
+    print_dram_timing("sequential");
+
+    dram_timing_reset();
+    uint32_t seed = 1;
+    for(uint64_t i=0; i<8192; ++i){
+        seed = seed * 1103515245 + 12345;
+        read64bits_dram(0x10000000 + ((uint64_t)seed & 0x3ffffc0));
+    }
+    dram_timing_stats_t scattered = dram_timing_stats;
+    print_dram_timing("scattered");
+
+    match = match && (sequential.row_hits * 10 > sequential.requests * 9);
+    match = match && (scattered.bank_conflicts * 2 > scattered.requests);
+    match = match && (scattered.total_latency > 2 * sequential.total_latency);
+
+    // two rows of one bank requested alternately: fr-fcfs groups the row hits
+    dram_sched_t policies[2] = {DRAM_SCHED_FCFS, DRAM_SCHED_FR_FCFS};
+    dram_timing_stats_t stats[2];
+    for(int p=0; p<2; ++p){
+        dram_timing_set_policy(policies[p]);
+        dram_timing_reset();
+        for(uint64_t i=0; i<32; ++i){
+            dram_timing_enqueue(i * 64,0,0);
+            dram_timing_enqueue(((uint64_t)1 << 18) + i * 64,0,0);
+        }
+        dram_timing_drain();
+        stats[p] = dram_timing_stats;
+        print_dram_timing(p == 0 ? "fcfs" : "fr-fcfs");
+    }
+    match = match && (stats[0].bank_conflicts == 63 && stats[1].bank_conflicts == 1);
+    match = match && (stats[1].total_latency < stats[0].total_latency);
+
+    // the same by the writes of the emulator: they are posted, so the queue
+    // holds enough of them for fr-fcfs to group the row hits
+    for(int p=0; p<2; ++p){
+        dram_timing_set_policy(policies[p]);
+        dram_timing_reset();
+        cycles = cpu_cycles;
+        for(uint64_t i=0; i<256; ++i){
+            write64bits_dram(0x10000000 + i * 64,0);
+            write64bits_dram(0x10000000 + ((uint64_t)1 << 18) + i * 64,0);
+        }
+        dram_timing_drain();
+        stats[p] = dram_timing_stats;
+        stats[p].cycles = cpu_cycles - cycles;
+        print_dram_timing(p == 0 ? "posted fcfs" : "posted fr-fcfs");
+    }
+    dram_timing_enabled = 0;
+    match = match && (stats[0].bank_conflicts > 500 && stats[1].bank_conflicts * 4 < stats[0].bank_conflicts);
+    match = match && (stats[1].cycles < stats[0].cycles);
+
+    if (match)
+    {
+        printf("dram timing match\n");
+    }
+    else
+    {
+        printf("dram timing mismatch\n");
+    }
+}
+
+static void TestCopyOnWriteFork(){
+    const int num_pages = 64;
+    const uint64_t base = 0x30000000;
+    for(int i=0; i<num_pages; ++i){
+        write64bits_vaddr(base + i * PHYSICAL_PAGE_SIZE,0x1000 + i);
+    }
+    writeinst_dram(va2pa(0x00600000),"syscall");
+
+    // fork
+    paging_stats_t before = paging_stats;
+    uint64_t parent = process_current();
+    cpu_pc.rip = 0x00600000;
+    cpu_reg.rax = SYS_fork;
+    instruction_cycle();
+    uint64_t child = cpu_reg.rax;
+
+    int match = 1;
+    match = match && (child != parent && process_current() == parent);
+    match = match && (paging_stats.cow_shared - before.cow_shared >= num_pages);
+    match = match && (paging_stats.cow_copied == before.cow_copied);
+
+    // the parent writes the first 16 pages: copied
+    for(int i=0; i<16; ++i){
+        write64bits_vaddr(base + i * PHYSICAL_PAGE_SIZE,0x2000 + i);
+    }
+    match = match && (paging_stats.cow_copied - before.cow_copied == 16);
+
+    // the child sees the pages as they were at fork
+    process_switch(child);
+    match = match && (cpu_reg.rax == 0 && cpu_pc.rip == 0x00600000 + MAX_INSTRUCTION_CHAR);
+    for(int i=0; i<num_pages; ++i){
+        match = match && (read64bits_vaddr(base + i * PHYSICAL_PAGE_SIZE) == 0x1000 + i);
+    }
+    // page 0 is no longer shared with the parent, page 20 still is
+    write64bits_vaddr(base,0x3000);
+    write64bits_vaddr(base + 20 * PHYSICAL_PAGE_SIZE,0x3020);
+    match = match && (paging_stats.cow_reused - before.cow_reused == 1);
+    match = match && (paging_stats.cow_copied - before.cow_copied == 17);
+
+    // the child exits: its frames go, the parent runs again
+    uint64_t freed = paging_stats.frames_freed;
+    cpu_pc.rip = 0x00600000;
+    cpu_reg.rax = SYS_exit;
+    cpu_reg.rdi = 0;
+    instruction_cycle();
+    match = match && (process_current() == parent && cpu_reg.rax == child);
+    match = match && (process_get(child)->state == PROCESS_ZOMBIE);
+    match = match && (paging_stats.frames_freed - freed >= 2);
+    for(int i=0; i<num_pages; ++i){
+        uint64_t expected = i < 16 ? 0x2000 + i : 0x1000 + i;
+        match = match && (read64bits_vaddr(base + i * PHYSICAL_PAGE_SIZE) == expected);
+    }
+    // page 20 has one mapping left: written in place
+    write64bits_vaddr(base + 20 * PHYSICAL_PAGE_SIZE,0x2020);
+    match = match && (paging_stats.cow_reused - before.cow_reused == 2);
+
+    printf("fork: shared %lu copied %lu reused %lu freed %lu\n",
+        paging_stats.cow_shared - before.cow_shared,
+        paging_stats.cow_copied - before.cow_copied,
+        paging_stats.cow_reused - before.cow_reused,
+        paging_stats.frames_freed - freed);
+    if (match)
+    {
+        printf("copy on write fork match\n");
+    }
+    else
+    {
+        printf("copy on write fork mismatch\n");
+    }
+}
+
+static void TestGuestMalloc(){
+    int match = 1;
+
+    // brk: query, grow, touch, and shrink back to unmap the pages
+    writeinst_dram(va2pa(0x00600000),"syscall");
+    cpu_pc.rip = 0x00600000;
+    cpu_reg.rax = SYS_brk;
+    cpu_reg.rdi = 0;
+    instruction_cycle();
+    uint64_t heap_start = cpu_reg.rax;
+    match = match && (heap_start == PROCESS_HEAP_START);
+    match = match && (process_sbrk(4 * PHYSICAL_PAGE_SIZE) == heap_start);
+    for(int i=0; i<4; ++i){
+        write64bits_vaddr(heap_start + i * PHYSICAL_PAGE_SIZE,i + 1);
+    }
+    uint64_t freed = paging_stats.frames_freed;
+    cpu_pc.rip = 0x00600000;
+    cpu_reg.rax = SYS_brk;
+    cpu_reg.rdi = heap_start;
+    instruction_cycle();
+    match = match && (cpu_reg.rax == heap_start && paging_stats.frames_freed - freed == 4);
+    match = match && (read64bits_vaddr(heap_start) == 0);
+    // out of the heap: the break does not move
+    match = match && (process_brk(heap_start - 8) == heap_start);
+
+    // a malloc lab like trace: the blocks are stamped and checked
+    const int num_slots = 256;
+    const int num_ops = 8000;
+    uint64_t ptr[256] = {0};
+    uint64_t size[256] = {0};
+    uint32_t seed = 12345;
+
+    heap_stats_t before = heap_stats;
+    for(int op=0; op<num_ops; ++op){
+        seed = seed * 1103515245 + 12345;
+        int i = (seed >> 8) % num_slots;
+        if(ptr[i] != 0){
+            // stamps intact: no block overlaps another
+            match = match && (read64bits_vaddr(ptr[i]) == (uint64_t)i);
+            match = match && (read64bits_vaddr(ptr[i] + ((size[i] - 1) & ~0x7)) == ~(uint64_t)i);
+        }
+        seed = seed * 1103515245 + 12345;
+        uint64_t n = (seed >> 16) % 8 == 0 ? 256 + (seed >> 4) % 4096 : 16 + (seed >> 4) % 112;
+        if(ptr[i] == 0){
+            ptr[i] = heap_malloc(n);
+            size[i] = n;
+        }else if((seed >> 20) % 4 == 0){
+            ptr[i] = heap_realloc(ptr[i],n);
+            size[i] = n;
+            // the first word is kept by realloc
+            match = match && (read64bits_vaddr(ptr[i]) == (uint64_t)i);
+        }else{
+            heap_free(ptr[i]);
+            ptr[i] = 0;
+            continue;
+        }
+        match = match && (ptr[i] % 16 == 0 && heap_usable_size(ptr[i]) >= size[i]);
+        write64bits_vaddr(ptr[i],i);
+        write64bits_vaddr(ptr[i] + ((size[i] - 1) & ~0x7),~(uint64_t)i);
+    }
+    int live = 0;
+    for(int i=0; i<num_slots; ++i){
+        live += ptr[i] != 0;
+        heap_free(ptr[i]);
+    }
+    // every op is counted once, realloc moving its block included
+    uint64_t ops = (heap_stats.mallocs - before.mallocs) + (heap_stats.frees - before.frees)
+        + (heap_stats.reallocs - before.reallocs);
+    match = match && (ops == num_ops + live);
+
+    // utilization: the peak of the payloads over the heap at the end
+    uint64_t heap_size = process_brk(0) - heap_start;
+    match = match && (heap_stats.payload == before.payload);
+    match = match && (heap_utilization() > 0.6 && heap_stats.cache_hits > 0);
+    printf("malloc: util %.1f%% (peak %lu heap %lu) throughput %.0f Kops/s cache hits %lu\n",
+        heap_utilization() * 100,heap_stats.peak_payload,heap_size,heap_throughput() / 1000,heap_stats.cache_hits);
+
+    // all free: the heap is reused, not grown
+    uint64_t p = heap_malloc(heap_size / 4);
+    match = match && (p != 0 && process_brk(0) - heap_start == heap_size);
+    heap_free(p);
+
+    // the last block grows with the heap, by less than a minimum block
+    uint64_t last = heap_malloc(heap_size);
+    write64bits_vaddr(last,0x1234);
+    uint64_t grown = heap_realloc(last,heap_size + 16);
+    match = match && (grown == last && read64bits_vaddr(grown) == 0x1234);
+    match = match && (heap_usable_size(grown) >= heap_size + 16);
+    // the epilogue is still allocated: the next block is below the break
+    match = match && ((read64bits_vaddr(process_brk(0) - 8) & 0x1) == 1);
+    uint64_t small = heap_malloc(24);
+    match = match && (small != 0 && small + 24 <= process_brk(0));
+    heap_free(small);
+    heap_free(grown);
+
+    if (match)
+    {
+        printf("guest malloc match\n");
+    }
+    else
+    {
+        printf("guest malloc mismatch\n");
+    }
+}
+
+// write the lines of an ELF file to a new file in /tmp
+static void write_test_elf(char* filename, const char** lines, int num_lines){
+    int fd = mkstemp(filename);
+    FILE* fp = fdopen(fd,"w");
+    for(int i=0; i<num_lines; ++i){
+        fprintf(fp,"%s\n",lines[i]);
+    }
+    fclose(fp);
+}
+
+// link the ELF lines into the EOF file eof_filename
+static void link_test_eof(const char** lines, int num_lines, const char* eof_filename){
+    char elf_filename[] = "/tmp/test_elf_XXXXXX";
+    write_test_elf(elf_filename,lines,num_lines);
+    elf_t src;
+    parse_elf(elf_filename,&src);
+    unlink(elf_filename);
+
+    elf_t* srcp[1] = {&src};
+    elf_t dst;
+    link_elf(srcp,1,&dst);
+    write_eof(eof_filename,&dst);
+    free_elf(&dst);
+    free_elf(&src);
+}
+
+static void TestLazyBinding(){
+    // two shared images: only the first one exports what is called
+    const char* lib_add[8] = {
+        "8",
+        "2",
+        ".text,0x0,4,3",
+        ".symtab,0x0,7,1",
+        "mov    %rdi,%rax",
+        "add    %rsi,%rax",
+        "retq",
+        "ext_add,STB_GLOBAL,STT_FUNC,.text,0,3",
+    };
+    const char* lib_unused[6] = {
+        "6",
+        "2",
+        ".text,0x0,4,1",
+        ".symtab,0x0,5,1",
+        "retq",
+        "ext_unused,STB_GLOBAL,STT_FUNC,.text,0,1",
+    };
+    // main calls ext_add(ext_add(rdi, rsi), rsi)
+    const char* caller[13] = {
+        "13",
+        "3",
+        ".text,0x0,5,4",
+        ".symtab,0x0,9,2",
+        ".rel.text,0x0,11,2",
+        "callq  0x0000000000000000   // ext_add",
+        "mov    %rax,%rdi",
+        "callq  0x0000000000000000   // ext_add",
+        "retq",
+        "main,STB_GLOBAL,STT_FUNC,.text,0,4",
+        "ext_add,STB_GLOBAL,STT_NOTYPE,SHN_UNDEF,0,0",
+        "0,7,R_X86_64_PLT32,1,-4",
+        "2,7,R_X86_64_PLT32,1,-4",
+    };
+
+    char lib_add_fn[] = "/tmp/test_lib_add_XXXXXX";
+    char lib_unused_fn[] = "/tmp/test_lib_unused_XXXXXX";
+    char exe_fn[] = "/tmp/test_exe_XXXXXX";
+    close(mkstemp(lib_add_fn));
+    close(mkstemp(lib_unused_fn));
+    close(mkstemp(exe_fn));
+
+    link_set_base(0x10000000);
+    link_test_eof(lib_add,8,lib_add_fn);
+    link_set_base(0x20000000);
+    link_test_eof(lib_unused,6,lib_unused_fn);
+    link_set_base(0x00400000);
+    char* needed[2] = {lib_add_fn,lib_unused_fn};
+    link_set_needed(needed,2);
+    link_test_eof(caller,13,exe_fn);
+    link_set_needed(NULL,0);
+
+    dynamic_stats_t before = dynamic_stats;
+    load_eof(exe_fn);
+
+    // nothing is resolved at load time
+    int match = 1;
+    match = match && (dynamic_stats.resolutions == before.resolutions);
+    match = match && (dynamic_stats.images_loaded == before.images_loaded);
+
+    cpu_reg.rdi = 5;
+    cpu_reg.rsi = 7;
+    cpu_reg.rsp = 0x7ffffffee0f0;
+    write64bits_vaddr(0x7ffffffee0f0,0x0000000000000000);
+
+    // the first call runs the resolver, the second one jumps through the GOT
+    uint64_t got = loader_section_address(".got.plt");
+    uint64_t unbound = read64bits_vaddr(got);
+    cpu_pc.rip = 0x00400000;
+    for(int i=0; i<15; ++i){
+        instruction_cycle();
+    }
+    match = match && (cpu_reg.rax == 19);
+    match = match && (cpu_pc.rip == 0x00400000 + 3 * MAX_INSTRUCTION_CHAR);
+    match = match && (cpu_reg.rsp == 0x7ffffffee0f0);
+    match = match && (dynamic_stats.resolutions - before.resolutions == 1);
+    match = match && (dynamic_stats.images_loaded - before.images_loaded == 1);
+    match = match && (got != 0 && unbound != 0x10000000 && read64bits_vaddr(got) == 0x10000000);
+
+    unlink(exe_fn);
+    unlink(lib_add_fn);
+    unlink(lib_unused_fn);
+
+    if (match)
+    {
+        printf("lazy binding match\n");
+    }
+    else
+    {
+        printf("lazy binding mismatch\n");
+    }
+}
+
+static void TestLinkedProgram(){
+    // link sum and main as the linker test does, then load and run the EOF
+    elf_t src[2];
+    parse_elf("./files/exe/sum.elf.txt",&src[0]);
+    parse_elf("./files/exe/main.elf.txt",&src[1]);
+    elf_t* srcp[2] = {&src[0],&src[1]};
+    elf_t dst;
+    link_elf(srcp,2,&dst);
+    char exe_fn[] = "/tmp/test_exe_XXXXXX";
+    close(mkstemp(exe_fn));
+    write_eof(exe_fn,&dst);
+    free_elf(&dst);
+    free_elf(&src[0]);
+    free_elf(&src[1]);
+
+    load_eof(exe_fn);
+    uint64_t text = loader_section_address(".text");
+    uint64_t data = loader_section_address(".data");
+
+    // sum is rows 0 to 21 of .text, main rows 22 to 31
+    cpu_reg.rsp = 0x7ffffffee0f0;
+    write64bits_vaddr(0x7ffffffee0f0,0x0000000000000000);
+    cpu_pc.rip = text + 22 * MAX_INSTRUCTION_CHAR;
+    for(int i=0; i<6; ++i){
+        instruction_cycle();
+    }
+    // main calls sum(array, 2)
+    int match = 1;
+    match = match && (cpu_pc.rip == text);
+    match = match && (cpu_reg.rdi == data && cpu_reg.rsi == 2);
+
+    // the loop of sum is in x86 byte offsets the emulator cannot branch to:
+    // stand in for it with s = array[0] + array[1] and resume at the load of bias
+    for(int i=0; i<4; ++i){
+        instruction_cycle();
+    }
+    write64bits_vaddr(cpu_reg.rbp - 0x8,read64bits_vaddr(data) + read64bits_vaddr(data + 8));
+    cpu_pc.rip = text + 17 * MAX_INSTRUCTION_CHAR;
+    for(int i=0; i<5; ++i){
+        instruction_cycle();
+    }
+    match = match && (cpu_pc.rip == text + 28 * MAX_INSTRUCTION_CHAR);
+    for(int i=0; i<4; ++i){
+        instruction_cycle();
+    }
+    // array[0] + array[1] + bias
+    match = match && (cpu_reg.rax == 0x0000000f1234abcd);
+    match = match && (cpu_reg.rsp == 0x7ffffffee0f8 && cpu_pc.rip == 0);
+
+    unlink(exe_fn);
+
+    if (match)
+    {
+        printf("linked program match\n");
+    }
+    else
+    {
+        printf("linked program mismatch\n");
+    }
+}
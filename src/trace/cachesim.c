@@ -0,0 +1,74 @@
+// Miss ratio of many LRU cache configurations from one memory trace
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "headers/common.h"
+#include "headers/trace.h"
+
+/*
+usage: ./bin/cachesim trace [line bytes]
+
+Prints the miss ratio of the data references (loads and stores) for the
+caches of 4KB to 4MB, direct mapped to 16 ways, and fully associative.
+*/
+#define MIN_CACHE_LENGTH    (12)    // 4KB
+#define MAX_CACHE_LENGTH    (22)    // 4MB
+#define MAX_ASSOC_LENGTH    (4)     // 16 ways
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        printf("usage: %s trace [line bytes]\n",argv[0]);
+        exit(1);
+    }
+    int line_length = 6;
+    if(argc >= 3){
+        uint64_t line = string2uint(argv[2]);
+        line_length = 0;
+        while(((uint64_t)1 << line_length) < line){
+            line_length += 1;
+        }
+    }
+
+    trace_reader_t* reader = trace_reader_open(argv[1]);
+    if(reader == NULL){
+        printf("unable to read the trace %s\n",argv[1]);
+        exit(1);
+    }
+
+    // the fully associative cache of the largest size is the single set config
+    uint64_t max_lines = (uint64_t)1 << (MAX_CACHE_LENGTH - line_length);
+    int max_sets_length = MAX_CACHE_LENGTH - line_length;
+    stackdist_t* sd = stackdist_construct(line_length,max_sets_length,max_lines);
+
+    trace_record_t rec;
+    while(trace_reader_next(reader,&rec) == 1){
+        if(rec.type != TRACE_FETCH){
+            stackdist_access(sd,rec.addr);
+        }
+    }
+    trace_reader_close(reader);
+
+    uint64_t refs = stackdist_references(sd);
+    printf("%lu data references, %d byte lines\n",refs,1 << line_length);
+    printf("%-8s","size");
+    for(int a=0; a<=MAX_ASSOC_LENGTH; ++a){
+        printf("%8d-way",1 << a);
+    }
+    printf("%12s\n","full");
+
+    for(int c=MIN_CACHE_LENGTH; c<=MAX_CACHE_LENGTH; ++c){
+        uint64_t lines = (uint64_t)1 << (c - line_length);
+        printf("%6luKB",((uint64_t)1 << c) >> 10);
+        for(int a=0; a<=MAX_ASSOC_LENGTH; ++a){
+            uint64_t assoc = (uint64_t)1 << a;
+            double ratio = refs == 0 ? 0 : (double)stackdist_misses(sd,lines / assoc,assoc) / refs;
+            printf("%12.4f",ratio);
+        }
+        double ratio = refs == 0 ? 0 : (double)stackdist_misses(sd,1,lines) / refs;
+        printf("%12.4f\n",ratio);
+    }
+
+    stackdist_free(sd);
+    return 0;
+}
@@ -0,0 +1,317 @@
+// LRU stack distances: the miss ratio of many cache configurations in one pass
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "headers/trace.h"
+
+/*
+Mattson: in an LRU cache of associativity A, a reference hits if and only
+if fewer than A distinct blocks of its set were referenced since the last
+reference to its block. That count is the stack distance, so the
+histogram of distances gives the misses of every associativity at once:
+
+    misses(A) = cold misses + sum of hist[d] for d >= A
+
+Olken: the distance is the count of blocks whose last reference is later
+than the last reference to this block. Keeping the last reference times
+in a balanced search tree with subtree sizes, it is an O(log n) rank query
+instead of an O(n) walk of the LRU stack.
+
+One tree per set, and one group of trees per count of sets (1, 2, 4, ...),
+so all the cache sizes and associativities are covered in a single pass.
+*/
+
+typedef struct TREAP_NODE_STRUCT{
+    uint64_t                    key;    // time of the last reference to a block
+    uint32_t                    priority;
+    uint64_t                    size;   // nodes in the subtree
+    struct TREAP_NODE_STRUCT*   left;
+    struct TREAP_NODE_STRUCT*   right;
+}treap_node_t;
+
+typedef struct{
+    uint64_t    block;
+    uint64_t    time;   // 0 if the slot is empty
+}last_ref_t;
+
+struct STACKDIST_STRUCT{
+    int             line_length;
+    int             num_configs;        // set counts 1, 2, 4, ... (1 << (num_configs - 1))
+    uint64_t        max_distance;       // distances >= max_distance share the last bucket
+
+    treap_node_t**  trees;              // trees[config][set], flattened
+    uint64_t**      hist;               // hist[config][distance]
+    uint64_t        cold_misses;
+    uint64_t        references;
+    uint64_t        time;
+
+    // block -> time of its last reference, open addressing
+    last_ref_t*     last;
+    uint64_t        last_size;
+    uint64_t        last_count;
+
+    treap_node_t*   free_nodes;
+    uint32_t        seed;
+};
+
+/*======================================*/
+/*      treap with subtree sizes        */
+/*======================================*/
+
+static inline uint64_t node_size(treap_node_t* t){
+    return t == NULL ? 0 : t->size;
+}
+
+static inline void node_update(treap_node_t* t){
+    t->size = 1 + node_size(t->left) + node_size(t->right);
+}
+
+// split t into keys < key and keys >= key
+static void treap_split(treap_node_t* t, uint64_t key, treap_node_t** l, treap_node_t** r){
+    if(t == NULL){
+        *l = NULL;
+        *r = NULL;
+        return;
+    }
+    if(t->key < key){
+        treap_split(t->right,key,&t->right,r);
+        *l = t;
+    }else{
+        treap_split(t->left,key,l,&t->left);
+        *r = t;
+    }
+    node_update(t);
+}
+
+static treap_node_t* treap_merge(treap_node_t* l, treap_node_t* r){
+    if(l == NULL){
+        return r;
+    }
+    if(r == NULL){
+        return l;
+    }
+    if(l->priority > r->priority){
+        l->right = treap_merge(l->right,r);
+        node_update(l);
+        return l;
+    }
+    r->left = treap_merge(l,r->left);
+    node_update(r);
+    return r;
+}
+
+// count of keys greater than key
+static uint64_t treap_count_greater(treap_node_t* t, uint64_t key){
+    uint64_t count = 0;
+    while(t != NULL){
+        if(key < t->key){
+            count += 1 + node_size(t->right);
+            t = t->left;
+        }else{
+            t = t->right;
+        }
+    }
+    return count;
+}
+
+static treap_node_t* new_node(stackdist_t* sd, uint64_t key){
+    treap_node_t* n = sd->free_nodes;
+    if(n != NULL){
+        sd->free_nodes = n->left;
+    }else{
+        n = malloc(sizeof(treap_node_t));
+    }
+    // xorshift
+    sd->seed ^= sd->seed << 13;
+    sd->seed ^= sd->seed >> 17;
+    sd->seed ^= sd->seed << 5;
+
+    n->key = key;
+    n->priority = sd->seed;
+    n->size = 1;
+    n->left = NULL;
+    n->right = NULL;
+    return n;
+}
+
+// the new key is the latest time: it goes to the right end
+static treap_node_t* treap_append(stackdist_t* sd, treap_node_t* t, uint64_t key){
+    return treap_merge(t,new_node(sd,key));
+}
+
+static treap_node_t* treap_remove(stackdist_t* sd, treap_node_t* t, uint64_t key){
+    treap_node_t *l, *m, *r;
+    treap_split(t,key,&l,&m);
+    treap_split(m,key + 1,&m,&r);
+    assert(m != NULL && m->size == 1);
+    m->left = sd->free_nodes;
+    sd->free_nodes = m;
+    return treap_merge(l,r);
+}
+
+static void treap_free(treap_node_t* t){
+    if(t == NULL){
+        return;
+    }
+    treap_free(t->left);
+    treap_free(t->right);
+    free(t);
+}
+
+/*======================================*/
+/*      last reference of the blocks    */
+/*======================================*/
+
+static inline uint64_t block_hash(uint64_t block){
+    return block * 0x9e3779b97f4a7c15;
+}
+
+static last_ref_t* last_ref_slot(stackdist_t* sd, uint64_t block){
+    uint64_t mask = sd->last_size - 1;
+    uint64_t i = block_hash(block) & mask;
+    while(sd->last[i].time != 0 && sd->last[i].block != block){
+        i = (i + 1) & mask;
+    }
+    return &sd->last[i];
+}
+
+static void last_ref_grow(stackdist_t* sd){
+    last_ref_t* old = sd->last;
+    uint64_t old_size = sd->last_size;
+
+    sd->last_size = old_size * 2;
+    sd->last = calloc(sd->last_size,sizeof(last_ref_t));
+    for(uint64_t i=0; i<old_size; ++i){
+        if(old[i].time != 0){
+            *last_ref_slot(sd,old[i].block) = old[i];
+        }
+    }
+    free(old);
+}
+
+/*======================================*/
+/*          exposed interface           */
+/*======================================*/
+
+/**
+ * @brief stack distances for the caches with lines of (1 << line_length)
+ *        bytes and 1, 2, 4, ... (1 << max_sets_length) sets
+ *
+ * @param line_length
+ * @param max_sets_length
+ * @param max_distance associativities up to max_distance are exact
+ * @return stackdist_t*
+ */
+stackdist_t* stackdist_construct(int line_length, int max_sets_length, uint64_t max_distance){
+    assert(max_sets_length >= 0 && max_sets_length < 32 && max_distance > 0);
+
+    stackdist_t* sd = calloc(1,sizeof(stackdist_t));
+    sd->line_length = line_length;
+    sd->num_configs = max_sets_length + 1;
+    sd->max_distance = max_distance;
+
+    // 1 + 2 + 4 + ... trees
+    sd->trees = calloc(((uint64_t)2 << max_sets_length) - 1,sizeof(treap_node_t*));
+    sd->hist = calloc(sd->num_configs,sizeof(uint64_t*));
+    for(int c=0; c<sd->num_configs; ++c){
+        sd->hist[c] = calloc(max_distance + 1,sizeof(uint64_t));
+    }
+
+    sd->last_size = 1024;
+    sd->last = calloc(sd->last_size,sizeof(last_ref_t));
+    sd->seed = 2463534242;
+    return sd;
+}
+
+void stackdist_free(stackdist_t* sd){
+    if(sd == NULL){
+        return;
+    }
+    uint64_t num_trees = ((uint64_t)1 << sd->num_configs) - 1;
+    for(uint64_t i=0; i<num_trees; ++i){
+        treap_free(sd->trees[i]);
+    }
+    while(sd->free_nodes != NULL){
+        treap_node_t* next = sd->free_nodes->left;
+        free(sd->free_nodes);
+        sd->free_nodes = next;
+    }
+    for(int c=0; c<sd->num_configs; ++c){
+        free(sd->hist[c]);
+    }
+    free(sd->hist);
+    free(sd->trees);
+    free(sd->last);
+    free(sd);
+}
+
+/**
+ * @brief one reference to the byte addr
+ *
+ * @param sd
+ * @param addr
+ */
+void stackdist_access(stackdist_t* sd, uint64_t addr){
+    uint64_t block = addr >> sd->line_length;
+    sd->references += 1;
+    sd->time += 1;
+
+    if(sd->last_count * 2 >= sd->last_size){
+        last_ref_grow(sd);
+    }
+    last_ref_t* slot = last_ref_slot(sd,block);
+    uint64_t last = slot->time;
+    if(last == 0){
+        sd->cold_misses += 1;
+        sd->last_count += 1;
+        slot->block = block;
+    }
+    slot->time = sd->time;
+
+    // the trees of the config with (1 << c) sets start at (1 << c) - 1
+    for(int c=0; c<sd->num_configs; ++c){
+        uint64_t set = block & (((uint64_t)1 << c) - 1);
+        treap_node_t** tree = &sd->trees[((uint64_t)1 << c) - 1 + set];
+
+        if(last != 0){
+            uint64_t distance = treap_count_greater(*tree,last);
+            if(distance > sd->max_distance){
+                distance = sd->max_distance;
+            }
+            sd->hist[c][distance] += 1;
+            *tree = treap_remove(sd,*tree,last);
+        }
+        *tree = treap_append(sd,*tree,sd->time);
+    }
+}
+
+/**
+ * @brief misses of the LRU cache with num_sets sets of assoc lines
+ *
+ * @param sd
+ * @param num_sets power of 2, at most (1 << max_sets_length)
+ * @param assoc at most max_distance
+ * @return uint64_t
+ */
+uint64_t stackdist_misses(stackdist_t* sd, uint64_t num_sets, uint64_t assoc){
+    assert(num_sets != 0 && (num_sets & (num_sets - 1)) == 0);
+    assert(assoc > 0 && assoc <= sd->max_distance);
+
+    int c = 0;
+    while(((uint64_t)1 << c) < num_sets){
+        c += 1;
+    }
+    assert(c < sd->num_configs);
+
+    uint64_t misses = sd->cold_misses;
+    for(uint64_t d=assoc; d<=sd->max_distance; ++d){
+        misses += sd->hist[c][d];
+    }
+    return misses;
+}
+
+uint64_t stackdist_references(stackdist_t* sd){
+    return sd->references;
+}
@@ -0,0 +1,218 @@
+// Encoding of the memory access trace, shared by the writer and the reader
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "headers/trace.h"
+
+/*======================================*/
+/*          record encoding             */
+/*======================================*/
+
+static inline uint64_t zigzag(int64_t v){
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t u){
+    return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+static inline uint64_t put_varint(uint8_t* buf, uint64_t v){
+    uint64_t n = 0;
+    while(v >= 0x80){
+        buf[n] = (uint8_t)(v | 0x80);
+        v >>= 7;
+        n += 1;
+    }
+    buf[n] = (uint8_t)v;
+    return n + 1;
+}
+
+static inline uint64_t get_varint(const uint8_t* buf, uint64_t* v){
+    uint64_t n = 0;
+    uint64_t val = 0;
+    int shift = 0;
+    while(buf[n] & 0x80){
+        val |= (uint64_t)(buf[n] & 0x7f) << shift;
+        shift += 7;
+        n += 1;
+    }
+    val |= (uint64_t)buf[n] << shift;
+    *v = val;
+    return n + 1;
+}
+
+/**
+ * @brief encode rec as the delta from prev, prev is updated to rec
+ *
+ * @param buf at least TRACE_RECORD_MAX_SIZE bytes
+ * @param rec
+ * @param prev
+ * @return uint64_t bytes written
+ */
+uint64_t trace_encode(uint8_t* buf, trace_record_t* rec, trace_record_t* prev){
+    assert(rec->size != 0 && (rec->size & (rec->size - 1)) == 0 && rec->size <= 128);
+
+    uint8_t size_log2 = 0;
+    while(((uint32_t)1 << size_log2) < rec->size){
+        size_log2 += 1;
+    }
+    int same_rip = rec->rip == prev->rip;
+    buf[0] = (uint8_t)rec->type | (size_log2 << 2) | (same_rip << 5);
+
+    uint64_t n = 1;
+    n += put_varint(buf + n,zigzag((int64_t)(rec->addr - prev->addr)));
+    if(same_rip == 0){
+        n += put_varint(buf + n,zigzag((int64_t)(rec->rip - prev->rip)));
+    }
+    *prev = *rec;
+    return n;
+}
+
+/**
+ * @brief decode one record following prev, prev is updated to rec
+ *
+ * @param buf
+ * @param rec
+ * @param prev
+ * @return uint64_t bytes read
+ */
+uint64_t trace_decode(const uint8_t* buf, trace_record_t* rec, trace_record_t* prev){
+    uint8_t head = buf[0];
+    rec->type = (trace_type_t)(head & 0x3);
+    rec->size = (uint32_t)1 << ((head >> 2) & 0x7);
+
+    uint64_t n = 1;
+    uint64_t delta;
+    n += get_varint(buf + n,&delta);
+    rec->addr = prev->addr + (uint64_t)unzigzag(delta);
+    rec->rip = prev->rip;
+    if((head & 0x20) == 0){
+        n += get_varint(buf + n,&delta);
+        rec->rip = prev->rip + (uint64_t)unzigzag(delta);
+    }
+    *prev = *rec;
+    return n;
+}
+
+/*======================================*/
+/*          block compression           */
+/*======================================*/
+
+/*
+A sequence of
+
+    varint      literal length
+                literals
+    varint      match length - TRACE_MIN_MATCH
+    varint      match offset, backwards from the output position
+
+and the last sequence has literals only. The matches are found with a
+hash table on the next 4 bytes; the record stream of a loop repeats
+the same deltas, so the matches are long and frequent.
+*/
+#define TRACE_MIN_MATCH     (4)
+#define TRACE_HASH_LENGTH   (12)
+#define TRACE_HASH_SIZE     (1 << TRACE_HASH_LENGTH)
+
+static inline uint32_t hash4(const uint8_t* p){
+    uint32_t v;
+    memcpy(&v,p,sizeof(uint32_t));
+    return (v * 2654435761u) >> (32 - TRACE_HASH_LENGTH);
+}
+
+/**
+ * @brief compress [src, src + len) into dst
+ *
+ * @param src
+ * @param len
+ * @param dst
+ * @param cap capacity of dst
+ * @return uint64_t compressed size, 0 if it does not fit in cap
+ */
+uint64_t trace_compress(const uint8_t* src, uint64_t len, uint8_t* dst, uint64_t cap){
+    // position + 1 of the last 4 bytes with the hash, 0 if none
+    uint32_t table[TRACE_HASH_SIZE];
+    memset(table,0,sizeof(table));
+
+    uint64_t out = 0;
+    uint64_t anchor = 0;    // start of the pending literals
+    uint64_t pos = 0;
+    while(pos + TRACE_MIN_MATCH <= len){
+        uint32_t h = hash4(src + pos);
+        uint64_t candidate = table[h];
+        table[h] = (uint32_t)(pos + 1);
+
+        if(candidate == 0 || memcmp(src + candidate - 1,src + pos,TRACE_MIN_MATCH) != 0){
+            pos += 1;
+            continue;
+        }
+        candidate -= 1;
+        uint64_t match = TRACE_MIN_MATCH;
+        while(pos + match < len && src[candidate + match] == src[pos + match]){
+            match += 1;
+        }
+
+        uint64_t literals = pos - anchor;
+        if(out + literals + 30 > cap){
+            return 0;
+        }
+        out += put_varint(dst + out,literals);
+        memcpy(dst + out,src + anchor,literals);
+        out += literals;
+        out += put_varint(dst + out,match - TRACE_MIN_MATCH);
+        out += put_varint(dst + out,pos - candidate);
+
+        pos += match;
+        anchor = pos;
+    }
+
+    uint64_t literals = len - anchor;
+    if(out + literals + 10 > cap){
+        return 0;
+    }
+    out += put_varint(dst + out,literals);
+    memcpy(dst + out,src + anchor,literals);
+    out += literals;
+    return out;
+}
+
+/**
+ * @brief decompress into exactly raw_len bytes of dst
+ *
+ * @param src
+ * @param len
+ * @param dst
+ * @param raw_len
+ * @return int 1 on success, 0 if the block is corrupted
+ */
+int trace_decompress(const uint8_t* src, uint64_t len, uint8_t* dst, uint64_t raw_len){
+    uint64_t in = 0;
+    uint64_t out = 0;
+    while(in < len){
+        uint64_t literals;
+        in += get_varint(src + in,&literals);
+        if(in + literals > len || out + literals > raw_len){
+            return 0;
+        }
+        memcpy(dst + out,src + in,literals);
+        in += literals;
+        out += literals;
+        if(in == len){
+            break;
+        }
+
+        uint64_t match, offset;
+        in += get_varint(src + in,&match);
+        in += get_varint(src + in,&offset);
+        match += TRACE_MIN_MATCH;
+        if(offset == 0 || offset > out || out + match > raw_len){
+            return 0;
+        }
+        // the match may overlap the bytes it produces
+        for(uint64_t i=0; i<match; ++i){
+            dst[out + i] = dst[out + i - offset];
+        }
+        out += match;
+    }
+    return out == raw_len;
+}
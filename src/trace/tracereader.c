@@ -0,0 +1,104 @@
+// Reader of the memory access trace, independent of the emulator
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "headers/trace.h"
+
+struct TRACE_READER_STRUCT{
+    FILE*           fp;
+    uint8_t*        raw;        // the decoded block
+    uint8_t*        stored;
+    uint32_t        raw_size;
+    uint32_t        pos;        // next record in raw
+    uint32_t        num_left;   // records left in raw
+    trace_record_t  prev;
+};
+
+static int read_uint32(FILE* fp, uint32_t* v){
+    uint8_t buf[4];
+    if(fread(buf,1,4,fp) != 4){
+        return 0;
+    }
+    *v = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+    return 1;
+}
+
+/**
+ * @brief open the trace written by trace_open()
+ *
+ * @param filename
+ * @return trace_reader_t* NULL if it is not a trace file
+ */
+trace_reader_t* trace_reader_open(const char* filename){
+    FILE* fp = fopen(filename,"rb");
+    if(fp == NULL){
+        return NULL;
+    }
+    char magic[4];
+    uint32_t version;
+    if(fread(magic,1,4,fp) != 4 || memcmp(magic,TRACE_MAGIC,4) != 0 ||
+        read_uint32(fp,&version) == 0 || version != TRACE_VERSION){
+        fclose(fp);
+        return NULL;
+    }
+
+    trace_reader_t* reader = calloc(1,sizeof(trace_reader_t));
+    reader->fp = fp;
+    reader->raw = malloc(TRACE_BLOCK_SIZE);
+    reader->stored = malloc(TRACE_BLOCK_SIZE);
+    return reader;
+}
+
+static int next_block(trace_reader_t* reader){
+    uint32_t raw_size, stored_size, num_records, flags;
+    if(read_uint32(reader->fp,&raw_size) == 0){
+        // end of the trace
+        return 0;
+    }
+    if(read_uint32(reader->fp,&stored_size) == 0 ||
+        read_uint32(reader->fp,&num_records) == 0 ||
+        read_uint32(reader->fp,&flags) == 0 ||
+        raw_size > TRACE_BLOCK_SIZE || stored_size > TRACE_BLOCK_SIZE){
+        printf("trace: corrupted block header\n");
+        exit(1);
+    }
+
+    uint8_t* dst = (flags & TRACE_BLOCK_COMPRESSED) ? reader->stored : reader->raw;
+    if(fread(dst,1,stored_size,reader->fp) != stored_size){
+        printf("trace: truncated block\n");
+        exit(1);
+    }
+    if((flags & TRACE_BLOCK_COMPRESSED) &&
+        trace_decompress(reader->stored,stored_size,reader->raw,raw_size) == 0){
+        printf("trace: corrupted block\n");
+        exit(1);
+    }
+
+    reader->raw_size = raw_size;
+    reader->pos = 0;
+    reader->num_left = num_records;
+    memset(&reader->prev,0,sizeof(trace_record_t));
+    return 1;
+}
+
+int trace_reader_next(trace_reader_t* reader, trace_record_t* rec){
+    while(reader->num_left == 0){
+        if(next_block(reader) == 0){
+            return 0;
+        }
+    }
+    reader->pos += trace_decode(reader->raw + reader->pos,rec,&reader->prev);
+    reader->num_left -= 1;
+    return 1;
+}
+
+void trace_reader_close(trace_reader_t* reader){
+    if(reader == NULL){
+        return;
+    }
+    fclose(reader->fp);
+    free(reader->raw);
+    free(reader->stored);
+    free(reader);
+}
@@ -0,0 +1,195 @@
+// Capture of the memory accesses of the emulator
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "headers/common.h"
+#include "headers/trace.h"
+
+/*
+The emulator encodes the records into a ring of blocks. A full block is
+handed to the writer thread, which compresses it and writes it out, so
+the emulator only waits when the whole ring is waiting for the disk.
+
+    ring:   [ written ] [ full ] [ full ] [ filling ]
+                 ^ head                       ^ fill
+*/
+#define TRACE_NUM_BLOCKS    (4)
+
+typedef struct{
+    uint8_t     raw[TRACE_BLOCK_SIZE];
+    uint32_t    size;
+    uint32_t    num_records;
+}trace_block_t;
+
+typedef struct{
+    FILE*               fp;
+    trace_block_t*      blocks;
+    int                 head;       // next block to write
+    int                 fill;       // block being filled by the emulator
+    int                 num_full;   // blocks waiting for the writer thread
+    int                 closing;
+    trace_record_t      prev;       // delta base of the block being filled
+
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      full;       // a block is ready for the writer
+    pthread_cond_t      empty;      // a block is free for the emulator
+}trace_writer_t;
+
+static trace_writer_t* writer = NULL;
+
+static void write_uint32(FILE* fp, uint32_t v){
+    uint8_t buf[4] = {v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, (v >> 24) & 0xff};
+    if(fwrite(buf,1,4,fp) != 4){
+        printf("trace: unable to write the trace file\n");
+        exit(1);
+    }
+}
+
+static void write_block(FILE* fp, trace_block_t* block, uint8_t* stored){
+    uint64_t stored_size = trace_compress(block->raw,block->size,stored,TRACE_BLOCK_SIZE);
+    uint32_t flags = TRACE_BLOCK_COMPRESSED;
+    const uint8_t* payload = stored;
+    if(stored_size == 0 || stored_size >= block->size){
+        // incompressible: keep the raw block
+        stored_size = block->size;
+        flags = 0;
+        payload = block->raw;
+    }
+
+    write_uint32(fp,block->size);
+    write_uint32(fp,(uint32_t)stored_size);
+    write_uint32(fp,block->num_records);
+    write_uint32(fp,flags);
+    if(fwrite(payload,1,stored_size,fp) != stored_size){
+        printf("trace: unable to write the trace file\n");
+        exit(1);
+    }
+}
+
+static void* writer_thread(void* arg){
+    uint8_t* stored = malloc(TRACE_BLOCK_SIZE);
+
+    pthread_mutex_lock(&writer->lock);
+    while(1){
+        while(writer->num_full == 0 && writer->closing == 0){
+            pthread_cond_wait(&writer->full,&writer->lock);
+        }
+        if(writer->num_full == 0){
+            break;
+        }
+        trace_block_t* block = &writer->blocks[writer->head];
+        pthread_mutex_unlock(&writer->lock);
+
+        write_block(writer->fp,block,stored);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->head = (writer->head + 1) % TRACE_NUM_BLOCKS;
+        writer->num_full -= 1;
+        pthread_cond_signal(&writer->empty);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    free(stored);
+    return NULL;
+}
+
+// hand the block being filled to the writer thread
+static void submit_block(){
+    pthread_mutex_lock(&writer->lock);
+    writer->num_full += 1;
+    pthread_cond_signal(&writer->full);
+    while(writer->num_full == TRACE_NUM_BLOCKS){
+        pthread_cond_wait(&writer->empty,&writer->lock);
+    }
+    writer->fill = (writer->fill + 1) % TRACE_NUM_BLOCKS;
+    pthread_mutex_unlock(&writer->lock);
+
+    trace_block_t* block = &writer->blocks[writer->fill];
+    block->size = 0;
+    block->num_records = 0;
+    memset(&writer->prev,0,sizeof(trace_record_t));
+}
+
+/**
+ * @brief start capturing the memory accesses into filename
+ *
+ * @param filename
+ */
+void trace_open(const char* filename){
+    assert(writer == NULL);
+    FILE* fp = fopen(filename,"wb");
+    if(fp == NULL){
+        printf("trace: unable to open %s\n",filename);
+        exit(1);
+    }
+    if(fwrite(TRACE_MAGIC,1,4,fp) != 4){
+        printf("trace: unable to write %s\n",filename);
+        exit(1);
+    }
+    write_uint32(fp,TRACE_VERSION);
+
+    writer = calloc(1,sizeof(trace_writer_t));
+    writer->fp = fp;
+    writer->blocks = calloc(TRACE_NUM_BLOCKS,sizeof(trace_block_t));
+    pthread_mutex_init(&writer->lock,NULL);
+    pthread_cond_init(&writer->full,NULL);
+    pthread_cond_init(&writer->empty,NULL);
+    if(pthread_create(&writer->thread,NULL,&writer_thread,NULL) != 0){
+        printf("trace: unable to create the writer thread\n");
+        exit(1);
+    }
+
+    add_cleanup_event(&trace_close);
+    trace_capture_enabled = 1;
+}
+
+/**
+ * @brief record one access
+ *
+ * @param type
+ * @param addr virtual address
+ * @param size bytes, power of 2
+ * @param rip
+ */
+void trace_capture(trace_type_t type, uint64_t addr, uint32_t size, uint64_t rip){
+    trace_block_t* block = &writer->blocks[writer->fill];
+    if(block->size + TRACE_RECORD_MAX_SIZE > TRACE_BLOCK_SIZE){
+        submit_block();
+        block = &writer->blocks[writer->fill];
+    }
+
+    trace_record_t rec = {type, size, addr, rip};
+    block->size += trace_encode(block->raw + block->size,&rec,&writer->prev);
+    block->num_records += 1;
+}
+
+/**
+ * @brief flush the last block and wait for the writer thread
+ */
+void trace_close(){
+    if(writer == NULL){
+        return;
+    }
+    trace_capture_enabled = 0;
+
+    pthread_mutex_lock(&writer->lock);
+    if(writer->blocks[writer->fill].num_records > 0){
+        writer->num_full += 1;
+    }
+    writer->closing = 1;
+    pthread_cond_signal(&writer->full);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread,NULL);
+
+    fclose(writer->fp);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->full);
+    pthread_cond_destroy(&writer->empty);
+    free(writer->blocks);
+    free(writer);
+    writer = NULL;
+}